@@ -131,5 +131,6 @@ board board_cuatro = {
   .set_siren = fake_siren_set,
   .set_bootkick = cuatro_set_bootkick,
   .read_som_gpio = tres_read_som_gpio,
-  .set_amp_enabled = cuatro_set_amp_enabled
+  .set_amp_enabled = cuatro_set_amp_enabled,
+  .set_spi_data_ready = tres_set_spi_data_ready
 };
@@ -130,5 +130,6 @@ board board_red = {
   .set_ir_power = unused_set_ir_power,
   .set_siren = unused_set_siren,
   .read_som_gpio = unused_read_som_gpio,
-  .set_amp_enabled = unused_set_amp_enabled
+  .set_amp_enabled = unused_set_amp_enabled,
+  .set_spi_data_ready = unused_set_spi_data_ready
 };
@@ -101,6 +101,16 @@ static bool tres_read_som_gpio (void) {
   return (get_gpio_input(GPIOC, 2) != 0);
 }
 
+static void tres_set_spi_data_ready(bool enabled, bool ready) {
+  // C2: SOM GPIO is only driven once the host asks for SPI data ready signalling.
+  // it's the only SOM sideband, so it can't be read meanwhile (see spi_data_ready_enabled)
+  if (enabled) {
+    set_gpio_output(GPIOC, 2, ready);
+  } else {
+    set_gpio_mode(GPIOC, 2, MODE_INPUT);
+  }
+}
+
 static void tres_init(void) {
   // Enable USB 3.3V LDO for USB block
   register_set_bits(&(PWR->CR3), PWR_CR3_USBREGEN);
@@ -171,5 +181,6 @@ board board_tres = {
   .set_siren = fake_i2c_siren_set,
   .set_bootkick = tres_set_bootkick,
   .read_som_gpio = tres_read_som_gpio,
-  .set_amp_enabled = unused_set_amp_enabled
+  .set_amp_enabled = unused_set_amp_enabled,
+  .set_spi_data_ready = tres_set_spi_data_ready
 };
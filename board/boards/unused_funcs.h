@@ -30,3 +30,8 @@ bool unused_read_som_gpio(void) {
 void unused_set_amp_enabled(bool enabled) {
   UNUSED(enabled);
 }
+
+void unused_set_spi_data_ready(bool enabled, bool ready) {
+  UNUSED(enabled);
+  UNUSED(ready);
+}
@@ -10,6 +10,9 @@
     spans multiple transfers/chunks.
   * the overflow buffers are reset by a dedicated control transfer handler,
     which is sent by the host on each start of a connection.
+  * comms_can_read_prefetch serializes whole packets ahead of time without
+    popping them, comms_can_read_commit pops them later if nothing else
+    has read from the queue in the meantime.
 */
 
 typedef struct {
@@ -19,9 +22,11 @@ typedef struct {
 } asm_buffer;
 
 static asm_buffer can_read_buffer = {.ptr = 0U, .tail_size = 0U};
+static uint32_t can_read_cnt = 0U;
 
 int comms_can_read(uint8_t *data, uint32_t max_len) {
   uint32_t pos = 0U;
+  can_read_cnt += 1U;
 
   // Send tail of previous message if it is in buffer
   if (can_read_buffer.ptr > 0U) {
@@ -53,6 +58,49 @@ int comms_can_read(uint8_t *data, uint32_t max_len) {
   return pos;
 }
 
+uint32_t comms_can_read_prefetch(uint8_t *data, uint32_t max_len, can_read_prefetch_t *pf) {
+  ENTER_CRITICAL();
+  pf->r_ptr = can_rx_q.r_ptr;
+  pf->read_cnt = can_read_cnt;
+  uint32_t w_ptr = can_rx_q.w_ptr;
+  bool has_tail = (can_read_buffer.ptr > 0U);
+  EXIT_CRITICAL();
+
+  // entries between r_ptr and w_ptr aren't touched by the writers
+  uint32_t ptr = pf->r_ptr;
+  pf->len = 0U;
+  while (!has_tail && (ptr != w_ptr)) {
+    const CANPacket_t *can_packet = &can_rx_q.elems[ptr];
+    uint32_t pckt_len = CANPACKET_HEAD_SIZE + dlc_to_len[can_packet->data_len_code];
+    if ((pf->len + pckt_len) > max_len) {
+      break;
+    }
+    (void)memcpy(&data[pf->len], (const uint8_t*)can_packet, pckt_len);
+    pf->len += pckt_len;
+    ptr = ((ptr + 1U) == can_rx_q.fifo_size) ? 0U : (ptr + 1U);
+  }
+  pf->end_ptr = ptr;
+
+  return pf->len;
+}
+
+bool comms_can_read_commit(const can_read_prefetch_t *pf) {
+  bool ret = false;
+
+  ENTER_CRITICAL();
+  uint32_t used = (can_rx_q.w_ptr >= can_rx_q.r_ptr) ? (can_rx_q.w_ptr - can_rx_q.r_ptr) : (can_rx_q.fifo_size - can_rx_q.r_ptr + can_rx_q.w_ptr);
+  uint32_t prefetched = (pf->end_ptr >= pf->r_ptr) ? (pf->end_ptr - pf->r_ptr) : (can_rx_q.fifo_size - pf->r_ptr + pf->end_ptr);
+  if ((pf->len > 0U) && (pf->read_cnt == can_read_cnt) && (pf->r_ptr == can_rx_q.r_ptr) &&
+      (can_read_buffer.ptr == 0U) && (prefetched <= used)) {
+    can_rx_q.r_ptr = pf->end_ptr;
+    can_read_cnt += 1U;
+    ret = true;
+  }
+  EXIT_CRITICAL();
+
+  return ret;
+}
+
 static asm_buffer can_write_buffer = {.ptr = 0U, .tail_size = 0U};
 
 // send on CAN
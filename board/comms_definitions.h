@@ -5,8 +5,18 @@ typedef struct {
   uint16_t length;
 } __attribute__((packed)) ControlPacket_t;
 
+// CAN RX data read ahead of time, see comms_can_read_prefetch
+typedef struct {
+  uint32_t r_ptr;
+  uint32_t end_ptr;
+  uint32_t read_cnt;
+  uint32_t len;
+} can_read_prefetch_t;
+
 int comms_control_handler(ControlPacket_t *req, uint8_t *resp);
 void comms_endpoint2_write(const uint8_t *data, uint32_t len);
 void comms_can_write(const uint8_t *data, uint32_t len);
 int comms_can_read(uint8_t *data, uint32_t max_len);
 void comms_can_reset(void);
+uint32_t comms_can_read_prefetch(uint8_t *data, uint32_t max_len, can_read_prefetch_t *pf);
+bool comms_can_read_commit(const can_read_prefetch_t *pf);
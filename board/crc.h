@@ -1,19 +1,27 @@
 #pragma once
 
-uint8_t crc_checksum(const uint8_t *dat, int len, const uint8_t poly) {
-  uint8_t crc = 0xFFU;
-  int i;
-  int j;
-  for (i = len - 1; i >= 0; i--) {
-    crc ^= dat[i];
-    for (j = 0; j < 8; j++) {
-      if ((crc & 0x80U) != 0U) {
-        crc = (uint8_t)((crc << 1) ^ poly);
-      }
-      else {
-        crc <<= 1;
-      }
-    }
+// XOR of all bytes, a word at a time for the aligned part
+uint8_t xor_checksum(const uint8_t *dat, uint32_t len, uint8_t init) {
+  uint8_t checksum = init;
+  uint32_t i = 0U;
+
+  while ((i < len) && (((uint32_t)&dat[i] & 3U) != 0U)) {
+    checksum ^= dat[i];
+    i++;
+  }
+
+  uint32_t checksum32 = 0U;
+  const uint32_t *dat32 = (const uint32_t *)&dat[i]; // cppcheck-suppress misra-c2012-11.3 ; already checked that it's properly aligned
+  for (; (i + 4U) <= len; i += 4U) {
+    checksum32 ^= *dat32;
+    dat32++;
+  }
+  checksum32 ^= (checksum32 >> 16U);
+  checksum32 ^= (checksum32 >> 8U);
+  checksum ^= (uint8_t)(checksum32 & 0xFFU);
+
+  for (; i < len; i++) {
+    checksum ^= dat[i];
   }
-  return crc;
+  return checksum;
 }
@@ -34,7 +34,9 @@ void bootkick_tick(bool ignition, bool recent_heartbeat) {
   }
   if (waiting_to_boot_countdown > 0U) {
     bool serial_activity = uart_ring_som_debug.w_ptr_tx != bootkick_last_serial_ptr;
-    if (serial_activity || current_board->read_som_gpio() || (boot_state != BOOT_BOOTKICK)) {
+    // with SPI data ready the panda drives the SOM GPIO, and the SOM is clearly up
+    bool som_gpio = spi_data_ready_enabled() || current_board->read_som_gpio();
+    if (serial_activity || som_gpio || (boot_state != BOOT_BOOTKICK)) {
       waiting_to_boot_countdown = 0U;
     } else {
       // try a reset
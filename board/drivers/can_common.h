@@ -212,11 +212,7 @@ bool can_tx_check_min_slots_free(uint32_t min) {
 }
 
 uint8_t calculate_checksum(const uint8_t *dat, uint32_t len) {
-  uint8_t checksum = 0U;
-  for (uint32_t i = 0U; i < len; i++) {
-    checksum ^= dat[i];
-  }
-  return checksum;
+  return xor_checksum(dat, len, 0U);
 }
 
 void can_set_checksum(CANPacket_t *packet) {
@@ -229,7 +225,13 @@ bool can_check_checksum(CANPacket_t *packet) {
 }
 
 void can_send(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook) {
-  if (skip_tx_hook || safety_tx_hook(to_push) != 0) {
+  bool tx_allowed = skip_tx_hook;
+  if (!tx_allowed) {
+    PROFILE_BEGIN(PROFILE_SAFETY_TX);
+    tx_allowed = safety_tx_hook(to_push) != 0;
+    PROFILE_END(PROFILE_SAFETY_TX);
+  }
+  if (tx_allowed) {
     if (bus_number < PANDA_CAN_CNT) {
       // add CAN packet to send queue
       tx_buffer_overflow += can_push(can_queues[bus_number], to_push) ? 0U : 1U;
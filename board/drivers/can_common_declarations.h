@@ -1,6 +1,7 @@
 #pragma once
 
 #include "board/can.h"
+#include "board/crc.h"
 
 typedef struct {
   volatile uint32_t w_ptr;
@@ -84,6 +84,7 @@ void update_can_health_pkt(uint8_t can_number, uint32_t ir_reg) {
 // ***************************** CAN *****************************
 // FDFDCANx_IT1 IRQ Handler (TX)
 void process_can(uint8_t can_number) {
+  PROFILE_BEGIN(PROFILE_PROCESS_CAN);
   if (can_number != 0xffU) {
     ENTER_CRITICAL();
 
@@ -145,11 +146,13 @@ void process_can(uint8_t can_number) {
     }
     EXIT_CRITICAL();
   }
+  PROFILE_END(PROFILE_PROCESS_CAN);
 }
 
 // FDFDCANx_IT0 IRQ Handler (RX and errors)
 // blink blue when we are receiving CAN messages
 void can_rx(uint8_t can_number) {
+  PROFILE_BEGIN(PROFILE_CAN_RX);
   FDCAN_GlobalTypeDef *FDCANx = CANIF_FROM_CAN_NUM(can_number);
   uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
 
@@ -215,7 +218,9 @@ void can_rx(uint8_t can_number) {
       can_health[can_number].total_fwd_cnt += 1U;
     }
 
+    PROFILE_BEGIN(PROFILE_SAFETY_RX);
     safety_rx_invalid += safety_rx_hook(&to_push) ? 0U : 1U;
+    PROFILE_END(PROFILE_SAFETY_RX);
     ignition_can_hook(&to_push);
 
     led_set(LED_BLUE, true);
@@ -237,6 +242,7 @@ void can_rx(uint8_t can_number) {
   if ((ir_reg & (FDCAN_IR_PED | FDCAN_IR_PEA | FDCAN_IR_EP | FDCAN_IR_BO | FDCAN_IR_RF0L)) != 0U) {
     update_can_health_pkt(can_number, ir_reg);
   }
+  PROFILE_END(PROFILE_CAN_RX);
 }
 
 static void FDCAN1_IT0_IRQ_Handler(void) { can_rx(0); }
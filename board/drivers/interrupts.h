@@ -14,30 +14,61 @@ static uint32_t idle_time = 0U;
 static uint32_t busy_time = 0U;
 float interrupt_load = 0.0f;
 
+// All IRQs run at the same priority, so handlers don't preempt each other. An interrupt
+// that fires while another handler runs stays pending until it's done: each handler notes
+// the ones it leaves pending, and they count their latency from that handler's start, so
+// it's an upper bound for the ones that fired during it.
+static void note_pending_interrupts(uint32_t since) {
+  for (uint32_t w = 0U; w < ((NUM_INTERRUPTS + 31U) / 32U); w++) {
+    uint32_t pending = NVIC->ISPR[w];
+    for (uint32_t b = 0U; (pending != 0U) && (b < 32U); b++) {
+      uint32_t irq = (w * 32U) + b;
+      if (((pending & (1UL << b)) != 0U) && (irq < NUM_INTERRUPTS) && !interrupts[irq].pending) {
+        interrupts[irq].pending = true;
+        interrupts[irq].pending_since = since;
+      }
+      pending &= ~(1UL << b);
+    }
+  }
+}
+
 void handle_interrupt(IRQn_Type irq_type){
   static uint8_t interrupt_depth = 0U;
   static uint32_t last_time = 0U;
+  interrupt *irq = &interrupts[irq_type];
+  uint32_t start_time;
   ENTER_CRITICAL();
+  start_time = microsecond_timer_get();
   if (interrupt_depth == 0U) {
-    uint32_t time = microsecond_timer_get();
-    idle_time += get_ts_elapsed(time, last_time);
-    last_time = time;
+    idle_time += get_ts_elapsed(start_time, last_time);
+    last_time = start_time;
+  }
+  irq->raised_ts = start_time;
+  if (irq->pending) {
+    irq->pending = false;
+    irq->raised_ts = irq->pending_since;
+    irq->max_latency_counter = MAX(irq->max_latency_counter, get_ts_elapsed(start_time, irq->pending_since));
   }
   interrupt_depth += 1U;
   EXIT_CRITICAL();
 
-  interrupts[irq_type].call_counter++;
-  interrupts[irq_type].handler();
+  irq->call_counter++;
+  irq->handler();
 
   // Check that the interrupts don't fire too often
-  if (check_interrupt_rate && (interrupts[irq_type].call_counter > interrupts[irq_type].max_call_rate)) {
-    fault_occurred(interrupts[irq_type].call_rate_fault);
+  if (check_interrupt_rate && (irq->call_counter > irq->max_call_rate)) {
+    fault_occurred(irq->call_rate_fault);
   }
 
   ENTER_CRITICAL();
+  uint32_t time = microsecond_timer_get();
+  uint32_t duration = get_ts_elapsed(time, start_time);
+  irq->busy_counter += duration;
+  irq->max_duration_counter = MAX(irq->max_duration_counter, duration);
+  note_pending_interrupts(start_time);
+
   interrupt_depth -= 1U;
   if (interrupt_depth == 0U) {
-    uint32_t time = microsecond_timer_get();
     busy_time += get_ts_elapsed(time, last_time);
     last_time = time;
   }
@@ -56,6 +87,12 @@ void interrupt_timer_handler(void) {
       // Reset interrupt counters
       interrupts[i].call_rate = interrupts[i].call_counter;
       interrupts[i].call_counter = 0U;
+      interrupts[i].busy_us = interrupts[i].busy_counter;
+      interrupts[i].busy_counter = 0U;
+      interrupts[i].max_duration_us = interrupts[i].max_duration_counter;
+      interrupts[i].max_duration_counter = 0U;
+      interrupts[i].max_latency_us = interrupts[i].max_latency_counter;
+      interrupts[i].max_latency_counter = 0U;
     }
 
     // Calculate interrupt load
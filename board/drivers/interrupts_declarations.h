@@ -7,6 +7,16 @@ typedef struct interrupt {
   uint32_t call_rate;
   uint32_t max_call_rate;   // Call rate is defined as the amount of calls each second
   uint32_t call_rate_fault;
+  // handler time in us, counted like the call rate and reported for the last second
+  uint32_t busy_counter;
+  uint32_t busy_us;
+  uint32_t max_duration_counter;  // longest single call
+  uint32_t max_duration_us;
+  uint32_t max_latency_counter;   // longest wait while pending behind other handlers
+  uint32_t max_latency_us;
+  bool pending;                   // was pending when a handler finished, since pending_since
+  uint32_t pending_since;
+  uint32_t raised_ts;             // when the last call's interrupt fired, at the latest
 } interrupt;
 
 void interrupt_timer_init(void);
@@ -20,6 +30,13 @@ extern interrupt interrupts[NUM_INTERRUPTS];
   interrupts[irq_num].handler = (func_ptr);  \
   interrupts[irq_num].call_counter = 0U;   \
   interrupts[irq_num].call_rate = 0U;   \
+  interrupts[irq_num].busy_counter = 0U;   \
+  interrupts[irq_num].busy_us = 0U;   \
+  interrupts[irq_num].max_duration_counter = 0U;   \
+  interrupts[irq_num].max_duration_us = 0U;   \
+  interrupts[irq_num].max_latency_counter = 0U;   \
+  interrupts[irq_num].max_latency_us = 0U;   \
+  interrupts[irq_num].pending = false;   \
   interrupts[irq_num].max_call_rate = (call_rate_max); \
   interrupts[irq_num].call_rate_fault = (rate_fault);
 
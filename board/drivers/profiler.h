@@ -0,0 +1,38 @@
+#include "profiler_declarations.h"
+
+#ifdef PROFILER_ENABLED
+profile_stats_t profile_stats[PROFILE_PROBE_CNT];
+
+void profiler_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55U; // unlock, the M7's DWT ignores writes until then
+  DWT->CYCCNT = 0U;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  profiler_reset();
+}
+
+uint32_t profiler_cycles(void) {
+  return DWT->CYCCNT;
+}
+
+// the counts include anything that preempted the probed code
+void profiler_record(profile_probe_t probe, uint32_t start) {
+  uint32_t cycles = profiler_cycles() - start;
+
+  ENTER_CRITICAL();
+  profile_stats_t *s = &profile_stats[probe];
+  if ((s->count == 0U) || (cycles < s->min_cycles)) {
+    s->min_cycles = cycles;
+  }
+  s->max_cycles = MAX(s->max_cycles, cycles);
+  s->total_cycles += cycles;
+  s->count += 1U;
+  EXIT_CRITICAL();
+}
+
+void profiler_reset(void) {
+  ENTER_CRITICAL();
+  (void)memset(profile_stats, 0, sizeof(profile_stats));
+  EXIT_CRITICAL();
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+// Cycle counts of named code sections, from the Cortex-M7 DWT cycle counter.
+// Debug builds only, the probes compile to nothing in release builds and the bootstub.
+#if defined(ALLOW_DEBUG) && !defined(BOOTSTUB)
+  #define PROFILER_ENABLED
+#endif
+
+// keep in sync with PROFILER_PROBES in python/__init__.py
+typedef enum {
+  PROFILE_CAN_RX = 0,
+  PROFILE_PROCESS_CAN = 1,
+  PROFILE_USB_IRQ = 2,
+  PROFILE_SPI_RX_DONE = 3,
+  PROFILE_SAFETY_RX = 4,
+  PROFILE_SAFETY_TX = 5,
+  PROFILE_SPI_CAN_PREFETCH = 6,
+  PROFILE_PROBE_CNT = 7
+} profile_probe_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+} profile_stats_t;
+
+#ifdef PROFILER_ENABLED
+  extern profile_stats_t profile_stats[PROFILE_PROBE_CNT];
+
+  void profiler_init(void);
+  uint32_t profiler_cycles(void);
+  void profiler_record(profile_probe_t probe, uint32_t start);
+  void profiler_reset(void);
+
+  // times the code between them as probe, they have to be in the same block
+  #define PROFILE_BEGIN(probe) const uint32_t probe##_start = profiler_cycles()
+  #define PROFILE_END(probe) profiler_record((probe), probe##_start)
+#else
+  #define PROFILE_BEGIN(probe)
+  #define PROFILE_END(probe)
+#endif
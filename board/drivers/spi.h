@@ -4,13 +4,28 @@
 #include "board/crc.h"
 
 uint8_t spi_buf_rx[SPI_BUF_SIZE];
-uint8_t spi_buf_tx[SPI_BUF_SIZE];
+uint8_t spi_bufs_tx[2][SPI_BUF_SIZE];
+
+// responses are built in one TX buffer, while CAN RX data is
+// prefetched into the other one after every CAN read
+static uint8_t spi_buf_tx_idx = 0U;
+static uint8_t *spi_buf_tx = spi_bufs_tx[0];
+static can_read_prefetch_t spi_can_prefetch = {0};
+static uint16_t spi_can_prefetch_max = 0U;
+// bumped by every request, a prefetch started before it is stale
+static uint32_t spi_can_prefetch_gen = 0U;
+#define SPI_CAN_PREFETCH_OFFSET 4U
+#define SPI_CAN_READ_MAX (SPI_BUF_SIZE - SPI_CAN_PREFETCH_OFFSET - SPI_CRC32_SIZE)
 
 uint16_t spi_error_count = 0;
+spi_timing_t spi_timing = {0};
 
 static uint8_t spi_state = SPI_STATE_HEADER;
 static uint16_t spi_data_len_mosi;
+static uint32_t spi_header_ts = 0U;
+static bool spi_crc32 = false;
 static bool spi_can_tx_ready = false;
+static spi_data_ready_fn spi_data_ready = NULL;
 static const unsigned char version_text[] = "VERSION";
 
 static uint16_t spi_version_packet(uint8_t *out) {
@@ -42,7 +57,7 @@ static uint16_t spi_version_packet(uint8_t *out) {
   data_len += 1U;
 
   // SPI protocol version
-  out[data_pos + data_len] = 0x2;
+  out[data_pos + data_len] = SPI_PROTOCOL_VERSION;
   data_len += 1U;
 
   // data length
@@ -51,7 +66,7 @@ static uint16_t spi_version_packet(uint8_t *out) {
 
   // CRC8
   uint16_t resp_len = data_pos + data_len;
-  out[resp_len] = crc_checksum(out, resp_len, 0xD5U);
+  out[resp_len] = llcrc8_reversed(out, resp_len, 0xD5U);
   resp_len += 1U;
 
   return resp_len;
@@ -66,22 +81,62 @@ void spi_init(void) {
   llspi_mosi_dma(spi_buf_rx, SPI_HEADER_SIZE);
 }
 
+// data ready: once enabled, the board drives a line high while a response is staged,
+// so the host can wait on an interrupt instead of polling for the ACK. NULL disables.
+void spi_set_data_ready_mode(spi_data_ready_fn fn) {
+  if (spi_data_ready != NULL) {
+    spi_data_ready(false, false);
+  }
+  spi_data_ready = fn;
+  if (spi_data_ready != NULL) {
+    spi_data_ready(true, false);
+  }
+}
+
+// the board's SOM GPIO is driven by the panda then, it can't be read
+bool spi_data_ready_enabled(void) {
+  return spi_data_ready != NULL;
+}
+
+static void spi_signal_data_ready(bool ready) {
+  if (spi_data_ready != NULL) {
+    spi_data_ready(true, ready);
+  }
+}
+
 static bool validate_checksum(const uint8_t *data, uint16_t len) {
-  // TODO: can speed this up by casting the bulk to uint32_t and xor-ing the bytes afterwards
-  uint8_t checksum = SPI_CHECKSUM_START;
-  for(uint16_t i = 0U; i < len; i++){
-    checksum ^= data[i];
+  return xor_checksum(data, len, SPI_CHECKSUM_START) == 0U;
+}
+
+static bool validate_crc32(const uint8_t *data, uint16_t len) {
+  const uint8_t *crc = &data[len];
+  uint32_t expected = ((uint32_t)crc[3] << 24U) | ((uint32_t)crc[2] << 16U) | ((uint32_t)crc[1] << 8U) | crc[0];
+  return llcrc32(data, len) == expected;
+}
+
+// Serves a CAN read from the prefetched data, if it's still valid. The response then
+// comes from the other TX buffer, starting so the CAN data lands where it was prefetched.
+static uint16_t spi_can_read_prefetched(uint16_t max_len, uint16_t data_offset) {
+  uint16_t ret = 0U;
+  if ((spi_can_prefetch.len > 0U) && (spi_can_prefetch.len <= max_len) && comms_can_read_commit(&spi_can_prefetch)) {
+    spi_buf_tx_idx ^= 1U;
+    spi_buf_tx = &spi_bufs_tx[spi_buf_tx_idx][SPI_CAN_PREFETCH_OFFSET - data_offset];
+    ret = spi_can_prefetch.len;
   }
-  return checksum == 0U;
+  spi_can_prefetch.len = 0U;
+  return ret;
 }
 
 void spi_rx_done(void) {
   uint16_t response_len = 0U;
   uint8_t next_rx_state = SPI_STATE_HEADER_NACK;
   bool checksum_valid = false;
+  bool respond = true;
   static uint8_t spi_endpoint;
   static uint16_t spi_data_len_miso;
 
+  spi_buf_tx = spi_bufs_tx[spi_buf_tx_idx];
+
   // parse header
   spi_endpoint = spi_buf_rx[1];
   spi_data_len_mosi = (spi_buf_rx[3] << 8) | spi_buf_rx[2];
@@ -91,8 +146,17 @@ void spi_rx_done(void) {
     response_len = spi_version_packet(spi_buf_tx);
     next_rx_state = SPI_STATE_HEADER_NACK;;
   } else if (spi_state == SPI_STATE_HEADER) {
+    spi_header_ts = llspi_mosi_dma_done_ts();
     checksum_valid = validate_checksum(spi_buf_rx, SPI_HEADER_SIZE);
-    if ((spi_buf_rx[0] == SPI_SYNC_BYTE) && checksum_valid) {
+    bool data_len_valid = (spi_data_len_mosi < (SPI_BUF_SIZE - SPI_HEADER_SIZE - SPI_CRC32_SIZE));
+    spi_crc32 = (spi_buf_rx[0] == SPI_SYNC_BYTE_V3_CRC32);
+    if (((spi_buf_rx[0] == SPI_SYNC_BYTE_V3) || spi_crc32) && checksum_valid && data_len_valid) {
+      // v3: the data follows the header in the same burst and is
+      // already coming into the RX FIFO, keep receiving without a response
+      llspi_mosi_dma_continue(&spi_buf_rx[SPI_HEADER_SIZE], spi_data_len_mosi + (spi_crc32 ? SPI_CRC32_SIZE : 1U));
+      next_rx_state = SPI_STATE_DATA_RX;
+      respond = false;
+    } else if ((spi_buf_rx[0] == SPI_SYNC_BYTE) && checksum_valid && data_len_valid) {
       // response: ACK and start receiving data portion
       spi_buf_tx[0] = SPI_HACK;
       next_rx_state = SPI_STATE_HEADER_ACK;
@@ -109,7 +173,12 @@ void spi_rx_done(void) {
   } else if (spi_state == SPI_STATE_DATA_RX) {
     // We got everything! Based on the endpoint specified, call the appropriate handler
     bool response_ack = false;
-    checksum_valid = validate_checksum(&(spi_buf_rx[SPI_HEADER_SIZE]), spi_data_len_mosi + 1U);
+    uint16_t can_read_max = 0U;
+    if (spi_crc32) {
+      checksum_valid = validate_crc32(&(spi_buf_rx[SPI_HEADER_SIZE]), spi_data_len_mosi);
+    } else {
+      checksum_valid = validate_checksum(&(spi_buf_rx[SPI_HEADER_SIZE]), spi_data_len_mosi + 1U);
+    }
     if (checksum_valid) {
       if (spi_endpoint == 0U) {
         if (spi_data_len_mosi >= sizeof(ControlPacket_t)) {
@@ -122,7 +191,9 @@ void spi_rx_done(void) {
         }
       } else if ((spi_endpoint == 1U) || (spi_endpoint == 0x81U)) {
         if (spi_data_len_mosi == 0U) {
-          response_len = comms_can_read(&(spi_buf_tx[3]), spi_data_len_miso);
+          can_read_max = MIN(spi_data_len_miso, SPI_CAN_READ_MAX);
+          uint16_t prefetched = spi_can_read_prefetched(can_read_max, 3U);
+          response_len = prefetched + comms_can_read(&(spi_buf_tx[3U + prefetched]), can_read_max - prefetched);
           response_ack = true;
         } else {
           print("SPI: did not expect data for can_read\n");
@@ -143,6 +214,26 @@ void spi_rx_done(void) {
         } else {
           print("SPI: did expect data for can_write\n");
         }
+      } else if (spi_endpoint == 4U) {
+        // combined CAN write and read, to save a transaction per control loop cycle.
+        // the response is a byte that's 1 if the CAN write data was taken, followed by
+        // the CAN read data. the write data is only taken when the TX queues have room,
+        // otherwise the host sends it again with the next transaction.
+        if (spi_data_len_miso > 1U) {
+          bool can_tx_taken = (spi_data_len_mosi == 0U);
+          if (!can_tx_taken && spi_can_tx_ready) {
+            spi_can_tx_ready = false;
+            comms_can_write(&spi_buf_rx[SPI_HEADER_SIZE], spi_data_len_mosi);
+            can_tx_taken = true;
+          }
+          can_read_max = MIN(spi_data_len_miso, SPI_CAN_READ_MAX) - 1U;
+          uint16_t prefetched = spi_can_read_prefetched(can_read_max, 4U);
+          spi_buf_tx[3] = can_tx_taken ? 1U : 0U;
+          response_len = 1U + prefetched + comms_can_read(&(spi_buf_tx[4U + prefetched]), can_read_max - prefetched);
+          response_ack = true;
+        } else {
+          print("SPI: no room for can_read\n");
+        }
       } else if (spi_endpoint == 0xABU) {
         // test endpoint: mimics panda -> device transfer
         response_len = spi_data_len_miso;
@@ -166,6 +257,11 @@ void spi_rx_done(void) {
       #endif
     }
 
+    // only keep prefetching while the host is reading CAN
+    spi_can_prefetch_max = can_read_max;
+    spi_can_prefetch.len = 0U;
+    spi_can_prefetch_gen += 1U;
+
     if (!response_ack) {
       spi_buf_tx[0] = SPI_NACK;
       next_rx_state = SPI_STATE_HEADER_NACK;
@@ -177,27 +273,41 @@ void spi_rx_done(void) {
       spi_buf_tx[2] = (response_len >> 8) & 0xFFU;
 
       // Add checksum
-      uint8_t checksum = SPI_CHECKSUM_START;
-      for(uint16_t i = 0U; i < (response_len + 3U); i++) {
-        checksum ^= spi_buf_tx[i];
+      if (spi_crc32) {
+        uint32_t crc = llcrc32(spi_buf_tx, response_len + 3U);
+        spi_buf_tx[response_len + 3U] = crc & 0xFFU;
+        spi_buf_tx[response_len + 4U] = (crc >> 8U) & 0xFFU;
+        spi_buf_tx[response_len + 5U] = (crc >> 16U) & 0xFFU;
+        spi_buf_tx[response_len + 6U] = (crc >> 24U) & 0xFFU;
+        response_len += 3U + SPI_CRC32_SIZE;
+      } else {
+        spi_buf_tx[response_len + 3U] = xor_checksum(spi_buf_tx, response_len + 3U, SPI_CHECKSUM_START);
+        response_len += 4U;
       }
-      spi_buf_tx[response_len + 3U] = checksum;
-      response_len += 4U;
 
       next_rx_state = SPI_STATE_DATA_TX;
     }
+
+    uint32_t dt = get_ts_elapsed(microsecond_timer_get(), spi_header_ts);
+    spi_timing.transfer_cnt += 1U;
+    spi_timing.last_us = dt;
+    spi_timing.max_us = MAX(spi_timing.max_us, dt);
+    spi_timing.total_us += dt;
   } else {
     print("SPI: RX unexpected state: "); puth(spi_state); print("\n");
   }
 
   // send out response
-  if (response_len == 0U) {
-    print("SPI: no response\n");
-    spi_buf_tx[0] = SPI_NACK;
-    spi_state = SPI_STATE_HEADER_NACK;
-    response_len = 1U;
+  if (respond) {
+    if (response_len == 0U) {
+      print("SPI: no response\n");
+      spi_buf_tx[0] = SPI_NACK;
+      spi_state = SPI_STATE_HEADER_NACK;
+      response_len = 1U;
+    }
+    llspi_miso_dma(spi_buf_tx, response_len);
+    spi_signal_data_ready(true);
   }
-  llspi_miso_dma(spi_buf_tx, response_len);
 
   spi_state = next_rx_state;
   if (!checksum_valid) {
@@ -205,7 +315,25 @@ void spi_rx_done(void) {
   }
 }
 
+// Some of the v3 data was lost to an RX FIFO overrun, so the DMA won't complete.
+// NACK right away, the host retries with v2 instead of waiting out its DACK timeout.
+void spi_rx_overrun(void) {
+  if (spi_state == SPI_STATE_DATA_RX) {
+    #ifdef DEBUG_SPI
+      print("- RX overrun\n");
+    #endif
+    spi_error_count += 1U;
+    spi_buf_tx = spi_bufs_tx[spi_buf_tx_idx];
+    spi_buf_tx[0] = SPI_NACK;
+    spi_state = SPI_STATE_HEADER_NACK;
+    llspi_miso_dma(spi_buf_tx, 1U);
+    spi_signal_data_ready(true);
+  }
+}
+
 void spi_tx_done(bool reset) {
+  spi_signal_data_ready(false);
+
   if ((spi_state == SPI_STATE_HEADER_NACK) || reset) {
     // Reset state
     spi_state = SPI_STATE_HEADER;
@@ -218,6 +346,13 @@ void spi_tx_done(bool reset) {
     // Reset state
     spi_state = SPI_STATE_HEADER;
     llspi_mosi_dma(spi_buf_rx, SPI_HEADER_SIZE);
+
+    // the host is likely to read CAN again next, get the data ready
+    // in the idle TX buffer while it's sending the header. that's done
+    // below every IRQ, so it doesn't hold up the next header
+    if (spi_can_prefetch_max > 0U) {
+      llspi_defer();
+    }
   } else {
     spi_state = SPI_STATE_HEADER;
     llspi_mosi_dma(spi_buf_rx, SPI_HEADER_SIZE);
@@ -225,6 +360,31 @@ void spi_tx_done(bool reset) {
   }
 }
 
+// Runs at the lowest priority, any SPI IRQ can come in while it's prefetching. The idle
+// TX buffer is only used by spi_rx_done once a prefetch is published, and a request
+// that's handled in the meantime makes this one stale.
+void spi_deferred(void) {
+  ENTER_CRITICAL();
+  uint32_t gen = spi_can_prefetch_gen;
+  uint16_t max_len = spi_can_prefetch_max;
+  bool published = (spi_can_prefetch.len > 0U);
+  uint8_t *idle_buf = spi_bufs_tx[spi_buf_tx_idx ^ 1U];
+  EXIT_CRITICAL();
+
+  if ((max_len > 0U) && !published) {
+    can_read_prefetch_t pf;
+    PROFILE_BEGIN(PROFILE_SPI_CAN_PREFETCH);
+    (void)comms_can_read_prefetch(&idle_buf[SPI_CAN_PREFETCH_OFFSET], max_len, &pf);
+    PROFILE_END(PROFILE_SPI_CAN_PREFETCH);
+
+    ENTER_CRITICAL();
+    if (gen == spi_can_prefetch_gen) {
+      spi_can_prefetch = pf;
+    }
+    EXIT_CRITICAL();
+  }
+}
+
 void can_tx_comms_resume_spi(void) {
   spi_can_tx_ready = true;
 }
@@ -11,10 +11,16 @@
 #define SPI_BUF_SIZE 4096U
 // H7 DMA2 located in D2 domain, so we need to use SRAM1/SRAM2
 __attribute__((section(".sram12"))) extern uint8_t spi_buf_rx[SPI_BUF_SIZE];
-__attribute__((section(".sram12"))) extern uint8_t spi_buf_tx[SPI_BUF_SIZE];
+__attribute__((section(".sram12"))) extern uint8_t spi_bufs_tx[2][SPI_BUF_SIZE];
+
+#define SPI_PROTOCOL_VERSION 3U
 
 #define SPI_CHECKSUM_START 0xABU
 #define SPI_SYNC_BYTE 0x5AU
+// v3: header and data in one burst, no HACK in between
+#define SPI_SYNC_BYTE_V3 0x5BU
+// v3 with a CRC-32 instead of the XOR checksum for the data and the response
+#define SPI_SYNC_BYTE_V3_CRC32 0x5CU
 #define SPI_HACK 0x79U
 #define SPI_DACK 0x85U
 #define SPI_NACK 0x1FU
@@ -31,14 +37,32 @@ enum {
 
 extern uint16_t spi_error_count;
 
+// time from the header's DMA completing to arming the response DMA
+typedef struct {
+  uint32_t transfer_cnt;
+  uint32_t last_us;
+  uint32_t max_us;
+  uint32_t total_us;
+} spi_timing_t;
+extern spi_timing_t spi_timing;
+
 #define SPI_HEADER_SIZE 7U
+#define SPI_CRC32_SIZE 4U
 
 // low level SPI prototypes
 void llspi_init(void);
 void llspi_mosi_dma(uint8_t *addr, int len);
+void llspi_mosi_dma_continue(uint8_t *addr, int len);
 void llspi_miso_dma(uint8_t *addr, int len);
+uint32_t llspi_mosi_dma_done_ts(void);
+void llspi_defer(void);
 
 void can_tx_comms_resume_spi(void);
 void spi_init(void);
 void spi_rx_done(void);
+void spi_rx_overrun(void);
 void spi_tx_done(bool reset);
+void spi_deferred(void);
+typedef void (*spi_data_ready_fn)(bool enabled, bool ready);
+void spi_set_data_ready_mode(spi_data_ready_fn fn);
+bool spi_data_ready_enabled(void);
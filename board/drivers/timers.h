@@ -26,6 +26,6 @@ void interrupt_timer_init(void) {
 }
 
 void tick_timer_init(void) {
-  timer_init(TICK_TIMER, (uint16_t)((15.25*APB2_TIMER_FREQ)/8U));
+  timer_init(TICK_TIMER, (uint16_t)((15.25*APB2_TIMER_FREQ)/TICK_TIMER_FREQ));
   NVIC_EnableIRQ(TICK_TIMER_IRQ);
 }
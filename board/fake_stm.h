@@ -20,10 +20,12 @@ void puth(unsigned int i) {
 
 typedef struct {
   uint32_t CNT;
+  uint32_t SR;
 } TIM_TypeDef;
 
 TIM_TypeDef timer;
 TIM_TypeDef *MICROSECOND_TIMER = &timer;
+#define TICK_TIMER_FREQ 8U
 uint32_t microsecond_timer_get(void);
 
 uint32_t microsecond_timer_get(void) {
@@ -31,3 +33,21 @@ uint32_t microsecond_timer_get(void) {
 }
 
 typedef uint32_t GPIO_TypeDef;
+
+typedef struct {
+  uint32_t CTRL;
+  uint32_t CYCCNT;
+  uint32_t LAR;
+} DWT_Type;
+
+typedef struct {
+  uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk 1UL
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+DWT_Type dwt;
+DWT_Type *DWT = &dwt;
+CoreDebug_Type core_debug;
+CoreDebug_Type *CoreDebug = &core_debug;
@@ -1,5 +1,10 @@
-// from the linker script
-#define APP_START_ADDRESS 0x8020000U
+// from the linker script, tests put it in a simulated flash
+#ifndef APP_START_ADDRESS
+  #define APP_START_ADDRESS 0x8020000U
+#endif
+#define FLASHER_SECTOR_SIZE 0x20000U
+// the bootstub is sector 0, right before the app
+#define FLASHER_SECTOR_ADDRESS(sec) ((APP_START_ADDRESS - FLASHER_SECTOR_SIZE) + ((uint32_t)(sec) * FLASHER_SECTOR_SIZE))
 
 // flasher state variables
 uint32_t *prog_ptr = NULL;
@@ -42,6 +47,25 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         resp[1] = 0xff;
       }
       break;
+    // **** 0xb3: SHA-1 of a sector, so the host only needs to reflash the ones that changed
+    case 0xb3:
+      // the last partial flash word is still in the write buffer after programming
+      flush_write_buffer();
+      sec = req->param1;
+      if ((sec >= 0) && (sec < 8)) {
+        (void)SHA_hash((const void *)FLASHER_SECTOR_ADDRESS(sec), FLASHER_SECTOR_SIZE, resp);
+        resp_len = SHA_DIGEST_SIZE;
+      }
+      break;
+    // **** 0xb4: program from the start of a sector
+    case 0xb4:
+      sec = req->param1;
+      if (unlocked && (sec > 0) && (sec < 8)) {
+        flush_write_buffer();
+        prog_ptr = (uint32_t *)FLASHER_SECTOR_ADDRESS(sec);
+        resp[1] = 0xff;
+      }
+      break;
     // **** 0xc1: get hardware type
     case 0xc1:
       resp[0] = hw_type;
@@ -105,6 +129,18 @@ int comms_can_read(uint8_t *data, uint32_t max_len) {
   return 0;
 }
 
+uint32_t comms_can_read_prefetch(uint8_t *data, uint32_t max_len, can_read_prefetch_t *pf) {
+  UNUSED(data);
+  UNUSED(max_len);
+  pf->len = 0U;
+  return 0U;
+}
+
+bool comms_can_read_commit(const can_read_prefetch_t *pf) {
+  UNUSED(pf);
+  return false;
+}
+
 void refresh_can_tx_slots_available(void) {}
 
 void comms_endpoint2_write(const uint8_t *data, uint32_t len) {
@@ -22,12 +22,10 @@ def ensure_jungle_health_packet_version(fn):
 
 
 class PandaJungleDFU(PandaDFU):
-  def recover(self):
+  def bootstub_code(self) -> bytes:
     fn = os.path.join(FW_PATH, self.get_mcu_type().config.bootstub_fn.replace("panda", "panda_jungle"))
     with open(fn, "rb") as f:
-      code = f.read()
-    self.program_bootstub(code)
-    self.reset()
+      return f.read()
 
 
 class PandaJungle(Panda):
@@ -70,6 +68,7 @@ class PandaJungle(Panda):
 
     # reflash after recover
     self.connect(True, True)
+    self.check_bootstub(dfu.bootstub_code())
     self.flash()
     return True
 
@@ -24,6 +24,7 @@
 
 #include "board/can_comms.h"
 #include "board/main_comms.h"
+#include "board/safety_mode.h"
 
 
 // ********************* Serial debugging *********************
@@ -35,66 +36,6 @@ void debug_ring_callback(uart_ring *ring) {
   }
 }
 
-// ****************************** safety mode ******************************
-
-// this is the only way to leave silent mode
-void set_safety_mode(uint16_t mode, uint16_t param) {
-  uint16_t mode_copy = mode;
-  int err = set_safety_hooks(mode_copy, param);
-  if (err == -1) {
-    print("Error: safety set mode failed. Falling back to SILENT\n");
-    mode_copy = SAFETY_SILENT;
-    err = set_safety_hooks(mode_copy, 0U);
-    // TERMINAL ERROR: we can't continue if SILENT safety mode isn't succesfully set
-    assert_fatal(err == 0, "Error: Failed setting SILENT mode. Hanging\n");
-  }
-  safety_tx_blocked = 0;
-  safety_rx_invalid = 0;
-
-  switch (mode_copy) {
-    case SAFETY_SILENT:
-      set_intercept_relay(false, false);
-      current_board->set_can_mode(CAN_MODE_NORMAL);
-      can_silent = true;
-      break;
-    case SAFETY_NOOUTPUT:
-      set_intercept_relay(false, false);
-      current_board->set_can_mode(CAN_MODE_NORMAL);
-      can_silent = false;
-      break;
-    case SAFETY_ELM327:
-      set_intercept_relay(false, false);
-      heartbeat_counter = 0U;
-      heartbeat_lost = false;
-
-      // Clear any pending messages in the can core (i.e. sending while comma power is unplugged)
-      // TODO: rewrite using hardware queues rather than fifo to cancel specific messages
-      can_clear_send(CANIF_FROM_CAN_NUM(1), 1);
-      if (param == 0U) {
-        current_board->set_can_mode(CAN_MODE_OBD_CAN2);
-      } else {
-        current_board->set_can_mode(CAN_MODE_NORMAL);
-      }
-      can_silent = false;
-      break;
-    default:
-      set_intercept_relay(true, false);
-      heartbeat_counter = 0U;
-      heartbeat_lost = false;
-      current_board->set_can_mode(CAN_MODE_NORMAL);
-      can_silent = false;
-      break;
-  }
-  can_init_all();
-}
-
-bool is_car_safety_mode(uint16_t mode) {
-  return (mode != SAFETY_SILENT) &&
-         (mode != SAFETY_NOOUTPUT) &&
-         (mode != SAFETY_ALLOUTPUT) &&
-         (mode != SAFETY_ELM327);
-}
-
 // ***************************** main code *****************************
 
 // cppcheck-suppress unusedFunction ; used in headers not included in cppcheck
@@ -130,6 +71,7 @@ static void tick_handler(void) {
     harness_tick();
     simple_watchdog_kick();
     sound_tick();
+    telemetry_tick();
 
     if (relay_malfunction_prev != relay_malfunction) {
       if (relay_malfunction) {
@@ -207,9 +149,17 @@ static void tick_handler(void) {
         heartbeat_engaged_mismatches = 0U;
       }
 
+      const bool heartbeat_timed_out = heartbeat_counter >= (started ? HEARTBEAT_IGNITION_CNT_ON : HEARTBEAT_IGNITION_CNT_OFF);
+
+      // the SOM GPIO is an output while the host uses it for SPI data ready,
+      // make it an input again once the host is gone, even without the heartbeat check
+      if (heartbeat_timed_out) {
+        spi_set_data_ready_mode(NULL);
+      }
+
       if (!heartbeat_disabled) {
         // if the heartbeat has been gone for a while, go to SILENT safety mode and enter power save
-        if (heartbeat_counter >= (started ? HEARTBEAT_IGNITION_CNT_ON : HEARTBEAT_IGNITION_CNT_OFF)) {
+        if (heartbeat_timed_out) {
           print("device hasn't sent a heartbeat for 0x");
           puth(heartbeat_counter);
           print(" seconds. Safety is set to SILENT mode.\n");
@@ -231,6 +181,9 @@ static void tick_handler(void) {
             set_safety_mode(SAFETY_SILENT, 0U);
           }
 
+          // nobody is left to consume the records
+          (void)telemetry_set_rate(0U);
+
           if (power_save_status != POWER_SAVE_STATUS_ENABLED) {
             set_power_save_state(POWER_SAVE_STATUS_ENABLED);
           }
@@ -262,7 +215,7 @@ static void tick_handler(void) {
     }
 
     loop_counter++;
-    loop_counter %= 8U;
+    loop_counter %= TICK_TIMER_FREQ;
   }
   TICK_TIMER->SR = 0;
 }
@@ -302,6 +255,9 @@ int main(void) {
   enable_fpu();
 
   microsecond_timer_init();
+#ifdef PROFILER_ENABLED
+  profiler_init();
+#endif
 
   current_board->set_siren(false);
   if (current_board->has_fan) {
@@ -315,7 +271,7 @@ int main(void) {
   enable_can_transceivers(true);
 
   // init watchdog for heartbeat loop, fed at 8Hz
-  simple_watchdog_init(FAULT_HEARTBEAT_LOOP_WATCHDOG, (3U * 1000000U / 8U));
+  simple_watchdog_init(FAULT_HEARTBEAT_LOOP_WATCHDOG, (3U * 1000000U / TICK_TIMER_FREQ));
 
   // 8Hz timer
   REGISTER_INTERRUPT(TICK_TIMER_IRQ, tick_handler, 10U, FAULT_INTERRUPT_RATE_TICK)
@@ -45,6 +45,78 @@ static int get_health_pkt(void *dat) {
   return sizeof(*health);
 }
 
+static int get_can_health_pkt(uint8_t can_number, void *dat) {
+  COMPILE_TIME_ASSERT(sizeof(can_health_t) <= USBPACKET_MAX_SIZE);
+  update_can_health_pkt(can_number, 0U);
+  can_health[can_number].can_speed = (bus_config[can_number].can_speed / 10U);
+  can_health[can_number].can_data_speed = (bus_config[can_number].can_data_speed / 10U);
+  can_health[can_number].canfd_enabled = bus_config[can_number].canfd_enabled;
+  can_health[can_number].brs_enabled = bus_config[can_number].brs_enabled;
+  can_health[can_number].canfd_non_iso = bus_config[can_number].canfd_non_iso;
+  (void)memcpy(dat, (uint8_t*)(&can_health[can_number]), sizeof(can_health[can_number]));
+  return sizeof(can_health[can_number]);
+}
+
+// **** telemetry ****
+// When enabled, the health packet and the CAN health packets are pushed onto the
+// CAN RX queue as 64-byte packets on TELEMETRY_BUS, so the host gets them along
+// with the regular CAN stream instead of polling the control endpoint.
+// The address selects the record: 0 for health, 1 + CAN number for CAN health.
+#define TELEMETRY_BUS 7U
+#define TELEMETRY_ADDR_HEALTH 0U
+#define TELEMETRY_ADDR_CAN_HEALTH 1U
+
+static uint8_t telemetry_period = 0U; // in ticks, 0 = disabled
+
+static void telemetry_push(CANPacket_t *pkt, uint32_t addr) {
+  pkt->returned = 0U;
+  pkt->rejected = 0U;
+  pkt->extended = 0U;
+  pkt->fd = 1U;
+  pkt->bus = TELEMETRY_BUS;
+  pkt->addr = addr;
+  pkt->data_len_code = 15U; // 64 bytes, fits both records
+  can_set_checksum(pkt);
+  rx_buffer_overflow += can_push(&can_rx_q, pkt) ? 0U : 1U;
+}
+
+// the records go out on ticks, so only rates that divide the tick rate are exact, others are rejected
+static bool telemetry_set_rate(uint16_t rate_hz) {
+  bool ret = true;
+  if (rate_hz == 0U) {
+    telemetry_period = 0U;
+  } else if ((rate_hz <= TICK_TIMER_FREQ) && ((TICK_TIMER_FREQ % rate_hz) == 0U)) {
+    telemetry_period = (uint8_t)(TICK_TIMER_FREQ / rate_hz);
+  } else {
+    ret = false;
+  }
+  return ret;
+}
+
+// called from the tick handler at TICK_TIMER_FREQ
+static void telemetry_tick(void) {
+  static uint8_t telemetry_cnt = 0U;
+
+  if (telemetry_period != 0U) {
+    telemetry_cnt += 1U;
+    if (telemetry_cnt >= telemetry_period) {
+      telemetry_cnt = 0U;
+
+      CANPacket_t pkt = {0};
+      (void)get_health_pkt(pkt.data);
+      telemetry_push(&pkt, TELEMETRY_ADDR_HEALTH);
+
+      for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+        (void)memset(pkt.data, 0, sizeof(pkt.data));
+        (void)get_can_health_pkt(i, pkt.data);
+        telemetry_push(&pkt, TELEMETRY_ADDR_CAN_HEALTH + i);
+      }
+    }
+  } else {
+    telemetry_cnt = 0U;
+  }
+}
+
 // send on serial, first byte to select the ring
 void comms_endpoint2_write(const uint8_t *data, uint32_t len) {
   uart_ring *ur = get_ring_by_number(data[0]);
@@ -95,9 +167,10 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       resp[1] = ((fan_state.rpm & 0xFF00U) >> 8U);
       resp_len = 2;
       break;
-    // **** 0xc0: reset communications state
+    // **** 0xc0: reset communications state, a new client starts without telemetry
     case 0xc0:
       comms_can_reset();
+      (void)telemetry_set_rate(0U);
       break;
     // **** 0xc1: get hardware type
     case 0xc1:
@@ -106,16 +179,8 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       break;
     // **** 0xc2: CAN health stats
     case 0xc2:
-      COMPILE_TIME_ASSERT(sizeof(can_health_t) <= USBPACKET_MAX_SIZE);
       if (req->param1 < 3U) {
-        update_can_health_pkt(req->param1, 0U);
-        can_health[req->param1].can_speed = (bus_config[req->param1].can_speed / 10U);
-        can_health[req->param1].can_data_speed = (bus_config[req->param1].can_data_speed / 10U);
-        can_health[req->param1].canfd_enabled = bus_config[req->param1].canfd_enabled;
-        can_health[req->param1].brs_enabled = bus_config[req->param1].brs_enabled;
-        can_health[req->param1].canfd_non_iso = bus_config[req->param1].canfd_non_iso;
-        resp_len = sizeof(can_health[req->param1]);
-        (void)memcpy(resp, (uint8_t*)(&can_health[req->param1]), resp_len);
+        resp_len = get_can_health_pkt(req->param1, resp);
       }
       break;
     // **** 0xc3: fetch MCU UID
@@ -123,15 +188,14 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       (void)memcpy(resp, ((uint8_t *)UID_BASE), 12);
       resp_len = 12;
       break;
-    // **** 0xc4: get interrupt call rate
+    // **** 0xc4: get interrupt call rate, param2 == 1 adds the last second's busy time,
+    //           longest call and longest wait behind other handlers, in us
     case 0xc4:
       if (req->param1 < NUM_INTERRUPTS) {
-        uint32_t load = interrupts[req->param1].call_rate;
-        resp[0] = (load & 0x000000FFU);
-        resp[1] = ((load & 0x0000FF00U) >> 8U);
-        resp[2] = ((load & 0x00FF0000U) >> 16U);
-        resp[3] = ((load & 0xFF000000U) >> 24U);
-        resp_len = 4U;
+        const interrupt *irq = &interrupts[req->param1];
+        uint32_t stats[4] = {irq->call_rate, irq->busy_us, irq->max_duration_us, irq->max_latency_us};
+        resp_len = (req->param2 == 1U) ? sizeof(stats) : 4U;
+        (void)memcpy(resp, (uint8_t*)stats, resp_len);
       }
       break;
     // **** 0xc5: DEBUG: drive relay
@@ -143,6 +207,46 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       resp[0] = current_board->read_som_gpio();
       resp_len = 1;
       break;
+    // **** 0xc7: set telemetry rate in Hz, 0 disables. 1, 2, 4 or 8, others are ignored
+    case 0xc7:
+      (void)telemetry_set_rate(req->param1);
+      break;
+    // **** 0xc8: get SPI timing stats, param1 == 1 resets them
+    case 0xc8:
+      COMPILE_TIME_ASSERT(sizeof(spi_timing) <= USBPACKET_MAX_SIZE);
+      (void)memcpy(resp, (uint8_t*)(&spi_timing), sizeof(spi_timing));
+      resp_len = sizeof(spi_timing);
+      if (req->param1 == 1U) {
+        (void)memset(&spi_timing, 0, sizeof(spi_timing));
+      }
+      break;
+    // **** 0xc9: enable SPI data ready signalling on the SOM GPIO
+    case 0xc9:
+      spi_set_data_ready_mode((req->param1 == 1U) ? current_board->set_spi_data_ready : NULL);
+      break;
+    // **** 0xca: get the settings the host sets on connect, so it can skip the ones already set
+    case 0xca:
+      resp[0] = heartbeat_disabled ? 1U : 0U;
+      resp[1] = (power_save_status == POWER_SAVE_STATUS_ENABLED) ? 1U : 0U;
+      for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+        resp[2U + (i * 3U)] = (uint8_t)(bus_config[i].can_speed & 0xFFU);
+        resp[3U + (i * 3U)] = (uint8_t)((bus_config[i].can_speed >> 8U) & 0xFFU);
+        resp[4U + (i * 3U)] = bus_config[i].canfd_auto ? 1U : 0U;
+      }
+      resp_len = 2U + (PANDA_CAN_CNT * 3U);
+      break;
+    // **** 0xcb: DEBUG: get profiler stats of probe param1, param2 == 1 resets all of them
+    case 0xcb:
+      #ifdef PROFILER_ENABLED
+        if (req->param1 < (uint16_t)PROFILE_PROBE_CNT) {
+          (void)memcpy(resp, (uint8_t*)(&profile_stats[req->param1]), sizeof(profile_stats_t));
+          resp_len = sizeof(profile_stats_t);
+        }
+        if (req->param2 == 1U) {
+          profiler_reset();
+        }
+      #endif
+      break;
     // **** 0xd0: fetch serial (aka the provisioned dongle ID)
     case 0xd0:
       // addresses are OTP
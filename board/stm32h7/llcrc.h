@@ -0,0 +1,45 @@
+// CRC peripheral, used for the SPI link checks from the SPI IRQs only.
+// The registers are written directly since they change on every use.
+
+// CRC-8 with init 0xFF, with the data fed from the last byte to the first
+uint8_t llcrc8_reversed(const uint8_t *dat, uint32_t len, uint8_t poly) {
+  CRC->POL = poly;
+  CRC->INIT = 0xFFU;
+  CRC->CR = (CRC_CR_POLYSIZE_1 | CRC_CR_RESET);
+
+  for (uint32_t i = len; i > 0U; i--) {
+    *(volatile uint8_t *)&(CRC->DR) = dat[i - 1U];
+  }
+  return (uint8_t)(CRC->DR & 0xFFU);
+}
+
+// CRC-32, same as zlib's
+uint32_t llcrc32(const uint8_t *dat, uint32_t len) {
+  uint32_t i = 0U;
+
+  CRC->POL = 0x04C11DB7U;
+  CRC->INIT = 0xFFFFFFFFU;
+
+  // bytes until the first word boundary, reflected by byte
+  CRC->CR = (CRC_CR_REV_IN_0 | CRC_CR_REV_OUT | CRC_CR_RESET);
+  while ((i < len) && (((uint32_t)&dat[i] & 3U) != 0U)) {
+    *(volatile uint8_t *)&(CRC->DR) = dat[i];
+    i++;
+  }
+
+  // words, reflected by word so the lowest byte goes first
+  CRC->CR = (CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1 | CRC_CR_REV_OUT);
+  const uint32_t *dat32 = (const uint32_t *)&dat[i]; // cppcheck-suppress misra-c2012-11.3 ; already checked that it's properly aligned
+  for (; (i + 4U) <= len; i += 4U) {
+    CRC->DR = *dat32;
+    dat32++;
+  }
+
+  // remaining bytes
+  CRC->CR = (CRC_CR_REV_IN_0 | CRC_CR_REV_OUT);
+  for (; i < len; i++) {
+    *(volatile uint8_t *)&(CRC->DR) = dat[i];
+  }
+
+  return ~CRC->DR;
+}
@@ -25,6 +25,17 @@ void llspi_mosi_dma(uint8_t *addr, int len) {
   register_set_bits(&(SPI4->CR1), SPI_CR1_SPE);
 }
 
+// master -> panda DMA continue, for data that follows the header in the same burst.
+// SPI stays enabled, so the bytes already in the RX FIFO aren't dropped. If the FIFO
+// overran before this, the data is incomplete and the OVR interrupt ends the transfer.
+void llspi_mosi_dma_continue(uint8_t *addr, int len) {
+  DMA2->LIFCR = (DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2);
+  register_set(&(DMA2_Stream2->M0AR), (uint32_t)addr, 0xFFFFFFFFU);
+  DMA2_Stream2->NDTR = len;
+  DMA2_Stream2->CR |= DMA_SxCR_EN;
+  register_set(&(SPI4->IER), SPI_IER_OVRIE, 0x3FFU);
+}
+
 // panda -> master DMA start
 void llspi_miso_dma(uint8_t *addr, int len) {
   // disable DMA + SPI
@@ -48,13 +59,29 @@ void llspi_miso_dma(uint8_t *addr, int len) {
   register_set_bits(&(SPI4->CR1), SPI_CR1_SPE);
 }
 
+// the header DMA's interrupt fired here at the latest, even if other handlers held it up
+uint32_t llspi_mosi_dma_done_ts(void) {
+  return interrupts[DMA2_Stream2_IRQn].raised_ts;
+}
+
+// spi_deferred runs from PendSV, below all IRQs
+void llspi_defer(void) {
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+void PendSV_Handler(void) {
+  spi_deferred();
+}
+
 static bool spi_tx_dma_done = false;
 // master -> panda DMA finished
 static void DMA2_Stream2_IRQ_Handler(void) {
   // Clear interrupt flag
   DMA2->LIFCR = DMA_LIFCR_CTCIF2;
 
+  PROFILE_BEGIN(PROFILE_SPI_RX_DONE);
   spi_rx_done();
+  PROFILE_END(PROFILE_SPI_RX_DONE);
 }
 
 // panda -> master DMA finished
@@ -67,12 +94,19 @@ static void DMA2_Stream3_IRQ_Handler(void) {
   EXIT_CRITICAL();
 }
 
-// panda TX finished
+// panda TX finished, or RX overrun while receiving v3 data
 static void SPI4_IRQ_Handler(void) {
+  bool overrun = ((SPI4->SR & SPI_SR_OVR) != 0U) && ((SPI4->IER & SPI_IER_OVRIE) != 0U);
+
   // clear flag
   SPI4->IFCR |= (0x1FFU << 3U);
 
-  if (spi_tx_dma_done && ((SPI4->SR & SPI_SR_TXC) != 0U)) {
+  if (overrun) {
+    // the RX DMA won't complete, stop it before responding
+    register_clear_bits(&(SPI4->CFG1), SPI_CFG1_RXDMAEN);
+    DMA2_Stream2->CR &= ~DMA_SxCR_EN;
+    spi_rx_overrun();
+  } else if (spi_tx_dma_done && ((SPI4->SR & SPI_SR_TXC) != 0U)) {
     spi_tx_dma_done = false;
     spi_tx_done(false);
   }
@@ -101,6 +135,9 @@ void llspi_init(void) {
   register_set(&(SPI4->CR1), SPI_CR1_SPE, 0xFFFFU);
   register_set(&(SPI4->CR2), 0, 0xFFFFU);
 
+  // the IRQs all keep the default, highest priority, PendSV goes below them
+  NVIC_SetPriority(PendSV_IRQn, (1UL << __NVIC_PRIO_BITS) - 1UL);
+
   NVIC_EnableIRQ(DMA2_Stream2_IRQn);
   NVIC_EnableIRQ(DMA2_Stream3_IRQn);
   NVIC_EnableIRQ(SPI4_IRQn);
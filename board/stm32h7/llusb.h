@@ -4,7 +4,9 @@ USB_OTG_GlobalTypeDef *USBx = USB_OTG_HS;
 
 static void OTG_HS_IRQ_Handler(void) {
   NVIC_DisableIRQ(OTG_HS_IRQn);
+  PROFILE_BEGIN(PROFILE_USB_IRQ);
   usb_irqhandler();
+  PROFILE_END(PROFILE_USB_IRQ);
   NVIC_EnableIRQ(OTG_HS_IRQn);
 }
 
@@ -68,9 +68,10 @@ void common_init_gpio(void) {
 void flasher_peripherals_init(void) {
   RCC->AHB1ENR |= RCC_AHB1ENR_USB1OTGHSEN;
 
-  // SPI + DMA
+  // SPI + DMA + CRC
   RCC->APB2ENR |= RCC_APB2ENR_SPI4EN;
   RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+  RCC->AHB4ENR |= RCC_AHB4ENR_CRCEN;
 
   // LED PWM
   RCC->APB1LENR |= RCC_APB1LENR_TIM3EN;
@@ -96,6 +97,7 @@ void peripherals_init(void) {
   RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;  // SPI DMA
   RCC->APB4ENR |= RCC_APB4ENR_SYSCFGEN;
   RCC->AHB4ENR |= RCC_AHB4ENR_BDMAEN; // Audio DMA
+  RCC->AHB4ENR |= RCC_AHB4ENR_CRCEN; // SPI CRC
 
   // Connectivity
   RCC->APB2ENR |= RCC_APB2ENR_SPI4EN;  // SPI
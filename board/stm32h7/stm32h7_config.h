@@ -32,6 +32,7 @@ separate IRQs for RX and TX.
 
 #define TICK_TIMER_IRQ TIM8_BRK_TIM12_IRQn
 #define TICK_TIMER TIM12
+#define TICK_TIMER_FREQ 8U
 
 #define MICROSECOND_TIMER TIM2
 
@@ -59,6 +60,7 @@ separate IRQs for RX and TX.
 
 #include "board/drivers/registers.h"
 #include "board/drivers/interrupts.h"
+#include "board/drivers/profiler.h"
 #include "board/drivers/gpio.h"
 #include "board/stm32h7/peripherals.h"
 #include "board/stm32h7/interrupt_handlers.h"
@@ -86,6 +88,7 @@ separate IRQs for RX and TX.
 
 #include "board/stm32h7/llusb.h"
 
+#include "board/stm32h7/llcrc.h"
 #include "board/drivers/spi.h"
 #include "board/stm32h7/llspi.h"
 
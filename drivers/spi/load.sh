@@ -12,7 +12,8 @@ sudo dmesg -C
 
 #sudo rmmod -f spidev_panda
 sudo rmmod spidev_panda || true
-sudo insmod spidev_panda.ko
+# DATA_READY_GPIO=<gpio> waits on the panda's data ready line instead of polling for ACKs
+sudo insmod spidev_panda.ko ${DATA_READY_GPIO:+data_ready_gpio=$DATA_READY_GPIO}
 
 sudo su -c "echo 'file $DIR/spidev_panda.c +p' > /sys/kernel/debug/dynamic_debug/control"
 sudo su -c "echo 'file $DIR/spi_panda.h +p' > /sys/kernel/debug/dynamic_debug/control"
@@ -1,7 +1,16 @@
+#include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
 #include <linux/spi/spi.h>
 #include <linux/spi/spidev.h>
 
+#include "spi_panda_ioctl.h"
+
 #define SPI_SYNC 0x5AU
 #define SPI_HACK 0x79U
 #define SPI_DACK 0x85U
@@ -15,16 +24,170 @@ struct __attribute__((packed)) spi_header {
   uint16_t max_rx_len;
 };
 
-struct spi_panda_transfer {
-  __u64 rx_buf;
-  __u64 tx_buf;
-  __u32 tx_length;
-  __u32 rx_length_max;
-  __u32 timeout;
-  __u8 endpoint;
-  __u8 expect_disconnect;
+// *** data ready ***
+// The panda can drive a GPIO high once a response is staged (control request 0xc9),
+// so we sleep on its interrupt instead of spinning SPI reads until the ACK shows up.
+// If the line never comes, we fall back to polling after the timeout, and keep polling
+// until the next rising edge: the panda turns the signal off on heartbeat loss and resets,
+// and only the host turns it back on.
+static int data_ready_gpio = -1;
+module_param(data_ready_gpio, int, S_IRUGO);
+MODULE_PARM_DESC(data_ready_gpio, "GPIO the panda asserts when a response is ready, -1 to poll");
+
+static unsigned data_ready_timeout_us = 1000;
+module_param(data_ready_timeout_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(data_ready_timeout_us, "max wait for data ready before falling back to polling");
+
+static int data_ready_irq = -1;
+static DECLARE_COMPLETION(panda_data_ready);
+// the panda is signalling, set on each rising edge and cleared on a timeout
+static bool data_ready_live = false;
+
+// *** stats, in debugfs ***
+#define PANDA_LATENCY_BUCKETS 16U  // log2(us)
+
+struct panda_stats {
+  u64 transfers;
+  u64 errors;
+  u64 ready_irqs;
+  u64 ready_timeouts;
+  u64 ack_polls;
+  u64 latency_hist[PANDA_LATENCY_BUCKETS];
+  u32 latency_max_us;
 };
 
+static struct panda_stats panda_stats;
+static DEFINE_SPINLOCK(panda_stats_lock);
+static struct dentry *panda_debugfs_dir;
+
+static void panda_stats_add_transfer(s64 us, bool error) {
+  u32 bucket = (us > 0) ? min_t(u32, ilog2(us) + 1U, PANDA_LATENCY_BUCKETS - 1U) : 0U;
+
+  spin_lock(&panda_stats_lock);
+  panda_stats.transfers++;
+  if (error) {
+    panda_stats.errors++;
+  }
+  panda_stats.latency_hist[bucket]++;
+  panda_stats.latency_max_us = max_t(u32, panda_stats.latency_max_us, us);
+  spin_unlock(&panda_stats_lock);
+}
+
+static int panda_stats_show(struct seq_file *s, void *unused) {
+  u32 i;
+  struct panda_stats st;
+
+  spin_lock(&panda_stats_lock);
+  st = panda_stats;
+  spin_unlock(&panda_stats_lock);
+
+  seq_printf(s, "transfers: %llu\nerrors: %llu\n", st.transfers, st.errors);
+  seq_printf(s, "data ready gpio: %d%s\n", data_ready_gpio, READ_ONCE(data_ready_live) ? "" : " (polling)");
+  seq_printf(s, "data ready irqs: %llu\ndata ready timeouts: %llu\n", st.ready_irqs, st.ready_timeouts);
+  seq_printf(s, "ack polls: %llu\n", st.ack_polls);
+  seq_printf(s, "max latency us: %u\n", st.latency_max_us);
+  seq_puts(s, "latency us:\n");
+  for (i = 0U; i < PANDA_LATENCY_BUCKETS; i++) {
+    seq_printf(s, "  < %6u: %llu\n", 1U << i, st.latency_hist[i]);
+  }
+  return 0;
+}
+
+static int panda_stats_open(struct inode *inode, struct file *file) {
+  return single_open(file, panda_stats_show, NULL);
+}
+
+// any write resets the stats
+static ssize_t panda_stats_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+  spin_lock(&panda_stats_lock);
+  memset(&panda_stats, 0, sizeof(panda_stats));
+  spin_unlock(&panda_stats_lock);
+  return count;
+}
+
+static const struct file_operations panda_stats_fops = {
+  .owner = THIS_MODULE,
+  .open = panda_stats_open,
+  .read = seq_read,
+  .write = panda_stats_write,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+
+static irqreturn_t panda_data_ready_isr(int irq, void *dev_id) {
+  WRITE_ONCE(data_ready_live, true);
+  complete(&panda_data_ready);
+  return IRQ_HANDLED;
+}
+
+static void panda_exit(void) {
+  debugfs_remove_recursive(panda_debugfs_dir);
+  if (data_ready_irq >= 0) {
+    free_irq(data_ready_irq, &panda_data_ready);
+    data_ready_irq = -1;
+  }
+  if (data_ready_gpio >= 0) {
+    gpio_free(data_ready_gpio);
+  }
+}
+
+static void panda_init(void) {
+  int ret;
+
+  panda_debugfs_dir = debugfs_create_dir("spidev_panda", NULL);
+  debugfs_create_file("stats", S_IRUGO | S_IWUSR, panda_debugfs_dir, NULL, &panda_stats_fops);
+
+  if (data_ready_gpio < 0) {
+    return;
+  }
+
+  // without the line we still work, just by polling
+  ret = gpio_request_one(data_ready_gpio, GPIOF_IN, "panda_data_ready");
+  if (ret < 0) {
+    pr_warn("spidev_panda: failed to get data ready gpio %d (%d), polling\n", data_ready_gpio, ret);
+    data_ready_gpio = -1;
+    return;
+  }
+
+  ret = gpio_to_irq(data_ready_gpio);
+  if (ret >= 0) {
+    data_ready_irq = ret;
+    ret = request_irq(data_ready_irq, panda_data_ready_isr, IRQF_TRIGGER_RISING, "panda_data_ready", &panda_data_ready);
+  }
+  if (ret < 0) {
+    pr_warn("spidev_panda: failed to get data ready irq (%d), polling\n", ret);
+    data_ready_irq = -1;
+    gpio_free(data_ready_gpio);
+    data_ready_gpio = -1;
+  }
+}
+
+// call before the write whose response we'll wait for
+static void panda_arm_data_ready(void) {
+  if (data_ready_irq >= 0) {
+    reinit_completion(&panda_data_ready);
+  }
+}
+
+static void panda_wait_for_data_ready(void) {
+  long ret;
+  if ((data_ready_irq < 0) || !READ_ONCE(data_ready_live) || gpio_get_value(data_ready_gpio)) {
+    return;
+  }
+
+  ret = wait_for_completion_timeout(&panda_data_ready, usecs_to_jiffies(data_ready_timeout_us));
+  if (ret == 0) {
+    WRITE_ONCE(data_ready_live, false);
+  }
+  spin_lock(&panda_stats_lock);
+  if (ret > 0) {
+    panda_stats.ready_irqs++;
+  } else {
+    panda_stats.ready_timeouts++;
+  }
+  spin_unlock(&panda_stats_lock);
+}
+
 static u8 panda_calc_checksum(u8 *buf, u16 length) {
   int i;
   u8 checksum = SPI_CHECKSUM_START;
@@ -37,7 +200,14 @@ static u8 panda_calc_checksum(u8 *buf, u16 length) {
 static long panda_wait_for_ack(struct spidev_data *spidev, u8 ack_val, u8 length) {
   int i;
   int ret;
+
+  panda_wait_for_data_ready();
+
   for (i = 0; i < 1000; i++) {
+    spin_lock(&panda_stats_lock);
+    panda_stats.ack_polls++;
+    spin_unlock(&panda_stats_lock);
+
     ret = spidev_sync_read(spidev, length);
     if (ret < 0) {
       return ret;
@@ -53,11 +223,11 @@ static long panda_wait_for_ack(struct spidev_data *spidev, u8 ack_val, u8 length
   return -1;
 }
 
-static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *spi, unsigned long arg) {
+// tx_buf and rx_buf are userspace pointers when user is set, kernel pointers otherwise
+static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *spi, const struct spi_panda_transfer *pt, bool user) {
   u16 rx_len;
   long retval = -1;
   struct spi_header header;
-  struct spi_panda_transfer pt;
 
   struct spi_transfer t = {
     .len = 0,
@@ -70,24 +240,18 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
   spi_message_init(&m);
   spi_message_add_tail(&t, &m);
 
-  // read struct from user
-  if (!access_ok(VERIFY_WRITE, arg, sizeof(pt))) {
-    return -1;
-  }
-  if (copy_from_user(&pt, (void __user *)arg, sizeof(pt))) {
-    return -1;
-  }
-  dev_dbg(&spi->dev, "ep: %d, tx len: %d\n", pt.endpoint, pt.tx_length);
+  dev_dbg(&spi->dev, "ep: %d, tx len: %d\n", pt->endpoint, pt->tx_length);
 
   // send header
   header.sync = 0x5a;
-  header.endpoint = pt.endpoint;
-  header.tx_len = pt.tx_length;
-  header.max_rx_len = pt.rx_length_max;
+  header.endpoint = pt->endpoint;
+  header.tx_len = pt->tx_length;
+  header.max_rx_len = pt->rx_length_max;
   memcpy(spidev->tx_buffer, &header, sizeof(header));
   spidev->tx_buffer[sizeof(header)] = panda_calc_checksum(spidev->tx_buffer, sizeof(header));
 
   t.len = sizeof(header) + 1;
+  panda_arm_data_ready();
   retval = spidev_sync(spidev, &m);
   if (retval < 0) {
     dev_dbg(&spi->dev, "spi xfer failed %ld\n", retval);
@@ -103,12 +267,17 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
 
   // send data
   dev_dbg(&spi->dev, "sending data\n");
-  retval = copy_from_user(spidev->tx_buffer, (const u8 __user *)(uintptr_t)pt.tx_buf, pt.tx_length);
-  spidev->tx_buffer[pt.tx_length] = panda_calc_checksum(spidev->tx_buffer, pt.tx_length);
-  t.len = pt.tx_length + 1;
+  if (user) {
+    retval = copy_from_user(spidev->tx_buffer, (const u8 __user *)(uintptr_t)pt->tx_buf, pt->tx_length);
+  } else {
+    memcpy(spidev->tx_buffer, (const u8 *)(uintptr_t)pt->tx_buf, pt->tx_length);
+  }
+  spidev->tx_buffer[pt->tx_length] = panda_calc_checksum(spidev->tx_buffer, pt->tx_length);
+  t.len = pt->tx_length + 1;
+  panda_arm_data_ready();
   retval = spidev_sync(spidev, &m);
 
-  if (pt.expect_disconnect) {
+  if (pt->expect_disconnect) {
     return 0;
   }
 
@@ -123,7 +292,7 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
   t.rx_buf = spidev->rx_buffer + 3;
   rx_len = (spidev->rx_buffer[2] << 8) | (spidev->rx_buffer[1]);
   dev_dbg(&spi->dev, "rx len %u\n", rx_len);
-  if (rx_len > pt.rx_length_max) {
+  if (rx_len > pt->rx_length_max) {
     dev_dbg(&spi->dev, "RX len greater than max\n");
     return -1;
   }
@@ -140,21 +309,83 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
     return -1;
   }
 
-  retval = copy_to_user((u8 __user *)(uintptr_t)pt.rx_buf, spidev->rx_buffer + 3, rx_len);
+  if (user) {
+    retval = copy_to_user((u8 __user *)(uintptr_t)pt->rx_buf, spidev->rx_buffer + 3, rx_len);
+  } else {
+    memcpy((u8 *)(uintptr_t)pt->rx_buf, spidev->rx_buffer + 3, rx_len);
+  }
 
   return rx_len;
 }
 
-static long panda_transfer(struct spidev_data *spidev, struct spi_device *spi, unsigned long arg) {
+static long panda_transfer_retry(struct spidev_data *spidev, struct spi_device *spi, const struct spi_panda_transfer *pt, bool user) {
   int i;
-  int ret;
+  long ret;
+  ktime_t start;
+
+  // header + checksum on the way out, DACK + len + checksum on the way back
+  if (((pt->tx_length + 1U) > bufsiz) || ((pt->rx_length_max + 4U) > bufsiz)) {
+    return -EINVAL;
+  }
+
   dev_dbg(&spi->dev, "=== XFER start ===\n");
+  start = ktime_get();
   for (i = 0; i < 20; i++) {
-    ret = panda_transfer_raw(spidev, spi, arg);
+    ret = panda_transfer_raw(spidev, spi, pt, user);
     if (ret >= 0) {
       break;
     }
   }
+  panda_stats_add_transfer(ktime_us_delta(ktime_get(), start), ret < 0);
   dev_dbg(&spi->dev, "took %d tries\n", i+1);
   return ret;
 }
+
+static long panda_transfer(struct spidev_data *spidev, struct spi_device *spi, unsigned long arg) {
+  struct spi_panda_transfer pt;
+
+  // read struct from user
+  if (!access_ok(VERIFY_WRITE, arg, sizeof(pt))) {
+    return -1;
+  }
+  if (copy_from_user(&pt, (void __user *)arg, sizeof(pt))) {
+    return -1;
+  }
+  return panda_transfer_retry(spidev, spi, &pt, true);
+}
+
+static long panda_transfer_batch(struct spidev_data *spidev, struct spi_device *spi, unsigned long arg) {
+  u32 i;
+  long ret;
+  struct spi_panda_batch batch;
+  struct spi_panda_transfer *pts;
+  s32 results[SPI_PANDA_BATCH_MAX];
+
+  if (copy_from_user(&batch, (void __user *)arg, sizeof(batch))) {
+    return -EFAULT;
+  }
+  if ((batch.count == 0U) || (batch.count > SPI_PANDA_BATCH_MAX)) {
+    return -EINVAL;
+  }
+
+  pts = memdup_user((void __user *)(uintptr_t)batch.transfers, batch.count * sizeof(*pts));
+  if (IS_ERR(pts)) {
+    return PTR_ERR(pts);
+  }
+
+  dev_dbg(&spi->dev, "=== BATCH start, %u xfers ===\n", batch.count);
+  for (i = 0U; i < batch.count; i++) {
+    ret = panda_transfer_retry(spidev, spi, &pts[i], true);
+    results[i] = ret;
+    if ((ret < 0) && (batch.flags & SPI_PANDA_BATCH_STOP_ON_ERROR)) {
+      i++;
+      break;
+    }
+  }
+  kfree(pts);
+
+  if (copy_to_user((void __user *)(uintptr_t)batch.results, results, i * sizeof(results[0]))) {
+    return -EFAULT;
+  }
+  return i;
+}
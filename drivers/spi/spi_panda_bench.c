@@ -0,0 +1,149 @@
+// Userspace client for the spidev_panda batch ioctl.
+// Runs the same CAN write + CAN read + health cycle as one ioctl per
+// transfer and as a single SPI_IOC_PANDA_BATCH, and prints the throughput.
+//
+// usage: ./spi_panda_bench [device] [cycles]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spi_panda_ioctl.h"
+
+#define CYCLE_LEN 3U
+#define RX_MAX 0x400U
+#define CAN_HEADER_SIZE 6U
+
+struct ctrl_packet {
+  uint8_t request;
+  uint16_t param1;
+  uint16_t param2;
+  uint16_t length;
+} __attribute__((packed));
+
+static uint8_t can_tx[CAN_HEADER_SIZE + 8U];
+static struct ctrl_packet health_req = {.request = 0xd2, .length = RX_MAX};
+static uint8_t rx[CYCLE_LEN][RX_MAX];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+// one classic CAN frame on bus 0, see pack_can_buffer in python/__init__.py
+static void build_can_packet(uint32_t addr) {
+  uint32_t word_4b = addr << 3;
+  uint8_t checksum = 0U;
+
+  memset(can_tx, 0, sizeof(can_tx));
+  can_tx[0] = 8U << 4;  // DLC 8
+  memcpy(&can_tx[1], &word_4b, sizeof(word_4b));
+  for (unsigned i = 0U; i < sizeof(can_tx); i++) {
+    checksum ^= can_tx[i];
+  }
+  can_tx[5] = checksum;
+}
+
+static void build_cycle(struct spi_panda_transfer *t) {
+  memset(t, 0, CYCLE_LEN * sizeof(*t));
+
+  // CAN write
+  t[0].endpoint = 3U;
+  t[0].tx_buf = (uintptr_t)can_tx;
+  t[0].tx_length = sizeof(can_tx);
+  t[0].rx_buf = (uintptr_t)rx[0];
+  t[0].rx_length_max = RX_MAX;
+
+  // CAN read
+  t[1].endpoint = 1U;
+  t[1].rx_buf = (uintptr_t)rx[1];
+  t[1].rx_length_max = RX_MAX;
+
+  // health
+  t[2].endpoint = 0U;
+  t[2].tx_buf = (uintptr_t)&health_req;
+  t[2].tx_length = sizeof(health_req);
+  t[2].rx_buf = (uintptr_t)rx[2];
+  t[2].rx_length_max = RX_MAX;
+}
+
+static int run_single(int fd, struct spi_panda_transfer *t, int cycles) {
+  for (int n = 0; n < cycles; n++) {
+    for (unsigned i = 0U; i < CYCLE_LEN; i++) {
+      if (ioctl(fd, SPI_IOC_PANDA_TRANSFER, &t[i]) < 0) {
+        fprintf(stderr, "transfer %u failed: %s\n", i, strerror(errno));
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int run_batch(int fd, struct spi_panda_transfer *t, int cycles) {
+  int32_t results[CYCLE_LEN];
+  struct spi_panda_batch batch = {
+    .transfers = (uintptr_t)t,
+    .results = (uintptr_t)results,
+    .count = CYCLE_LEN,
+    .flags = SPI_PANDA_BATCH_STOP_ON_ERROR,
+  };
+
+  for (int n = 0; n < cycles; n++) {
+    int ret = ioctl(fd, SPI_IOC_PANDA_BATCH, &batch);
+    if (ret < 0) {
+      fprintf(stderr, "batch failed: %s\n", strerror(errno));
+      return -1;
+    }
+    for (int i = 0; i < ret; i++) {
+      if (results[i] < 0) {
+        fprintf(stderr, "batch transfer %d failed: %d\n", i, results[i]);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void report(const char *name, double dt, int cycles, unsigned ioctls_per_cycle) {
+  printf("%-8s %8.1f cycles/s  %8.1f us/cycle  %8.1f ioctls/s\n", name,
+         cycles / dt, (dt * 1e6) / cycles, (cycles * ioctls_per_cycle) / dt);
+}
+
+int main(int argc, char **argv) {
+  const char *dev = (argc > 1) ? argv[1] : "/dev/spidev0.0";
+  int cycles = (argc > 2) ? atoi(argv[2]) : 2000;
+  struct spi_panda_transfer t[CYCLE_LEN];
+  double st;
+
+  int fd = open(dev, O_RDWR);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open %s: %s\n", dev, strerror(errno));
+    return 1;
+  }
+
+  build_can_packet(0x123U);
+  build_cycle(t);
+  printf("%d cycles of CAN write + CAN read + health on %s\n", cycles, dev);
+
+  st = now();
+  if (run_single(fd, t, cycles) < 0) {
+    return 1;
+  }
+  report("single", now() - st, cycles, CYCLE_LEN);
+
+  st = now();
+  if (run_batch(fd, t, cycles) < 0) {
+    return 1;
+  }
+  report("batch", now() - st, cycles, 1U);
+
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,486 @@
+#include <linux/can.h>
+#include <linux/can/dev.h>
+#include <linux/kthread.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/wait.h>
+#include <asm/unaligned.h>
+
+// SocketCAN interface: one canN netdev per panda CAN bus. A kernel thread
+// moves frames between the netdevs and the panda's CAN endpoints over SPI,
+// in the same packet format as pack_can_buffer/unpack_can_buffer in python/__init__.py.
+// While any netdev is up it has the panda to itself, so bus speeds and the safety mode
+// are set through the panda API before bringing them up.
+
+#define PANDA_CAN_CNT 3U
+#define PANDA_CAN_HEADER_SIZE 6U
+#define PANDA_CAN_PACKET_MAX (PANDA_CAN_HEADER_SIZE + CANFD_MAX_DLEN)
+#define PANDA_CAN_EP_READ 1U
+#define PANDA_CAN_EP_WRITE 3U
+#define PANDA_CAN_XFER_MAX 1024U
+#define PANDA_CAN_TX_QUEUE_LEN 256U
+
+static bool can_loopback = false;
+module_param(can_loopback, bool, S_IRUGO);
+MODULE_PARM_DESC(can_loopback, "echo CAN TX back as RX without talking to a panda, for testing");
+
+static unsigned can_poll_us = 1000;
+module_param(can_poll_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(can_poll_us, "CAN RX poll interval while idle");
+
+static const u8 panda_dlc_to_len[] = {0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U, 12U, 16U, 20U, 24U, 32U, 48U, 64U};
+
+struct panda_can_priv {
+  struct can_priv can;  // must be first
+  u8 bus;
+};
+
+struct panda_can {
+  struct net_device *netdevs[PANDA_CAN_CNT];
+  struct task_struct *thread;
+  wait_queue_head_t wq;
+  struct sk_buff_head txq;
+
+  // held by the thread for a whole cycle, protects spidev and up_cnt
+  struct mutex lock;
+  struct spidev_data *spidev;
+  u32 up_cnt;
+
+  // packed frames waiting to be taken by the panda
+  u8 tx_buf[PANDA_CAN_XFER_MAX];
+  u32 tx_len;
+
+  // a partial packet from the previous read is kept at the start
+  u8 rx_buf[PANDA_CAN_PACKET_MAX + PANDA_CAN_XFER_MAX];
+  u32 rx_carry;
+};
+
+static struct panda_can panda_can;
+
+// *** spidev ownership ***
+// The netdevs and the /dev/spidev chardev can't share the panda: both would poll its one
+// CAN RX ring, and every frame would only reach whichever read it first. The first to open
+// owns it and the other gets -EBUSY until it's closed. Protected by device_list_lock.
+static bool panda_can_owns_spidev = false;
+
+// buffers and refcount like spidev_open/spidev_release
+static int panda_can_spidev_get(struct spidev_data *spidev) {
+  int ret = 0;
+
+  mutex_lock(&device_list_lock);
+  if (spidev->users > 0U) {
+    // open as /dev/spidev
+    ret = -EBUSY;
+  } else {
+    if (!spidev->tx_buffer) {
+      spidev->tx_buffer = kmalloc(bufsiz, GFP_KERNEL);
+    }
+    if (!spidev->rx_buffer) {
+      spidev->rx_buffer = kmalloc(bufsiz, GFP_KERNEL);
+    }
+    if (!spidev->tx_buffer || !spidev->rx_buffer) {
+      ret = -ENOMEM;
+    } else {
+      spidev->users++;
+      panda_can_owns_spidev = true;
+    }
+  }
+  mutex_unlock(&device_list_lock);
+  return ret;
+}
+
+static void panda_can_spidev_put(struct spidev_data *spidev) {
+  bool dofree;
+
+  mutex_lock(&device_list_lock);
+  panda_can_owns_spidev = false;
+  spidev->users--;
+  if (!spidev->users) {
+    kfree(spidev->tx_buffer);
+    spidev->tx_buffer = NULL;
+    kfree(spidev->rx_buffer);
+    spidev->rx_buffer = NULL;
+
+    spin_lock_irq(&spidev->spi_lock);
+    dofree = (spidev->spi == NULL);
+    spin_unlock_irq(&spidev->spi_lock);
+    if (dofree) {
+      kfree(spidev);
+    }
+  }
+  mutex_unlock(&device_list_lock);
+}
+
+static void panda_can_attach(struct spidev_data *spidev) {
+  mutex_lock(&panda_can.lock);
+  if ((panda_can.spidev == NULL) && !can_loopback) {
+    if ((panda_can.up_cnt == 0U) || (panda_can_spidev_get(spidev) == 0)) {
+      panda_can.spidev = spidev;
+    }
+  }
+  mutex_unlock(&panda_can.lock);
+}
+
+static void panda_can_detach(struct spidev_data *spidev) {
+  mutex_lock(&panda_can.lock);
+  if (panda_can.spidev == spidev) {
+    if (panda_can.up_cnt > 0U) {
+      panda_can_spidev_put(spidev);
+    }
+    panda_can.spidev = NULL;
+  }
+  mutex_unlock(&panda_can.lock);
+}
+
+// *** packing ***
+static u32 panda_can_pack(u8 *buf, const struct canfd_frame *cf, u8 bus, bool fd) {
+  u32 i;
+  u8 dlc = can_len2dlc(cf->len);
+  u32 len = panda_dlc_to_len[dlc];
+  bool extended = (cf->can_id & CAN_EFF_FLAG) != 0U;
+  u32 addr = cf->can_id & (extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+  u8 checksum = 0U;
+
+  buf[0] = (dlc << 4) | (bus << 1) | (fd ? 1U : 0U);
+  put_unaligned_le32((addr << 3) | (extended ? 4U : 0U), &buf[1]);
+  memset(&buf[PANDA_CAN_HEADER_SIZE], 0, len);
+  memcpy(&buf[PANDA_CAN_HEADER_SIZE], cf->data, cf->len);
+
+  buf[5] = 0U;
+  for (i = 0U; i < (PANDA_CAN_HEADER_SIZE + len); i++) {
+    checksum ^= buf[i];
+  }
+  buf[5] = checksum;
+  return PANDA_CAN_HEADER_SIZE + len;
+}
+
+static void panda_can_wake_queues(void) {
+  u32 i;
+  for (i = 0U; i < PANDA_CAN_CNT; i++) {
+    if (netif_running(panda_can.netdevs[i]) && netif_queue_stopped(panda_can.netdevs[i])) {
+      netif_wake_queue(panda_can.netdevs[i]);
+    }
+  }
+}
+
+// packs queued frames into tx_buf, until it's full
+static void panda_can_fill_tx(void) {
+  struct sk_buff *skb;
+
+  while ((skb = skb_dequeue(&panda_can.txq)) != NULL) {
+    struct net_device *dev = skb->dev;
+    struct panda_can_priv *priv = netdev_priv(dev);
+    struct canfd_frame *cf = (struct canfd_frame *)skb->data;
+
+    if ((panda_can.tx_len + PANDA_CAN_PACKET_MAX) > sizeof(panda_can.tx_buf)) {
+      skb_queue_head(&panda_can.txq, skb);
+      break;
+    }
+
+    panda_can.tx_len += panda_can_pack(&panda_can.tx_buf[panda_can.tx_len], cf, priv->bus, can_is_canfd_skb(skb));
+    dev->stats.tx_packets++;
+    dev->stats.tx_bytes += cf->len;
+    consume_skb(skb);
+  }
+
+  if (skb_queue_len(&panda_can.txq) < (PANDA_CAN_TX_QUEUE_LEN / 2U)) {
+    panda_can_wake_queues();
+  }
+}
+
+static void panda_can_rx_frame(const u8 *pkt, u8 len) {
+  struct sk_buff *skb;
+  struct canfd_frame *cf;
+  struct net_device *dev;
+  u8 bus = (pkt[0] >> 1) & 0x7U;
+  bool fd = (pkt[0] & 1U) != 0U;
+  u32 word_4b = get_unaligned_le32(&pkt[1]);
+
+  // skip TX echoes (returned), rejected frames, and telemetry on the extra buses
+  if (((word_4b & 3U) != 0U) || (bus >= PANDA_CAN_CNT)) {
+    return;
+  }
+
+  dev = panda_can.netdevs[bus];
+  if (!netif_running(dev)) {
+    return;
+  }
+
+  if (fd) {
+    skb = alloc_canfd_skb(dev, &cf);
+  } else {
+    skb = alloc_can_skb(dev, (struct can_frame **)&cf);
+  }
+  if (skb == NULL) {
+    dev->stats.rx_dropped++;
+    return;
+  }
+
+  cf->can_id = word_4b >> 3;
+  if ((word_4b & 4U) != 0U) {
+    cf->can_id |= CAN_EFF_FLAG;
+  }
+  cf->len = len;
+  memcpy(cf->data, &pkt[PANDA_CAN_HEADER_SIZE], len);
+
+  dev->stats.rx_packets++;
+  dev->stats.rx_bytes += len;
+  netif_rx_ni(skb);
+}
+
+// parses rx_buf, keeping a trailing partial packet for the next read
+static void panda_can_unpack(u32 len) {
+  u32 i;
+  u32 pos = 0U;
+  u8 *dat = panda_can.rx_buf;
+
+  while ((len - pos) >= PANDA_CAN_HEADER_SIZE) {
+    u8 data_len = panda_dlc_to_len[dat[pos] >> 4];
+    u32 pkt_len = PANDA_CAN_HEADER_SIZE + data_len;
+    u8 checksum = 0U;
+
+    if ((len - pos) < pkt_len) {
+      break;
+    }
+    for (i = 0U; i < pkt_len; i++) {
+      checksum ^= dat[pos + i];
+    }
+    if (checksum != 0U) {
+      // can't resync inside the stream, drop the rest
+      pr_debug("spidev_panda: CAN packet bad checksum\n");
+      pos = len;
+      break;
+    }
+
+    panda_can_rx_frame(&dat[pos], data_len);
+    pos += pkt_len;
+  }
+
+  panda_can.rx_carry = len - pos;
+  memmove(dat, &dat[pos], panda_can.rx_carry);
+}
+
+// *** thread ***
+static long panda_can_xfer(struct spidev_data *spidev, u8 endpoint, u8 *tx, u32 tx_len, u8 *rx, u32 rx_len_max) {
+  long ret;
+  struct spi_device *spi;
+  struct spi_panda_transfer pt = {
+    .tx_buf = (uintptr_t)tx,
+    .tx_length = tx_len,
+    .rx_buf = (uintptr_t)rx,
+    .rx_length_max = rx_len_max,
+    .endpoint = endpoint,
+  };
+
+  spin_lock_irq(&spidev->spi_lock);
+  spi = spi_dev_get(spidev->spi);
+  spin_unlock_irq(&spidev->spi_lock);
+  if (spi == NULL) {
+    return -ESHUTDOWN;
+  }
+
+  mutex_lock(&spidev->buf_lock);
+  ret = panda_transfer_retry(spidev, spi, &pt, false);
+  mutex_unlock(&spidev->buf_lock);
+
+  spi_dev_put(spi);
+  return ret;
+}
+
+// returns true if there was anything to do
+static bool panda_can_cycle(void) {
+  long ret;
+  u32 rx_len = 0U;
+  bool busy = false;
+
+  panda_can_fill_tx();
+
+  if (can_loopback) {
+    memcpy(&panda_can.rx_buf[panda_can.rx_carry], panda_can.tx_buf, panda_can.tx_len);
+    rx_len = panda_can.tx_len;
+    busy = (panda_can.tx_len > 0U);
+    panda_can.tx_len = 0U;
+  } else if (panda_can.spidev != NULL) {
+    // a NACK means the panda's TX queues are full, keep the data for the next cycle
+    if (panda_can.tx_len > 0U) {
+      ret = panda_can_xfer(panda_can.spidev, PANDA_CAN_EP_WRITE, panda_can.tx_buf, panda_can.tx_len, NULL, 0U);
+      if (ret >= 0) {
+        panda_can.tx_len = 0U;
+        busy = true;
+      }
+    }
+
+    ret = panda_can_xfer(panda_can.spidev, PANDA_CAN_EP_READ, NULL, 0U, &panda_can.rx_buf[panda_can.rx_carry], PANDA_CAN_XFER_MAX);
+    if (ret > 0) {
+      rx_len = ret;
+      busy = true;
+    }
+  } else {
+    // no panda, nowhere to send
+    panda_can.tx_len = 0U;
+  }
+
+  if (rx_len > 0U) {
+    panda_can_unpack(panda_can.rx_carry + rx_len);
+  }
+  return busy;
+}
+
+static int panda_can_thread(void *unused) {
+  bool busy;
+
+  while (!kthread_should_stop()) {
+    wait_event_interruptible(panda_can.wq, kthread_should_stop() || (READ_ONCE(panda_can.up_cnt) > 0U));
+
+    mutex_lock(&panda_can.lock);
+    busy = (panda_can.up_cnt > 0U) && panda_can_cycle();
+    mutex_unlock(&panda_can.lock);
+
+    // keep draining while there's traffic
+    if (!busy && skb_queue_empty(&panda_can.txq)) {
+      usleep_range(can_poll_us, can_poll_us + (can_poll_us / 4U));
+    }
+  }
+  return 0;
+}
+
+// *** netdev ***
+static int panda_can_open(struct net_device *dev) {
+  int ret = open_candev(dev);
+  if (ret < 0) {
+    return ret;
+  }
+
+  mutex_lock(&panda_can.lock);
+  if ((panda_can.up_cnt == 0U) && (panda_can.spidev != NULL)) {
+    ret = panda_can_spidev_get(panda_can.spidev);
+  }
+  if (ret == 0) {
+    panda_can.up_cnt++;
+  }
+  mutex_unlock(&panda_can.lock);
+
+  if (ret < 0) {
+    close_candev(dev);
+    return ret;
+  }
+
+  ((struct panda_can_priv *)netdev_priv(dev))->can.state = CAN_STATE_ERROR_ACTIVE;
+  netif_start_queue(dev);
+  wake_up(&panda_can.wq);
+  return 0;
+}
+
+static int panda_can_stop(struct net_device *dev) {
+  netif_stop_queue(dev);
+
+  mutex_lock(&panda_can.lock);
+  panda_can.up_cnt--;
+  if ((panda_can.up_cnt == 0U) && (panda_can.spidev != NULL)) {
+    panda_can_spidev_put(panda_can.spidev);
+  }
+  mutex_unlock(&panda_can.lock);
+
+  ((struct panda_can_priv *)netdev_priv(dev))->can.state = CAN_STATE_STOPPED;
+  close_candev(dev);
+  return 0;
+}
+
+static netdev_tx_t panda_can_start_xmit(struct sk_buff *skb, struct net_device *dev) {
+  struct canfd_frame *cf = (struct canfd_frame *)skb->data;
+
+  if (can_dropped_invalid_skb(dev, skb)) {
+    return NETDEV_TX_OK;
+  }
+
+  // the panda has no remote frames
+  if ((cf->can_id & CAN_RTR_FLAG) != 0U) {
+    dev->stats.tx_dropped++;
+    kfree_skb(skb);
+    return NETDEV_TX_OK;
+  }
+
+  skb_queue_tail(&panda_can.txq, skb);
+  if (skb_queue_len(&panda_can.txq) >= PANDA_CAN_TX_QUEUE_LEN) {
+    netif_stop_queue(dev);
+  }
+  wake_up(&panda_can.wq);
+  return NETDEV_TX_OK;
+}
+
+static const struct net_device_ops panda_can_netdev_ops = {
+  .ndo_open = panda_can_open,
+  .ndo_stop = panda_can_stop,
+  .ndo_start_xmit = panda_can_start_xmit,
+  .ndo_change_mtu = can_change_mtu,
+};
+
+static void panda_can_exit(void) {
+  u32 i;
+
+  if (panda_can.thread != NULL) {
+    kthread_stop(panda_can.thread);
+    panda_can.thread = NULL;
+  }
+  for (i = 0U; i < PANDA_CAN_CNT; i++) {
+    if (panda_can.netdevs[i] != NULL) {
+      unregister_candev(panda_can.netdevs[i]);
+      free_candev(panda_can.netdevs[i]);
+      panda_can.netdevs[i] = NULL;
+    }
+  }
+  skb_queue_purge(&panda_can.txq);
+}
+
+static int panda_can_init(void) {
+  u32 i;
+  int ret = 0;
+
+  mutex_init(&panda_can.lock);
+  init_waitqueue_head(&panda_can.wq);
+  skb_queue_head_init(&panda_can.txq);
+
+  for (i = 0U; i < PANDA_CAN_CNT; i++) {
+    struct panda_can_priv *priv;
+    struct net_device *dev = alloc_candev(sizeof(struct panda_can_priv), 0);
+    if (dev == NULL) {
+      ret = -ENOMEM;
+      break;
+    }
+
+    priv = netdev_priv(dev);
+    priv->bus = i;
+    // the panda's defaults, they're configured through the panda API
+    priv->can.bittiming.bitrate = 500000U;
+    priv->can.data_bittiming.bitrate = 2000000U;
+    priv->can.ctrlmode_supported = CAN_CTRLMODE_FD;
+    priv->can.ctrlmode = CAN_CTRLMODE_FD;
+    priv->can.state = CAN_STATE_STOPPED;
+
+    dev->netdev_ops = &panda_can_netdev_ops;
+    dev->mtu = CANFD_MTU;
+    // no IFF_ECHO, the CAN core loops back locally
+    dev->flags &= ~IFF_ECHO;
+
+    ret = register_candev(dev);
+    if (ret < 0) {
+      free_candev(dev);
+      break;
+    }
+    panda_can.netdevs[i] = dev;
+  }
+
+  if (ret == 0) {
+    panda_can.thread = kthread_run(panda_can_thread, NULL, "spidev_panda_can");
+    if (IS_ERR(panda_can.thread)) {
+      ret = PTR_ERR(panda_can.thread);
+      panda_can.thread = NULL;
+    }
+  }
+
+  if (ret < 0) {
+    pr_err("spidev_panda: failed to set up CAN netdevs: %d\n", ret);
+    panda_can_exit();
+  }
+  return ret;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// shared between the spidev_panda module and userspace clients
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/spi/spidev.h>
+
+struct spi_panda_transfer {
+  __u64 rx_buf;
+  __u64 tx_buf;
+  __u32 tx_length;
+  __u32 rx_length_max;
+  __u32 timeout;
+  __u8 endpoint;
+  __u8 expect_disconnect;
+};
+
+// transfers[i] are executed back-to-back with a single user/kernel crossing.
+// results[i] is the RX length of transfers[i], or a negative error.
+// returns the number of transfers that were attempted.
+#define SPI_PANDA_BATCH_MAX 16U
+#define SPI_PANDA_BATCH_STOP_ON_ERROR (1U << 0)
+
+struct spi_panda_batch {
+  __u64 transfers;  // struct spi_panda_transfer[count]
+  __u64 results;    // __s32[count]
+  __u32 count;
+  __u32 flags;
+};
+
+// a single transfer reuses an ioctl number the panda has no use for
+#define SPI_IOC_PANDA_TRANSFER SPI_IOC_RD_LSB_FIRST
+#define SPI_IOC_PANDA_BATCH _IOW(SPI_IOC_MAGIC, 0x40, struct spi_panda_batch)
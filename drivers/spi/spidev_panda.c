@@ -355,6 +355,7 @@ spidev_get_ioc_message(unsigned int cmd, struct spi_ioc_transfer __user *u_ioc,
 
 
 #include "spi_panda.h"
+#include "spi_panda_can.h"
 
 static long
 spidev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
@@ -418,6 +419,9 @@ spidev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		//retval = __put_user((spi->mode & SPI_LSB_FIRST) ?  1 : 0,
 		//			(__u8 __user *)arg);
 		break;
+	case SPI_IOC_PANDA_BATCH:
+		retval = panda_transfer_batch(spidev, spi, arg);
+		break;
 	case SPI_IOC_RD_BITS_PER_WORD:
 		retval = __put_user(spi->bits_per_word, (__u8 __user *)arg);
 		break;
@@ -605,6 +609,12 @@ static int spidev_open(struct inode *inode, struct file *filp)
 		goto err_find_dev;
 	}
 
+	/* the CAN netdevs are up, and own the panda */
+	if (panda_can_owns_spidev) {
+		status = -EBUSY;
+		goto err_find_dev;
+	}
+
 	if (!spidev->tx_buffer) {
 		spidev->tx_buffer = kmalloc(bufsiz, GFP_KERNEL);
 		if (!spidev->tx_buffer) {
@@ -800,10 +810,12 @@ static int spidev_probe(struct spi_device *spi)
 
 	spidev->speed_hz = spi->max_speed_hz;
 
-	if (status == 0)
+	if (status == 0) {
 		spi_set_drvdata(spi, spidev);
-	else
+		panda_can_attach(spidev);
+	} else {
 		kfree(spidev);
+	}
 
 	return status;
 }
@@ -812,6 +824,8 @@ static int spidev_remove(struct spi_device *spi)
 {
 	struct spidev_data	*spidev = spi_get_drvdata(spi);
 
+	panda_can_detach(spidev);
+
 	/* make sure ops on existing fds can abort cleanly */
 	spin_lock_irq(&spidev->spi_lock);
 	spidev->spi = NULL;
@@ -868,8 +882,20 @@ static int __init spidev_init(void)
 		return PTR_ERR(spidev_class);
 	}
 
+	panda_init();
+
+	status = panda_can_init();
+	if (status < 0) {
+		panda_exit();
+		class_destroy(spidev_class);
+		unregister_chrdev(SPIDEV_MAJOR, spidev_spi_driver.driver.name);
+		return status;
+	}
+
 	status = spi_register_driver(&spidev_spi_driver);
 	if (status < 0) {
+		panda_can_exit();
+		panda_exit();
 		class_destroy(spidev_class);
 		unregister_chrdev(SPIDEV_MAJOR, spidev_spi_driver.driver.name);
 	}
@@ -880,6 +906,8 @@ module_init(spidev_init);
 static void __exit spidev_exit(void)
 {
 	spi_unregister_driver(&spidev_spi_driver);
+	panda_can_exit();
+	panda_exit();
 	class_destroy(spidev_class);
 	unregister_chrdev(SPIDEV_MAJOR, spidev_spi_driver.driver.name);
 }
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+# Checks the spidev_panda CAN netdevs without a panda:
+#   sudo insmod spidev_panda.ko can_loopback=1
+#   for i in 0 1 2; do sudo ip link set can$i up; done
+#   ./test_can_loopback.py can0 can1 can2
+# Every frame sent goes through the panda packing and comes back as RX.
+import random
+import socket
+import struct
+import sys
+
+CAN_EFF_FLAG = 0x80000000
+CANFD_FRAME = struct.Struct("=IBB2x64s")
+CANFD_LENS = (0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64)
+
+
+def open_socket(iface):
+  s = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
+  s.setsockopt(socket.SOL_CAN_RAW, socket.CAN_RAW_FD_FRAMES, 1)
+  # only see what comes back through the driver, not the CAN core's local echo
+  s.setsockopt(socket.SOL_CAN_RAW, socket.CAN_RAW_LOOPBACK, 0)
+  s.settimeout(1)
+  s.bind((iface,))
+  return s
+
+
+def random_frame():
+  extended = random.random() < 0.5
+  can_id = random.randrange(0x20000000 if extended else 0x800)
+  length = random.choice(CANFD_LENS)
+  return (can_id | (CAN_EFF_FLAG if extended else 0)), random.randbytes(length)
+
+
+def run(iface, n):
+  s = open_socket(iface)
+  for _ in range(n):
+    can_id, dat = random_frame()
+    s.send(CANFD_FRAME.pack(can_id, len(dat), 0, dat))
+
+    rx_id, rx_len, _, rx_dat = CANFD_FRAME.unpack(s.recv(CANFD_FRAME.size))
+    assert (rx_id, rx_dat[:rx_len]) == (can_id, dat), f"{iface}: sent {can_id:#x} {dat.hex()}, got {rx_id:#x} {rx_dat[:rx_len].hex()}"
+  s.close()
+  print(f"{iface}: {n} frames OK")
+
+
+if __name__ == "__main__":
+  for iface in (sys.argv[1:] or ["can0", ]):
+    run(iface, 1000)
@@ -0,0 +1,23 @@
+#!/usr/bin/env python3
+# Converts a can_logger.py or cabana CSV to a binary CAN log (see python/canlog.py), or back with --to-csv.
+import argparse
+import csv
+
+from panda.python.canlog import CanLogReader, csv_to_canlog
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("input")
+  parser.add_argument("output")
+  parser.add_argument("--to-csv", action="store_true", help="convert a binary log to can_logger.py's CSV")
+  args = parser.parse_args()
+
+  if args.to_csv:
+    with CanLogReader(args.input) as log, open(args.output, "w", newline='') as out:
+      writer = csv.writer(out)
+      writer.writerow(['Bus', 'MessageID', 'Message', 'MessageLength', 'Time'])
+      start = log.start_time or 0
+      for t, address, dat, bus in log:
+        writer.writerow([str(bus), hex(address), f"0x{dat.hex()}", len(dat), str((t - start) / 1e6)])
+  else:
+    print(f"converted {csv_to_canlog(args.input, args.output)} messages")
@@ -1,43 +1,52 @@
 #!/usr/bin/env python3
-
+import argparse
 import csv
 import time
 from panda import Panda
+from panda.python.canlog import CanLogWriter
 
-def can_logger():
+def can_logger(output, use_csv):
   p = Panda()
 
+  bus_msg_cnt = [0, 0, 0]
   try:
-    outputfile = open('output.csv', 'w')
-    csvwriter = csv.writer(outputfile)
-    # Write Header
-    csvwriter.writerow(['Bus', 'MessageID', 'Message', 'MessageLength', 'Time'])
-    print("Writing csv file output.csv. Press Ctrl-C to exit...\n")
-
-    bus0_msg_cnt = 0
-    bus1_msg_cnt = 0
-    bus2_msg_cnt = 0
+    if use_csv:
+      outputfile = open(output, 'w')
+      csvwriter = csv.writer(outputfile)
+      # Write Header
+      csvwriter.writerow(['Bus', 'MessageID', 'Message', 'MessageLength', 'Time'])
+    else:
+      log = CanLogWriter(output)
+    print(f"Writing {output}. Press Ctrl-C to exit...\n")
 
     start_time = time.time()
     while True:
       can_recv = p.can_recv()
 
-      for address, dat, src in can_recv:
-        csvwriter.writerow(
-          [str(src), str(hex(address)), f"0x{dat.hex()}", len(dat), str(time.time() - start_time)])
+      if use_csv:
+        for address, dat, src in can_recv:
+          csvwriter.writerow(
+            [str(src), str(hex(address)), f"0x{dat.hex()}", len(dat), str(time.time() - start_time)])
+      else:
+        log.write(can_recv)
 
-        if src == 0:
-          bus0_msg_cnt += 1
-        elif src == 1:
-          bus1_msg_cnt += 1
-        elif src == 2:
-          bus2_msg_cnt += 1
+      for _, _, src in can_recv:
+        if src < len(bus_msg_cnt):
+          bus_msg_cnt[src] += 1
 
-        print(f"Message Counts... Bus 0: {bus0_msg_cnt} Bus 1: {bus1_msg_cnt} Bus 2: {bus2_msg_cnt}", end='\r')
+      if len(can_recv):
+        print(f"Message Counts... Bus 0: {bus_msg_cnt[0]} Bus 1: {bus_msg_cnt[1]} Bus 2: {bus_msg_cnt[2]}", end='\r')
 
   except KeyboardInterrupt:
-    print(f"\nNow exiting. Final message Counts... Bus 0: {bus0_msg_cnt} Bus 1: {bus1_msg_cnt} Bus 2: {bus2_msg_cnt}")
-    outputfile.close()
+    print(f"\nNow exiting. Final message Counts... Bus 0: {bus_msg_cnt[0]} Bus 1: {bus_msg_cnt[1]} Bus 2: {bus_msg_cnt[2]}")
+    if use_csv:
+      outputfile.close()
+    else:
+      log.close()
 
 if __name__ == "__main__":
-  can_logger()
+  parser = argparse.ArgumentParser(description="Logs all CAN messages, to a binary CAN log (see python/canlog.py) or CSV")
+  parser.add_argument("--csv", action="store_true", help="write the old CSV format")
+  parser.add_argument("-o", "--output", help="output file, output.canlog or output.csv by default")
+  args = parser.parse_args()
+  can_logger(args.output or ("output.csv" if args.csv else "output.canlog"), args.csv)
@@ -1,14 +1,13 @@
 #!/usr/bin/env python3
 
-# Given an interesting CSV file of CAN messages and a list of background CAN
-# messages, print which bits in the interesting file have never appeared
-# in the background files.
+# Given an interesting CAN log and a list of background CAN logs, print which
+# bits in the interesting file have never appeared in the background files.
 
-# Expects the CSV file to be in one of the following formats:
+# Takes binary CAN logs (can_logger.py), or CSV files in one of the following formats:
 
-# can_logger.py
-# Bus,MessageID,Message,MessageLength
-# 0,0x292,0x040000001068,6
+# can_logger.py --csv
+# Bus,MessageID,Message,MessageLength,Time
+# 0,0x292,0x040000001068,6,0.51
 
 # The old can_logger.py format is also supported:
 # Bus,MessageID,Message
@@ -18,95 +17,31 @@
 # time,addr,bus,data
 # 240.47911496100002,53,0,0acc0ade0074bf9e
 
+# The bit statistics are computed by python/cananalysis.py.
 
-import csv
 import sys
 
-class Message():
-  """Details about a specific message ID."""
-
-  def __init__(self, message_id):
-    self.message_id = message_id
-    self.data = {}  # keyed by hex string encoded message data
-    self.ones = [0] * 64   # bit set if 1 is seen
-    self.zeros = [0] * 64  # bit set if 0 has been seen
-
-  def printBitDiff(self, other):
-    """Prints bits that are set or cleared compared to other background."""
-    for i in range(len(self.ones)):
-      new_ones = ((~other.ones[i]) & 0xff) & self.ones[i]
-      if new_ones:
-        print('id %s new one  at byte %d bitmask %d' % (
-            self.message_id, i, new_ones))
-      new_zeros = ((~other.zeros[i]) & 0xff) & self.zeros[i]
-      if new_zeros:
-        print('id %s new zero at byte %d bitmask %d' % (
-            self.message_id, i, new_zeros))
-
-
-class Info():
-  """A collection of Messages."""
-
-  def __init__(self):
-    self.messages = {}  # keyed by MessageID
-
-  def load(self, filename):
-    """Given a CSV file, adds information about message IDs and their values."""
-    with open(filename) as inp:
-      reader = csv.reader(inp)
-      header = next(reader, None)
-      if header[0] == 'time':
-        self.cabana(reader)
-      else:
-        self.logger(reader)
-
-  def cabana(self, reader):
-    for row in reader:
-      bus = row[2]
-      message_id = hex(int(row[1]))[2:]
-      message_id = f'{bus}:{message_id}'
-      data = row[3]
-      self.store(message_id, data)
-
-  def logger(self, reader):
-    for row in reader:
-      bus = row[0]
-      if row[1].startswith('0x'):
-        message_id = row[1][2:]  # remove leading '0x'
-      else:
-        message_id = hex(int(row[1]))[2:]  # old message IDs are in decimal
-      message_id = f'{bus}:{message_id}'
-      if row[1].startswith('0x'):
-        data = row[2][2:]  # remove leading '0x'
-      else:
-        data = row[2]
-      self.store(message_id, data)
-
-  def store(self, message_id, data):
-      if message_id not in self.messages:
-        self.messages[message_id] = Message(message_id)
-      message = self.messages[message_id]
-      if data not in self.messages[message_id].data:
-        message.data[data] = True
-      bts = bytearray.fromhex(data)
-      for i in range(len(bts)):
-        message.ones[i] = message.ones[i] | int(bts[i])
-        # Inverts the data and masks it to a byte to get the zeros as ones.
-        message.zeros[i] = message.zeros[i] | ((~int(bts[i])) & 0xff)
+from panda.python.cananalysis import BitStats
 
 
 def PrintUnique(interesting_file, background_files):
-  background = Info()
+  background = BitStats(flips=False)
   for background_file in background_files:
-    background.load(background_file)
-  interesting = Info()
-  interesting.load(interesting_file)
-  for message_id in sorted(interesting.messages):
-    if message_id not in background.messages:
+    background.add_file(background_file)
+  interesting = BitStats(flips=False).add_file(interesting_file)
+
+  for key in sorted(interesting.ids(), key=lambda k: f'{k[0]}:{k[1]:x}'):
+    message_id = f'{key[0]}:{key[1]:x}'
+    if key not in background.rows:
       print('New message_id: %s' % message_id)
-    else:
-      interesting.messages[message_id].printBitDiff(
-          background.messages[message_id])
+      continue
+    new_ones = ~background.ever_one(key) & interesting.ever_one(key)
+    new_zeros = ~background.ever_zero(key) & interesting.ever_zero(key)
+    for i in range(len(new_ones)):
+      if new_ones[i]:
+        print('id %s new one  at byte %d bitmask %d' % (message_id, i, new_ones[i]))
+      if new_zeros[i]:
+        print('id %s new zero at byte %d bitmask %d' % (message_id, i, new_zeros[i]))
 
 
 if __name__ == "__main__":
@@ -3,86 +3,49 @@ import os
 import sys
 import time
 import usb1
+import contextlib
 import struct
 import hashlib
+import threading
 import binascii
+from concurrent.futures import ThreadPoolExecutor
 from functools import wraps, partial
 from itertools import accumulate
 
 from opendbc.car.structs import CarParams
 
 from .base import BaseHandle
+from .canpack import (pack_can_buffer, unpack_can_buffer, unpack_can_frames, calculate_checksum,  # noqa: F401
+                      CANPACKET_HEAD_SIZE, DLC_TO_LEN, LEN_TO_DLC, CAN_FRAME_FLAG_FD, CAN_FRAME_FLAG_EXTENDED,
+                      CAN_FRAME_FLAG_RETURNED, CAN_FRAME_FLAG_REJECTED)
+from .canreader import CanReader
 from .constants import FW_PATH, McuType
 from .dfu import PandaDFU
-from .spi import PandaSpiHandle, PandaSpiException, PandaProtocolMismatch
+from .spi import PandaSpiHandle, PandaSpiException, PandaProtocolMismatch, PandaSpiTransferFailed, XFER_SIZE, DEV_PATH as SPI_DEV_PATH
 from .usb import PandaUsbHandle
+from .usbregistry import UsbRegistry
 from .utils import logger
 
 __version__ = '0.0.10'
 
-CANPACKET_HEAD_SIZE = 0x6
-DLC_TO_LEN = [0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64]
-LEN_TO_DLC = {length: dlc for (dlc, length) in enumerate(DLC_TO_LEN)}
 PANDA_CAN_CNT = 3
 
+# health and CAN health records streamed on the CAN RX stream, see Panda.set_telemetry_rate
+TELEMETRY_BUS = 7
+TELEMETRY_ADDR_HEALTH = 0
+TELEMETRY_ADDR_CAN_HEALTH = 1
 
-def calculate_checksum(data):
-  res = 0
-  for b in data:
-    res ^= b
-  return res
+# runs the SPI probe while connect() looks for a USB panda, created on first use
+_probe_pool: ThreadPoolExecutor | None = None
+_probe_pool_lock = threading.Lock()
 
-def pack_can_buffer(arr, chunk=False, fd=False):
-  snds = [bytearray(), ]
-  for address, dat, bus in arr:
-    extended = 1 if address >= 0x800 else 0
-    data_len_code = LEN_TO_DLC[len(dat)]
-    header = bytearray(CANPACKET_HEAD_SIZE)
-    word_4b = (address << 3) | (extended << 2)
-    header[0] = (data_len_code << 4) | (bus << 1) | int(fd)
-    header[1] = word_4b & 0xFF
-    header[2] = (word_4b >> 8) & 0xFF
-    header[3] = (word_4b >> 16) & 0xFF
-    header[4] = (word_4b >> 24) & 0xFF
-    header[5] = calculate_checksum(header[:5] + dat)
 
-    snds[-1].extend(header)
-    snds[-1].extend(dat)
-    if chunk and len(snds[-1]) > 256:
-      snds.append(bytearray())
-
-  return snds
-
-def unpack_can_buffer(dat):
-  ret = []
-
-  while len(dat) >= CANPACKET_HEAD_SIZE:
-    data_len = DLC_TO_LEN[(dat[0]>>4)]
-
-    header = dat[:CANPACKET_HEAD_SIZE]
-
-    bus = (header[0] >> 1) & 0x7
-    address = (header[4] << 24 | header[3] << 16 | header[2] << 8 | header[1]) >> 3
-
-    if (header[1] >> 1) & 0x1:
-      # returned
-      bus += 128
-    if header[1] & 0x1:
-      # rejected
-      bus += 192
-
-    # we need more from the next transfer
-    if data_len > len(dat) - CANPACKET_HEAD_SIZE:
-      break
-
-    assert calculate_checksum(dat[:(CANPACKET_HEAD_SIZE+data_len)]) == 0, "CAN packet checksum incorrect"
-
-    data = dat[CANPACKET_HEAD_SIZE:(CANPACKET_HEAD_SIZE+data_len)]
-    dat = dat[(CANPACKET_HEAD_SIZE+data_len):]
-
-    ret.append((address, data, bus))
-
-  return (ret, dat)
+def _get_probe_pool() -> ThreadPoolExecutor:
+  global _probe_pool
+  with _probe_pool_lock:
+    if _probe_pool is None:
+      _probe_pool = ThreadPoolExecutor(max_workers=4, thread_name_prefix="panda-probe")
+    return _probe_pool
 
 
 def ensure_version(desc, lib_field, panda_field, fn):
@@ -124,6 +87,10 @@ class Panda:
   CAN_HEALTH_PACKET_VERSION = 5
   HEALTH_STRUCT = struct.Struct("<IIIIIIIIBBBBBHBBBHfBBHHHB")
   CAN_HEALTH_STRUCT = struct.Struct("<BIBBBBBBBBIIIIIIIHHBBBIIII")
+  PROFILE_STATS_STRUCT = struct.Struct("<IIIQ")
+
+  # the firmware's profiler probes, in profile_probe_t order
+  PROFILER_PROBES = ["can_rx", "process_can", "usb_irq", "spi_rx_done", "safety_rx", "safety_tx", "spi_can_prefetch"]
 
   H7_DEVICES = [HW_TYPE_RED_PANDA, HW_TYPE_TRES, HW_TYPE_CUATRO, HW_TYPE_BODY]
   SUPPORTED_DEVICES = H7_DEVICES
@@ -146,6 +113,9 @@ class Panda:
     self._handle_open = False
     self.can_rx_overflow_buffer = b''
     self._can_speed_kbps = can_speed_kbps
+    self._telemetry: dict = {"health": None, "can_health": [None] * PANDA_CAN_CNT}
+    self._telemetry_callback = None
+    self._can_reader: CanReader | None = None
 
     if cli and serial is None:
         self._connect_serial = self._cli_select_panda()
@@ -185,6 +155,7 @@ class Panda:
     self.close()
 
   def close(self):
+    self.stop_can_reader()
     if self._handle_open:
       self._handle.close()
       self._handle_open = False
@@ -195,13 +166,15 @@ class Panda:
     self.close()
 
     self._handle = None
+    registry = UsbRegistry.get()
     while self._handle is None:
-      # try USB first, then SPI
-      self._context, self._handle, serial, self.bootstub = self.usb_connect(self._connect_serial, claim=claim, no_error=wait)
-      if self._handle is None:
-        self._context, self._handle, serial, self.bootstub = self.spi_connect(self._connect_serial)
+      generation = registry.generation if registry is not None else 0
+      self._context, self._handle, serial, self.bootstub = self._probe(claim, wait)
       if not wait:
         break
+      if self._handle is None and registry is not None:
+        # wake up as soon as a USB device shows up, SPI is polled
+        registry.wait(generation, timeout=0.005)
 
     if self._handle is None:
       raise Exception("failed to connect to panda")
@@ -216,21 +189,44 @@ class Panda:
     if hw_type not in self.SUPPORTED_DEVICES:
       print("WARNING: Using deprecated HW")
 
+    # only set what isn't already, a panda that was just reset or reconnected to needs no changes
+    config = self.get_connect_config()
+
     # disable openpilot's heartbeat checks
     if self._disable_checks:
-      self.set_heartbeat_disabled()
-      self.set_power_save(0)
+      if config is None or not config["heartbeat_disabled"]:
+        self.set_heartbeat_disabled()
+      if config is None or config["power_save"]:
+        self.set_power_save(0)
 
     # reset comms
     self.can_reset_communications()
 
-    # disable automatic CAN-FD switching
     for bus in range(PANDA_CAN_CNT):
-      self.set_canfd_auto(bus, False)
+      # disable automatic CAN-FD switching
+      if config is None or config["canfd_auto"][bus]:
+        self.set_canfd_auto(bus, False)
+
+      # set CAN speed
+      if config is None or config["can_speed"][bus] != int(self._can_speed_kbps * 10):
+        self.set_can_speed_kbps(bus, self._can_speed_kbps)
+
+  def _probe(self, claim, wait):
+    # USB and SPI are probed at once, USB wins if both find a panda
+    if not os.path.exists(SPI_DEV_PATH):
+      return self.usb_connect(self._connect_serial, claim=claim, no_error=wait)
+    spi = _get_probe_pool().submit(self.spi_connect, self._connect_serial)
+    usb = self.usb_connect(self._connect_serial, claim=claim, no_error=wait)
+    if usb[1] is None:
+      return spi.result()
 
-    # set CAN speed
-    for bus in range(PANDA_CAN_CNT):
-      self.set_can_speed_kbps(bus, self._can_speed_kbps)
+    try:
+      spi_handle = spi.result()[1]
+      if spi_handle is not None:
+        spi_handle.close()
+    except PandaSpiException:
+      pass
+    return usb
 
   @property
   def spi(self) -> bool:
@@ -256,8 +252,9 @@ class Panda:
       return None, None, None, False
 
     # ensure our protocol version matches the panda
-    if (not ignore_version) and spi_version != handle.PROTOCOL_VERSION:
+    if (not ignore_version) and spi_version != handle.PROTOCOL_VERSION and spi_version not in handle.LEGACY_PROTOCOL_VERSIONS:
       raise PandaProtocolMismatch(f"panda protocol mismatch: expected {handle.PROTOCOL_VERSION}, got {spi_version}. reflash panda")
+    handle.protocol_version = spi_version
 
     # got a device and all good
     return None, handle, spi_serial, bootstub
@@ -265,43 +262,56 @@ class Panda:
   @classmethod
   def usb_connect(cls, serial, claim=True, no_error=False):
     handle, usb_serial, bootstub = None, None, None
-    context = usb1.USBContext()
-    context.open()
+    registry = UsbRegistry.get()
+    if registry is not None:
+      # devices opened from the registry belong to its context
+      context = None
+    else:
+      context = usb1.USBContext()
+      context.open()
     try:
-      for device in context.getDeviceList(skip_on_error=True):
-        if device.getVendorID() in cls.USB_VIDS and device.getProductID() in cls.USB_PIDS:
-          try:
-            this_serial = device.getSerialNumber()
-          except Exception:
-            # Allow to ignore errors on reconnect. USB hubs need some time to initialize after panda reset
-            if not no_error:
-              logger.exception("failed to get serial number of panda")
-            continue
-
-          if serial is None or this_serial == serial:
-            logger.debug("opening device %s %s", this_serial, hex(device.getProductID()))
-
-            usb_serial = this_serial
-            bootstub = (device.getProductID() & 0xF0) == 0xe0
-            handle = device.open()
-            if sys.platform not in ("win32", "cygwin", "msys", "darwin"):
-              handle.setAutoDetachKernelDriver(True)
-            if claim:
-              handle.claimInterface(0)
-              # handle.setInterfaceAltSetting(0, 0)  # Issue in USB stack
-
-            break
+      for device, this_serial in cls._usb_devices(registry, context, no_error):
+        if serial is None or this_serial == serial:
+          logger.debug("opening device %s %s", this_serial, hex(device.getProductID()))
+
+          usb_serial = this_serial
+          bootstub = (device.getProductID() & 0xF0) == 0xe0
+          handle = device.open()
+          if sys.platform not in ("win32", "cygwin", "msys", "darwin"):
+            handle.setAutoDetachKernelDriver(True)
+          if claim:
+            handle.claimInterface(0)
+            # handle.setInterfaceAltSetting(0, 0)  # Issue in USB stack
+
+          break
     except Exception:
       logger.exception("USB connect error")
 
     usb_handle = None
     if handle is not None:
       usb_handle = PandaUsbHandle(handle)
-    else:
+    elif context is not None:
       context.close()
 
     return context, usb_handle, usb_serial, bootstub
 
+  @classmethod
+  def _usb_devices(cls, registry, context, no_error=False):
+    if registry is not None:
+      yield from registry.devices(cls.USB_VIDS, cls.USB_PIDS, no_error=no_error)
+      return
+
+    for device in context.getDeviceList(skip_on_error=True):
+      if device.getVendorID() in cls.USB_VIDS and device.getProductID() in cls.USB_PIDS:
+        try:
+          this_serial = device.getSerialNumber()
+        except Exception:
+          # Allow to ignore errors on reconnect. USB hubs need some time to initialize after panda reset
+          if not no_error:
+            logger.exception("failed to get serial number of panda")
+          continue
+        yield device, this_serial
+
   def is_connected_spi(self):
     return isinstance(self._handle, PandaSpiHandle)
 
@@ -319,17 +329,13 @@ class Panda:
   def usb_list(cls):
     ret = []
     try:
-      with usb1.USBContext() as context:
-        for device in context.getDeviceList(skip_on_error=True):
-          if device.getVendorID() in cls.USB_VIDS and device.getProductID() in cls.USB_PIDS:
-            try:
-              serial = device.getSerialNumber()
-              if len(serial) == 24:
-                ret.append(serial)
-              else:
-                logger.warning(f"found device with panda descriptors but invalid serial: {serial}", RuntimeWarning)
-            except Exception:
-              logger.exception("error connecting to panda")
+      registry = UsbRegistry.get()
+      with contextlib.nullcontext() if registry is not None else usb1.USBContext() as context:
+        for _, serial in cls._usb_devices(registry, context):
+          if len(serial) == 24:
+            ret.append(serial)
+          else:
+            logger.warning(f"found device with panda descriptors but invalid serial: {serial}", RuntimeWarning)
     except Exception:
       logger.exception("exception while listing pandas")
     return ret
@@ -386,7 +392,18 @@ class Panda:
     return fr[4:8] == b"\xde\xad\xd0\x0d"
 
   @staticmethod
-  def flash_static(handle, code, mcu_type):
+  def sector_hashes(handle, sectors):
+    """SHA-1 of each of the app's flash sectors, or None if the bootstub doesn't support it."""
+    ret = {}
+    for i in sectors:
+      dat = bytes(handle.controlRead(Panda.REQUEST_IN, 0xb3, i, 0, 20))
+      if len(dat) != 20:
+        return None
+      ret[i] = dat
+    return ret
+
+  @staticmethod
+  def flash_static(handle, code, mcu_type, incremental=True):
     assert mcu_type is not None, "must set valid mcu_type to flash"
 
     # confirm flasher is present
@@ -398,20 +415,54 @@ class Panda:
     assert last_sector >= 1, "Binary too small? No sector to erase."
     assert last_sector < 7, "Binary too large! Risk of overwriting provisioning chunk."
 
+    # what each sector should contain, the rest of the last one stays erased
+    sectors = {}
+    for i in range(1, last_sector + 1):
+      start = mcu_type.config.sector_address(i) - mcu_type.config.app_address
+      size = mcu_type.config.sector_sizes[i]
+      sectors[i] = code[start:start + size]
+    expected = {i: hashlib.sha1(dat.ljust(mcu_type.config.sector_sizes[i], b"\xff")).digest() for i, dat in sectors.items()}
+
+    st = time.monotonic()
+    current = Panda.sector_hashes(handle, sectors) if incremental else None
+    if current is None:
+      if incremental:
+        logger.info("flash: bootstub can't hash sectors, flashing all of them")
+      to_flash = list(sectors)
+    else:
+      to_flash = [i for i in sectors if current[i] != expected[i]]
+    logger.info(f"flash: {len(to_flash)}/{len(sectors)} sectors changed ({time.monotonic() - st:.2f}s)")
+
     # unlock flash
     logger.info("flash: unlocking")
     handle.controlWrite(Panda.REQUEST_IN, 0xb1, 0, 0, b'')
 
     # erase sectors
-    logger.info(f"flash: erasing sectors 1 - {last_sector}")
-    for i in range(1, last_sector + 1):
+    st = time.monotonic()
+    logger.info(f"flash: erasing sectors {to_flash}")
+    for i in to_flash:
       handle.controlWrite(Panda.REQUEST_IN, 0xb2, i, 0, b'')
+    logger.info(f"flash: erased in {time.monotonic() - st:.2f}s")
 
-    # flash over EP2
-    STEP = 0x200
+    # flash over EP2, a sector at a time so unchanged ones can be skipped
+    STEP = 0x4000
+    st = time.monotonic()
     logger.info("flash: flashing")
-    for i in range(0, len(code), STEP):
-      handle.bulkWrite(2, code[i:i + STEP])
+    for n, i in enumerate(to_flash):
+      if current is not None:
+        handle.controlWrite(Panda.REQUEST_IN, 0xb4, i, 0, b'')
+      else:
+        assert i == n + 1
+      for j in range(0, len(sectors[i]), STEP):
+        handle.bulkWrite(2, sectors[i][j:j + STEP])
+    logger.info(f"flash: flashed {sum(len(sectors[i]) for i in to_flash)} bytes in {time.monotonic() - st:.2f}s")
+
+    # verify
+    if current is not None:
+      st = time.monotonic()
+      if Panda.sector_hashes(handle, sectors) != expected:
+        raise RuntimeError("flash: verification failed, sector hashes don't match")
+      logger.info(f"flash: verified in {time.monotonic() - st:.2f}s")
 
     # reset
     logger.info("flash: resetting")
@@ -420,7 +471,7 @@ class Panda:
     except Exception:
       pass
 
-  def flash(self, fn=None, code=None, reconnect=True):
+  def flash(self, fn=None, code=None, reconnect=True, incremental=True):
     if self.up_to_date(fn=fn):
       logger.info("flash: already up to date")
       return
@@ -447,7 +498,7 @@ class Panda:
     logger.debug("flash: bootstub version is %s", self.get_version())
 
     # do flash
-    Panda.flash_static(self._handle, code, mcu_type=mcu_type)
+    Panda.flash_static(self._handle, code, mcu_type=mcu_type, incremental=incremental)
 
     # reconnect
     if reconnect:
@@ -468,9 +519,21 @@ class Panda:
 
     # reflash after recover
     self.connect(True, True)
+    self.check_bootstub(dfu.bootstub_code())
     self.flash()
     return True
 
+  def check_bootstub(self, code):
+    """Checks the running bootstub's sector against code, instead of reading it back over DFU."""
+    assert self.bootstub
+    hashes = Panda.sector_hashes(self._handle, [0])
+    if hashes is None:
+      logger.info("recover: bootstub can't hash sectors, skipping verification")
+      return
+    expected = hashlib.sha1(code.ljust(self.get_mcu_type().config.sector_sizes[0], b"\xff")).digest()
+    if hashes[0] != expected:
+      raise RuntimeError("recover: bootstub verification failed")
+
   @staticmethod
   def wait_for_dfu(dfu_serial: str | None, timeout: int | None = None) -> bool:
     t_start = time.monotonic()
@@ -510,7 +573,11 @@ class Panda:
   @ensure_health_packet_version
   def health(self):
     dat = self._handle.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, self.HEALTH_STRUCT.size)
-    a = self.HEALTH_STRUCT.unpack(dat)
+    return self._parse_health(dat)
+
+  @classmethod
+  def _parse_health(cls, dat):
+    a = cls.HEALTH_STRUCT.unpack(dat[:cls.HEALTH_STRUCT.size])
     return {
       "uptime": a[0],
       "voltage": a[1],
@@ -541,6 +608,11 @@ class Panda:
 
   @ensure_can_health_packet_version
   def can_health(self, can_number):
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc2, int(can_number), 0, self.CAN_HEALTH_STRUCT.size)
+    return self._parse_can_health(dat)
+
+  @classmethod
+  def _parse_can_health(cls, dat):
     LEC_ERROR_CODE = {
       0: "No error",
       1: "Stuff error",
@@ -551,8 +623,7 @@ class Panda:
       6: "CRCError",
       7: "NoChange",
     }
-    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc2, int(can_number), 0, self.CAN_HEALTH_STRUCT.size)
-    a = self.CAN_HEALTH_STRUCT.unpack(dat)
+    a = cls.CAN_HEALTH_STRUCT.unpack(dat[:cls.CAN_HEALTH_STRUCT.size])
     return {
       "bus_off": a[0],
       "bus_off_cnt": a[1],
@@ -582,6 +653,45 @@ class Panda:
       "can_core_reset_count": a[25],
     }
 
+  # ******************* telemetry *******************
+
+  @ensure_health_packet_version
+  @ensure_can_health_packet_version
+  def set_telemetry_rate(self, rate_hz, callback=None):
+    """Streams the health and CAN health packets on the CAN RX stream.
+
+    The records are decoded by can_recv() and never returned as CAN messages.
+    The latest ones are available from telemetry(), and callback(name, bus, record)
+    is called for each record as it's received, with bus None for the health packet.
+
+    Args:
+      rate_hz (int): records per second, 1, 2, 4 or 8. 0 disables the stream.
+      callback (callable, optional): called for every received record.
+    """
+    # the records are sent on the 8Hz tick, the panda ignores rates it can't keep exactly
+    if rate_hz != 0 and (rate_hz not in range(1, 9) or 8 % rate_hz != 0):
+      raise ValueError(f"unsupported telemetry rate {rate_hz}Hz")
+    self._telemetry_callback = callback
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xc7, int(rate_hz), 0, b'')
+
+  def telemetry(self):
+    """Returns the most recently streamed health and CAN health records, None where nothing was received yet."""
+    return {"health": self._telemetry["health"], "can_health": list(self._telemetry["can_health"])}
+
+  def _handle_telemetry(self, address, dat):
+    if address == TELEMETRY_ADDR_HEALTH:
+      name, bus, record = "health", None, self._parse_health(dat)
+      self._telemetry["health"] = record
+    elif TELEMETRY_ADDR_CAN_HEALTH <= address < TELEMETRY_ADDR_CAN_HEALTH + PANDA_CAN_CNT:
+      name, bus, record = "can_health", address - TELEMETRY_ADDR_CAN_HEALTH, self._parse_can_health(dat)
+      self._telemetry["can_health"][bus] = record
+    else:
+      logger.error(f"unknown telemetry record {address}")
+      return
+
+    if self._telemetry_callback is not None:
+      self._telemetry_callback(name, bus, record)
+
   # ******************* control *******************
 
   def get_version(self):
@@ -649,10 +759,60 @@ class Panda:
   def get_secret(self):
     return self._handle.controlRead(Panda.REQUEST_IN, 0xd0, 1, 0, 0x10)
 
+  def get_spi_timing(self, reset=False):
+    """Returns the panda's time from receiving an SPI header to having the response ready, in microseconds."""
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc8, int(reset), 0, 16)
+    cnt, last_us, max_us, total_us = struct.unpack("<IIII", dat)
+    return {
+      "transfers": cnt,
+      "last_us": last_us,
+      "max_us": max_us,
+      "avg_us": (total_us / cnt) if cnt > 0 else 0.,
+    }
+
+  def get_profile(self, reset=False):
+    """
+      Returns the cycle counts of the firmware's profiler probes, see board/drivers/profiler.h.
+      Empty on release builds, which don't have the profiler.
+    """
+    ret = {}
+    for i, name in enumerate(self.PROFILER_PROBES):
+      last = i == len(self.PROFILER_PROBES) - 1
+      dat = self._handle.controlRead(Panda.REQUEST_IN, 0xcb, i, int(reset and last), self.PROFILE_STATS_STRUCT.size)
+      if len(dat) < self.PROFILE_STATS_STRUCT.size:
+        return {}
+      cnt, min_cycles, max_cycles, total_cycles = self.PROFILE_STATS_STRUCT.unpack(dat)
+      ret[name] = {
+        "count": cnt,
+        "min_cycles": min_cycles,
+        "max_cycles": max_cycles,
+        "avg_cycles": (total_cycles / cnt) if cnt > 0 else 0.,
+        "total_cycles": total_cycles,
+      }
+    return ret
+
+  def set_spi_data_ready(self, enabled):
+    """Drives the SOM GPIO high while an SPI response is ready, for hosts that wait on it instead of polling."""
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xc9, int(enabled), 0, b'')
+
   def get_interrupt_call_rate(self, irqnum):
     dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc4, int(irqnum), 0, 4)
     return struct.unpack("I", dat)[0]
 
+  def get_interrupt_stats(self, irqnum):
+    """
+      Returns an IRQ's calls and handler time over the last second. max_latency_us is the longest
+      it waited while pending behind other handlers, as an upper bound.
+    """
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc4, int(irqnum), 1, 16)
+    call_rate, busy_us, max_duration_us, max_latency_us = struct.unpack("<IIII", dat)
+    return {
+      "call_rate": call_rate,
+      "busy_us": busy_us,
+      "max_duration_us": max_duration_us,
+      "max_latency_us": max_latency_us,
+    }
+
   # ******************* configuration *******************
 
   def set_alternative_experience(self, alternative_experience):
@@ -675,6 +835,22 @@ class Panda:
     # sets the can transceiver enable pin
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xf4, int(bus_num), int(enable), b'')
 
+  def get_connect_config(self):
+    """The settings connect() makes, as the panda has them now. None if the firmware can't report them."""
+    if self.bootstub:
+      return None
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xca, 0, 0, 2 + 3 * PANDA_CAN_CNT)
+    # the bootstub's USB flasher answers any request with a 12 byte header starting with 0xff
+    if len(dat) != 2 + 3 * PANDA_CAN_CNT or dat[0] > 1 or dat[1] > 1:
+      return None
+    buses = [struct.unpack_from("<HB", dat, 2 + 3 * bus) for bus in range(PANDA_CAN_CNT)]
+    return {
+      "heartbeat_disabled": dat[0] == 1,
+      "power_save": dat[1] == 1,
+      "can_speed": [b[0] for b in buses],
+      "canfd_auto": [b[1] == 1 for b in buses],
+    }
+
   def set_can_speed_kbps(self, bus, speed):
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xde, bus, int(speed * 10), b'')
 
@@ -718,18 +894,122 @@ class Panda:
   def can_send(self, addr, dat, bus, *, fd=False, timeout=CAN_SEND_TIMEOUT_MS):
     self.can_send_many([[addr, dat, bus]], fd=fd, timeout=timeout)
 
-  @ensure_can_packet_version
-  def can_recv(self):
-    dat = bytearray()
+  def _can_read(self):
     while True:
       try:
-        dat = self._handle.bulkRead(1, 16384) # Max receive batch size + 2 extra reserve frames
-        break
+        return self._handle.bulkRead(1, 16384) # Max receive batch size + 2 extra reserve frames
       except (usb1.USBErrorIO, usb1.USBErrorOverflow):
         logger.error("CAN: BAD RECV, RETRYING")
         time.sleep(0.1)
+
+  @ensure_can_packet_version
+  def can_recv(self):
+    dat = self._can_read()
     msgs, self.can_rx_overflow_buffer = unpack_can_buffer(self.can_rx_overflow_buffer + dat)
-    return msgs
+    return self._filter_telemetry(msgs)
+
+  @ensure_can_packet_version
+  def can_recv_batch(self, *, columns=False):
+    """Like can_recv, but returns the messages as a numpy array of CAN_FRAME_DTYPE, without
+    creating any Python objects per message.
+
+    Args:
+      columns (bool): return a dict of one array per field instead, e.g. "address" and "data".
+
+    The bus is the physical bus, with returned/rejected messages marked in the flags. Since
+    the panda doesn't timestamp messages, all frames from one read get the host's receive time.
+    """
+    dat = self._can_read()
+    timestamp = int(time.monotonic() * 1e6)
+    frames, self.can_rx_overflow_buffer = unpack_can_frames(self.can_rx_overflow_buffer + dat, timestamp)
+
+    telemetry = frames["bus"] == TELEMETRY_BUS
+    if telemetry.any():
+      for f in frames[telemetry]:
+        self._handle_telemetry(int(f["address"]), bytes(f["data"][:f["len"]]))
+      frames = frames[~telemetry]
+
+    if columns:
+      return {name: frames[name] for name in frames.dtype.names}
+    return frames
+
+  @ensure_can_packet_version
+  def can_send_recv(self, arr, *, fd=False, timeout=CAN_SEND_TIMEOUT_MS):
+    """Sends the CAN messages in arr and returns the received ones, like can_send_many followed by can_recv.
+
+    Over SPI this is done in a single transaction, which saves a full
+    protocol round trip per control loop cycle.
+    """
+    if not isinstance(self._handle, PandaSpiHandle):
+      self.can_send_many(arr, fd=fd, timeout=timeout)
+      return self.can_recv()
+
+    tx = pack_can_buffer(arr, fd=fd)[0]
+    if len(tx) > XFER_SIZE:
+      # only the last chunk goes with the read
+      split = len(tx) - (len(tx) % XFER_SIZE)
+      self._handle.bulkWrite(3, tx[:split], timeout=timeout)
+      tx = tx[split:]
+
+    # the panda only takes the CAN data when its TX queues have room, resend until it does
+    start_time = time.monotonic()
+    while True:
+      dat = self._handle.bulkTransfer(4, tx, XFER_SIZE, timeout=timeout)
+      self.can_rx_overflow_buffer += dat[1:]
+      if dat[0] == 1:
+        break
+      if (timeout != 0) and ((time.monotonic() - start_time) * 1e3 > timeout):
+        raise PandaSpiTransferFailed("CAN TX queues full")
+
+    # read the rest if it didn't fit
+    if len(dat) >= XFER_SIZE:
+      self.can_rx_overflow_buffer += self._handle.bulkRead(1, 16384)
+
+    msgs, self.can_rx_overflow_buffer = unpack_can_buffer(self.can_rx_overflow_buffer)
+    return self._filter_telemetry(msgs)
+
+  def _filter_telemetry(self, msgs):
+    if not any(bus == TELEMETRY_BUS for _, _, bus in msgs):
+      return msgs
+    ret = []
+    for address, dat, bus in msgs:
+      if bus == TELEMETRY_BUS:
+        self._handle_telemetry(address, dat)
+      else:
+        ret.append((address, dat, bus))
+    return ret
+
+  def start_can_reader(self, *, ring_size=1 << 16, callback=None, poll_interval=0.001):
+    """Starts draining the CAN RX stream from a background thread into a host ring.
+
+    Read the messages with can_read(), or pass callback(msgs) to get every batch in the
+    reader thread instead. can_recv() must not be called while the reader runs.
+
+    Args:
+      ring_size (int): ring capacity in messages, a power of two. Messages that don't fit are dropped and counted.
+      callback (callable, optional): called with each list of received messages, bypassing the ring.
+      poll_interval (float): seconds to sleep after an empty read.
+    """
+    self.stop_can_reader()
+    self._can_reader = CanReader(self.can_recv, ring_size=ring_size, callback=callback, poll_interval=poll_interval)
+    self._can_reader.start()
+
+  def stop_can_reader(self):
+    if self._can_reader is not None:
+      self._can_reader.stop()
+      self._can_reader = None
+
+  def can_read(self, timeout=None, max_msgs=1 << 16):
+    """Returns the messages received by the background reader, like can_recv().
+
+    Waits up to timeout seconds for at least one message, or forever if it's None.
+    """
+    assert self._can_reader is not None, "CAN reader isn't running, see start_can_reader()"
+    return self._can_reader.read(timeout, max_msgs)
+
+  def can_reader_stats(self):
+    """Host side receive counters: received, dropped, ring fill and latencies, see CanReader.stats()."""
+    return self._can_reader.stats() if self._can_reader is not None else None
 
   def can_clear(self, bus):
     """Clears all messages from the specified internal CAN ringbuffer as
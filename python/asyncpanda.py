@@ -0,0 +1,238 @@
+# asyncio CAN client on libusb asynchronous transfers, see AsyncPanda.
+import asyncio
+import threading
+from collections import deque
+
+import usb1
+
+from .canpack import pack_can_buffer, unpack_can_buffer
+from .usb import PandaUsbHandle
+from .usbregistry import UsbRegistry
+from .utils import logger
+
+RX_ENDPOINT = 0x81
+TX_ENDPOINT = 3
+
+
+class AsyncPandaError(Exception):
+  pass
+
+
+class AsyncPanda:
+  """
+  Streams CAN over USB with several transfers queued on each bulk endpoint, so the
+  pipe never idles waiting for Python to submit the next one.
+
+    async with AsyncPanda(Panda()) as p:
+      await p.can_send_many(msgs)
+      async for address, dat, bus in p.frames():
+        ...
+
+  The Panda is set up (safety mode, CAN speeds, ...) with its regular sync API. Its CAN
+  stream must only be used through AsyncPanda while this is open. libusb's events are
+  handled on a thread, which hands completed transfers to the event loop.
+  """
+
+  def __init__(self, panda, rx_transfers: int = 4, tx_transfers: int = 4, rx_size: int = 16384, tx_timeout: int = 1000):
+    if not isinstance(panda._handle, PandaUsbHandle):
+      raise AsyncPandaError("AsyncPanda only supports USB pandas")
+    self.panda = panda
+    self._usb = panda._handle._libusb_handle
+    # pandas opened from the USB registry share its context
+    registry = UsbRegistry.get()
+    self._context = panda._context if registry is None else registry.context
+    self._rx_cnt = rx_transfers
+    self._rx_size = rx_size
+    self._tx_timeout = tx_timeout
+
+    self._loop: asyncio.AbstractEventLoop | None = None
+    self._rx: list = []
+    self._tx_free: deque = deque()
+    self._tx_slots = asyncio.Semaphore(tx_transfers)
+    self._tx_cnt = tx_transfers
+    self._in_flight = 0
+    self._lock = threading.Lock()
+    self._running = False
+    self._closing = False
+    self._thread: threading.Thread | None = None
+
+    self._rx_buffer = b''
+    self._frames: deque = deque()
+    self._frames_ready = asyncio.Event()
+    self._error: Exception | None = None
+
+    # counters
+    self.rx_bytes = 0
+    self.rx_transfers_done = 0
+    self.tx_bytes = 0
+    self.tx_transfers_done = 0
+
+  async def __aenter__(self):
+    await self.open()
+    return self
+
+  async def __aexit__(self, *args):
+    await self.close()
+
+  async def open(self):
+    self._loop = asyncio.get_running_loop()
+    self._running = True
+    self._thread = threading.Thread(target=self._handle_events, name="panda-usb-events", daemon=True)
+    self._thread.start()
+
+    for _ in range(self._tx_cnt):
+      self._tx_free.append(self._usb.getTransfer())
+    for _ in range(self._rx_cnt):
+      t = self._usb.getTransfer()
+      t.setBulk(RX_ENDPOINT, self._rx_size, callback=self._rx_done)
+      self._rx.append(t)
+      self._submit(t)
+
+  async def close(self):
+    if not self._running:
+      return
+
+    self._closing = True
+    for t in self._rx:
+      try:
+        t.cancel()
+      except usb1.USBError:
+        pass  # already completed
+
+    # the event thread runs until every callback is back
+    while self._in_flight > 0:
+      await asyncio.sleep(0.001)
+    self._running = False
+    if self._thread is not None:
+      await asyncio.to_thread(self._thread.join)
+      self._thread = None
+
+    for t in self._rx + list(self._tx_free):
+      t.close()
+    self._rx.clear()
+    self._tx_free.clear()
+
+  def _handle_events(self):
+    while self._running:
+      self._context.handleEventsTimeout(0.1)
+
+  def _submit(self, t):
+    with self._lock:
+      self._in_flight += 1
+    try:
+      t.submit()
+    except Exception:
+      with self._lock:
+        self._in_flight -= 1
+      raise
+
+  def _done(self):
+    with self._lock:
+      self._in_flight -= 1
+
+  # *** RX ***
+
+  def _rx_done(self, t):
+    # event thread
+    status = t.getStatus()
+    if status == usb1.TRANSFER_COMPLETED:
+      dat = bytes(t.getBuffer()[:t.getActualLength()])
+      if not self._closing:
+        try:
+          self._submit(t)
+        except usb1.USBError as e:
+          self._post(self._rx_error, e)
+      self._done()
+      self._post(self._rx_data, dat)
+    else:
+      self._done()
+      if status != usb1.TRANSFER_CANCELLED and self._running:
+        self._post(self._rx_error, AsyncPandaError(f"CAN RX transfer failed, status {status}"))
+
+  def _post(self, fn, arg):
+    assert self._loop is not None
+    try:
+      self._loop.call_soon_threadsafe(fn, arg)
+    except RuntimeError:
+      pass  # loop closed
+
+  def _rx_data(self, dat):
+    self.rx_bytes += len(dat)
+    self.rx_transfers_done += 1
+    if len(dat) == 0:
+      return
+    msgs, self._rx_buffer = unpack_can_buffer(self._rx_buffer + dat)
+    msgs = self.panda._filter_telemetry(msgs)
+    if len(msgs):
+      self._frames.extend(msgs)
+      self._frames_ready.set()
+
+  def _rx_error(self, e):
+    logger.error(f"CAN RX: {e}")
+    self._error = e
+    self._frames_ready.set()
+
+  async def recv(self):
+    """Waits for and returns all the received messages, like Panda.can_recv()."""
+    while len(self._frames) == 0:
+      if self._error is not None:
+        raise self._error
+      self._frames_ready.clear()
+      await self._frames_ready.wait()
+    ret = list(self._frames)
+    self._frames.clear()
+    return ret
+
+  async def frames(self):
+    """Yields every received (address, dat, bus), forever."""
+    while True:
+      for msg in await self.recv():
+        yield msg
+
+  # *** TX ***
+
+  def _tx_done(self, t):
+    # event thread
+    fut = t.getUserData()
+    status = t.getStatus()
+    self._done()
+    if status == usb1.TRANSFER_COMPLETED:
+      self._post(self._tx_result, (t, fut, None))
+    else:
+      self._post(self._tx_result, (t, fut, AsyncPandaError(f"CAN TX transfer failed, status {status}")))
+
+  def _tx_result(self, arg):
+    t, fut, err = arg
+    self._tx_free.append(t)
+    self._tx_slots.release()
+    if fut.done():
+      return
+    if err is None:
+      self.tx_bytes += t.getActualLength()
+      self.tx_transfers_done += 1
+      fut.set_result(t.getActualLength())
+    else:
+      fut.set_exception(err)
+
+  async def _send(self, dat):
+    await self._tx_slots.acquire()
+    assert self._loop is not None
+    fut = self._loop.create_future()
+    t = self._tx_free.popleft()
+    t.setBulk(TX_ENDPOINT, dat, callback=self._tx_done, user_data=fut, timeout=self._tx_timeout)
+    try:
+      self._submit(t)
+    except Exception:
+      self._tx_free.append(t)
+      self._tx_slots.release()
+      raise
+    return fut
+
+  async def can_send_many(self, arr, *, fd=False):
+    """Queues the messages in arr and waits until the panda took all of them."""
+    # chunks are queued in order, so they also complete in order
+    futs = [await self._send(tx) for tx in pack_can_buffer(arr, chunk=True, fd=fd) if len(tx)]
+    await asyncio.gather(*futs)
+
+  async def can_send(self, addr, dat, bus, *, fd=False):
+    await self.can_send_many([[addr, dat, bus]], fd=fd)
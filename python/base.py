@@ -4,6 +4,9 @@ from .constants import McuType
 
 TIMEOUT = int(15 * 1e3)  # default timeout, in milliseconds
 
+def is_erased(block: bytes) -> bool:
+  return block.count(0xFF) == len(block)
+
 class BaseHandle(ABC):
   """
     A handle to talk to a panda.
@@ -50,6 +53,7 @@ class BaseSTBootloaderHandle(ABC):
 
   @abstractmethod
   def program(self, address: int, dat: bytes) -> None:
+    """Writes dat to erased flash at address. Blocks that are all 0xFF are skipped."""
     ...
 
   @abstractmethod
@@ -0,0 +1,329 @@
+# Bit level CAN log analysis, shared by examples/can_bit_transition.py and examples/can_unique.py.
+import csv
+
+import numpy as np
+
+from .canlog import CanLogReader, FILE_MAGIC
+from .canpack import CAN_FRAME_DTYPE, LEN_TO_DLC, CAN_FRAME_FLAG_EXTENDED, CAN_FRAME_FLAG_RETURNED, CAN_FRAME_FLAG_REJECTED
+
+BATCH_RECORDS = 1 << 18
+
+# _LEN_MASK[n] has the first n payload bytes set, as 8 words
+_LEN_MASK = np.zeros((65, 64), dtype=np.uint8)
+for _n in range(65):
+  _LEN_MASK[_n, :_n] = 0xFF
+_LEN_MASK = _LEN_MASK.view(np.uint64)
+_LEN_TO_DLC_NP = np.array([LEN_TO_DLC.get(ln, 0) for ln in range(65)], dtype=np.uint8)
+
+
+# digit value of each character, 0xFF if it isn't one
+_DIGITS = np.full(256, 0xFF, dtype=np.uint8)
+_DIGITS[np.frombuffer(b"0123456789", dtype=np.uint8)] = np.arange(10)
+_DIGITS[np.frombuffer(b"abcdef", dtype=np.uint8)] = np.arange(10, 16)
+_DIGITS[np.frombuffer(b"ABCDEF", dtype=np.uint8)] = np.arange(10, 16)
+
+def _field_digits(buf, s, e):
+  # each field's digits in a (rows, widest field) grid, after an optional 0x prefix
+  hex_prefix = ((e - s) > 2) & (buf[s] == ord("0")) & (buf[np.minimum(s + 1, len(buf) - 1)] == ord("x"))
+  s = s + 2 * hex_prefix
+  width = e - s
+  cols = np.arange(max(int(width.max()), 1))
+  mask = cols[None, :] < width[:, None]
+  digits = _DIGITS[buf[np.minimum(s[:, None] + cols[None, :], len(buf) - 1)]]
+  digits[~mask] = 0
+  return hex_prefix, width, digits, mask
+
+def _parse_ints(buf, s, e):
+  hex_prefix, width, digits, mask = _field_digits(buf, s, e)
+  if (digits[mask] == 0xFF).any() or (width == 0).any():
+    return None
+  base = np.where(hex_prefix, 16, 10).astype(np.uint64)
+  v = np.zeros(len(s), dtype=np.uint64)
+  for j in range(digits.shape[1]):
+    v = np.where(mask[:, j], v * base + digits[:, j], v)
+  return v
+
+def _csv_block_to_frames(block, ncol, cabana):
+  """Parses whole lines of a CSV without a Python loop per row, None if they aren't plain and regular."""
+  buf = np.frombuffer(block, dtype=np.uint8)
+  delims = np.flatnonzero((buf == ord(",")) | (buf == ord("\n")))
+  if len(delims) == 0 or len(delims) % ncol != 0:
+    return None
+  ends = delims.reshape(-1, ncol)
+  if (buf[ends[:, -1]] != ord("\n")).any() or (buf[ends[:, :-1]] != ord(",")).any():
+    return None
+  starts = np.empty_like(ends)
+  starts[0, 0] = 0
+  starts[1:, 0] = ends[:-1, -1] + 1
+  starts[:, 1:] = ends[:, :-1] + 1
+
+  if cabana:
+    t_col, address_col, bus_col, data_col = 0, 1, 2, 3
+  else:
+    bus_col, address_col, data_col, t_col = 0, 1, 2, (4 if ncol > 4 else None)
+
+  address = _parse_ints(buf, starts[:, address_col], ends[:, address_col])
+  bus = _parse_ints(buf, starts[:, bus_col], ends[:, bus_col])
+  hex_prefix, width, digits, mask = _field_digits(buf, starts[:, data_col], ends[:, data_col])
+  if address is None or bus is None or (digits[mask] == 0xFF).any() or (width % 2).any() or (width > 128).any():
+    return None
+
+  n = len(ends)
+  frames = np.zeros(n, dtype=CAN_FRAME_DTYPE)
+  if t_col is not None:
+    t = np.array([block[a:b] for a, b in zip(starts[:, t_col].tolist(), ends[:, t_col].tolist(), strict=True)])
+    frames["timestamp"] = (t.astype(np.float64) * 1e6).astype(np.int64)
+  frames["address"] = address
+  lens = (width // 2).astype(np.uint8)
+  frames["len"] = lens
+  frames["dlc"] = _LEN_TO_DLC_NP[lens]
+  nbytes = digits.shape[1] // 2
+  frames["data"][:, :nbytes] = (digits[:, 0:2 * nbytes:2] << 4) | digits[:, 1:2 * nbytes:2]
+  _set_bus(frames, bus.astype(np.uint16))
+  return frames
+
+def _csv_frames(path, batch_records):
+  with open(path, "rb") as f:
+    header = f.readline().decode().strip()
+    cabana = header.split(",")[0] == "time"
+    ncol = len(header.split(","))
+    rest = b""
+    while True:
+      chunk = f.read(batch_records * 48)
+      block = rest + chunk
+      if len(chunk):
+        # whole lines only, the rest goes with the next read
+        cut = block.rfind(b"\n") + 1
+        block, rest = block[:cut], block[cut:]
+        if len(block) == 0:
+          continue
+      else:
+        rest = b""
+        if len(block) == 0:
+          break
+        if not block.endswith(b"\n"):
+          block += b"\n"
+      block = block.replace(b"\r", b"")
+
+      frames = _csv_block_to_frames(block, ncol, cabana)
+      if frames is None:
+        # blank lines, quoting, ... go through the csv module
+        rows = [row for row in csv.reader(block.decode().splitlines()) if len(row)]
+        frames = _csv_rows_to_frames(rows, cabana) if len(rows) else None
+      if frames is not None:
+        yield frames
+
+def _csv_rows_to_frames(rows, cabana):
+  # column at a time, see canlog._parse_csv_row for the formats
+  if cabana:
+    t, address, bus, data = (list(c) for c in zip(*(r[:4] for r in rows), strict=True))
+  else:
+    bus, address, data = (list(c) for c in zip(*(r[:3] for r in rows), strict=True))
+    t = [r[4] if len(r) > 4 else "0" for r in rows]
+
+  hexdata = [d[2:] if d.startswith("0x") else d for d in data]
+  frames = np.zeros(len(rows), dtype=CAN_FRAME_DTYPE)
+  frames["timestamp"] = (np.array(t, dtype=np.float64) * 1e6).astype(np.int64)
+  frames["address"] = [int(a, 16) if a.startswith("0x") else int(a) for a in address]
+  lens = np.array([len(d) // 2 for d in hexdata], dtype=np.uint8)
+  frames["len"] = lens
+  frames["dlc"] = _LEN_TO_DLC_NP[lens]
+  frames["data"] = np.frombuffer(bytes.fromhex("".join(d.ljust(128, "0") for d in hexdata)), dtype=np.uint8).reshape(-1, 64)
+  _set_bus(frames, np.array(bus, dtype=np.uint16))
+  return frames
+
+def _set_bus(frames, bus):
+  rejected = bus >= 192
+  returned = (bus >= 128) & ~rejected
+  frames["bus"] = bus - np.where(rejected, 192, np.where(returned, 128, 0))
+  frames["flags"] = (np.where(frames["address"] >= 0x800, CAN_FRAME_FLAG_EXTENDED, 0) |
+                     np.where(returned, CAN_FRAME_FLAG_RETURNED, 0) | np.where(rejected, CAN_FRAME_FLAG_REJECTED, 0))
+
+def _rows_to_frames(rows):
+  t, address, dat, bus = zip(*rows, strict=True)
+  frames = np.zeros(len(rows), dtype=CAN_FRAME_DTYPE)
+  frames["timestamp"] = t
+  frames["address"] = address
+  frames["len"] = [len(d) for d in dat]
+  frames["dlc"] = [LEN_TO_DLC[len(d)] for d in dat]
+  frames["data"] = np.frombuffer(b"".join(d.ljust(64, b"\x00") for d in dat), dtype=np.uint8).reshape(-1, 64)
+  _set_bus(frames, np.array(bus, dtype=np.uint16))
+  return frames
+
+def load_frames(path, start=None, end=None, batch_records=BATCH_RECORDS):
+  """
+  Yields a binary CAN log (see canlog.py) or a can_logger.py/cabana CSV as CAN_FRAME_DTYPE batches.
+  start and end are in seconds, from the start of a binary log or in the CSV's time column, both inclusive.
+  """
+  with open(path, "rb") as f:
+    binary = f.read(len(FILE_MAGIC)) == FILE_MAGIC
+
+  start_us = None if start is None else int(start * 1e6)
+  end_us = None if end is None else int(end * 1e6) + 1
+  if binary:
+    with CanLogReader(path) as log:
+      t0 = log.start_time or 0
+      yield from log.frames(None if start_us is None else t0 + start_us, None if end_us is None else t0 + end_us, batch_records)
+  else:
+    for frames in _csv_frames(path, batch_records):
+      t = frames["timestamp"]
+      if start_us is not None or end_us is not None:
+        frames = frames[((start_us is None) | (t >= (start_us or 0))) & ((end_us is None) | (t < (end_us or 0)))]
+      if len(frames):
+        yield frames
+
+
+def frame_bus(frames):
+  """The can_recv() bus of each frame, with 128 added for returned and 192 for rejected ones."""
+  flags = frames["flags"]
+  return (frames["bus"].astype(np.uint16) + np.where(flags & CAN_FRAME_FLAG_RETURNED, 128, 0) +
+          np.where(flags & CAN_FRAME_FLAG_REJECTED, 192, 0)).astype(np.uint16)
+
+
+class BitStats:
+  """
+  Per (bus, address) statistics of every payload bit, built up from CAN_FRAME_DTYPE batches.
+  Payloads are handled as 64-bit words (only as many as the batch's longest frame needs), and
+  a batch is grouped by ID with one sort, so the per frame cost is a handful of word wide
+  numpy operations.
+
+  Per ID: frame count, first/last seen time, the bits ever seen one/zero (and so the always
+  one/zero ones) and, with flips=True, how many times each bit changed between frames.
+  """
+
+  def __init__(self, flips: bool = True):
+    self._count_flips = flips
+    self.rows: dict[tuple[int, int], int] = {}
+    self._known_keys = np.zeros(0, dtype=np.uint64)
+    self._known_rows = np.zeros(0, dtype=np.int64)
+    self._alloc(0, 64)
+
+  def _alloc(self, n, cap):
+    def grow(a, shape, dtype):
+      new = np.zeros(shape, dtype=dtype)
+      if a is not None:
+        new[:n] = a[:n]
+      return new
+
+    old = self.__dict__
+    self.count = grow(old.get("count"), cap, np.int64)
+    self.first_t = grow(old.get("first_t"), cap, np.int64)
+    self.last_t = grow(old.get("last_t"), cap, np.int64)
+    self.seen = grow(old.get("seen"), (cap, 8), np.uint64)
+    self.ones = grow(old.get("ones"), (cap, 8), np.uint64)
+    self.zeros = grow(old.get("zeros"), (cap, 8), np.uint64)
+    self.last_data = grow(old.get("last_data"), (cap, 8), np.uint64)
+    self.flips = grow(old.get("flips"), (cap, 512) if self._count_flips else (cap, 0), np.uint32)
+
+  def _row(self, key):
+    row = self.rows.get(key)
+    if row is None:
+      row = len(self.rows)
+      if row == len(self.count):
+        self._alloc(row, 2 * row)
+      self.rows[key] = row
+
+      # sorted keys, for looking up a batch's rows with searchsorted
+      k = np.uint64((key[0] << 32) | key[1])
+      i = np.searchsorted(self._known_keys, k)
+      self._known_keys = np.insert(self._known_keys, i, k)
+      self._known_rows = np.insert(self._known_rows, i, row)
+    return row
+
+  def add(self, frames):
+    n = len(frames)
+    if n == 0:
+      return
+
+    # map each frame to its ID's row, then group by row with one stable (radix) sort, keeping time order within each ID
+    keys = (frame_bus(frames).astype(np.uint64) << np.uint64(32)) | frames["address"].astype(np.uint64)
+    pos = np.searchsorted(self._known_keys, keys)
+    pos[pos == len(self._known_keys)] = 0
+    unknown = self._known_keys[pos] != keys if len(self._known_keys) else np.ones(n, dtype=bool)
+    if unknown.any():
+      for k in np.unique(keys[unknown]):
+        self._row((int(k) >> 32, int(k) & 0xFFFFFFFF))
+      pos = np.searchsorted(self._known_keys, keys)
+    rows = self._known_rows[pos]
+    order = np.argsort(rows.astype(np.int16) if len(self.rows) < (1 << 15) else rows, kind="stable")
+    rows = rows[order]
+    starts = np.flatnonzero(np.r_[True, rows[1:] != rows[:-1]])
+    ends = np.r_[starts[1:], n]
+    ids = rows[starts]
+
+    # only the words that any frame in the batch reaches, one for classic CAN
+    lens = frames["len"][order]
+    nbytes = int(lens.max())
+    nw = max((nbytes + 7) // 8, 1)
+    words = np.zeros((n, nw), dtype=np.uint64)
+    words.view(np.uint8)[:, :nbytes] = frames["data"][:, :nbytes]
+    words = words[order]
+    if (lens == lens[0]).all():
+      valid = _LEN_MASK[lens[0], :nw][None, :]
+    else:
+      valid = _LEN_MASK[lens, :nw]
+    t = frames["timestamp"][order].astype(np.int64)
+
+    new = self.count[ids] == 0
+    self.first_t[ids[new]] = t[starts[new]]
+    self.last_t[ids] = t[ends - 1]
+    self.count[ids] += ends - starts
+    if valid.shape[0] == 1:
+      self.seen[ids, :nw] |= valid
+    else:
+      self.seen[ids, :nw] |= np.bitwise_or.reduceat(valid, starts, axis=0)
+    self.ones[ids, :nw] |= np.bitwise_or.reduceat(words & valid, starts, axis=0)
+    self.zeros[ids, :nw] |= np.bitwise_or.reduceat(~words & valid, starts, axis=0)
+
+    if self._count_flips:
+      # each frame against the previous one of its ID, which is in the last batch for the first frame
+      prev = np.empty_like(words)
+      prev[1:] = words[:-1]
+      prev[starts] = self.last_data[ids, :nw]
+      changed = (words ^ prev) & valid
+      changed[starts[new]] = 0
+
+      if nbytes > 0:
+        bits = np.unpackbits(changed.view(np.uint8)[:, :nbytes], axis=1, bitorder="little")
+        self.flips[ids, :nbytes * 8] += np.add.reduceat(bits, starts, axis=0, dtype=np.uint32)
+    self.last_data[ids] = 0
+    self.last_data[ids, :nw] = words[ends - 1]
+
+  def add_file(self, path, start=None, end=None, frame_filter=None):
+    """Adds a whole log, see load_frames(). frame_filter(frames) can return a mask of the frames to keep."""
+    for frames in load_frames(path, start, end):
+      if frame_filter is not None:
+        frames = frames[frame_filter(frames)]
+      self.add(frames)
+    return self
+
+  # *** results, per payload byte ***
+
+  def ids(self):
+    return list(self.rows)
+
+  def _bytes(self, words, key):
+    return words[self.rows[key]].view(np.uint8)
+
+  def ever_one(self, key):
+    return self._bytes(self.ones, key)
+
+  def ever_zero(self, key):
+    return self._bytes(self.zeros, key)
+
+  def always_one(self, key):
+    return self._bytes(self.seen & ~self.zeros, key)
+
+  def always_zero(self, key):
+    return self._bytes(self.seen & ~self.ones, key)
+
+  def flip_counts(self, key):
+    """How many times each bit changed, bit i of byte j at j * 8 + i."""
+    return self.flips[self.rows[key]]
+
+  def first_seen(self, key):
+    return int(self.first_t[self.rows[key]])
+
+
+def not_returned(frames):
+  return (frames["flags"] & (CAN_FRAME_FLAG_RETURNED | CAN_FRAME_FLAG_REJECTED)) == 0
@@ -0,0 +1,309 @@
+# Binary CAN log, see CanLogWriter and CanLogReader.
+#
+# Layout, all little endian:
+#   file header:  FILE_HEADER (magic, version)
+#   chunks:       records back to back, each RECORD_HEADER (time_us, address, bus, len) + len data bytes
+#   index:        CHUNK_ENTRY per chunk (offset, first/last time, record count),
+#                 then ID_COUNT and per (address, bus) ID_ENTRY followed by the u32 numbers of the chunks it's in
+#   trailer:      TRAILER (index offset, chunk count, magic)
+#
+# The index is written on close. A log without one (e.g. the logger was killed) is still readable,
+# the reader rebuilds the index with one pass over the records.
+import bisect
+import csv
+import mmap
+import os
+import struct
+import time
+from array import array
+from collections.abc import Iterable
+
+from . import canpack
+from .canpack import LEN_TO_DLC, CAN_FRAME_FLAG_EXTENDED, CAN_FRAME_FLAG_RETURNED, CAN_FRAME_FLAG_REJECTED
+
+FILE_MAGIC = b"PANDACAN"
+INDEX_MAGIC = b"PIDX"
+VERSION = 1
+
+FILE_HEADER = struct.Struct("<8sHxxxxxx")
+RECORD_HEADER = struct.Struct("<qIHB")
+CHUNK_ENTRY = struct.Struct("<QqqI")
+ID_COUNT = struct.Struct("<I")
+ID_ENTRY = struct.Struct("<IHI")
+TRAILER = struct.Struct("<QI4s")
+
+CHUNK_RECORDS = 4096
+
+
+class CanLogWriter:
+  """
+  Streams records to a binary CAN log, e.g. straight from can_recv():
+
+    with CanLogWriter("drive.canlog") as log:
+      while True:
+        log.write(p.can_recv())
+
+  Times are in microseconds and must not go backwards, since the reader's time index relies on it.
+  """
+
+  def __init__(self, path: str, chunk_records: int = CHUNK_RECORDS):
+    self._f = open(path, "wb")
+    self._f.write(FILE_HEADER.pack(FILE_MAGIC, VERSION))
+    self._chunk_records = chunk_records
+    self._buf = bytearray()
+    self._cnt = 0
+    self._first_t = 0
+    self._last_t = 0
+    self._chunk_ids: set = set()
+    self._chunks: list[tuple[int, int, int, int]] = []
+    self._ids: dict[tuple[int, int], array] = {}
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args):
+    self.close()
+
+  def write(self, msgs, t_us: int | None = None):
+    """Writes a list of (address, dat, bus), all with time t_us (now for None)."""
+    if t_us is None:
+      t_us = time.time_ns() // 1000
+    for address, dat, bus in msgs:
+      self.write_record(t_us, address, dat, bus)
+
+  def write_record(self, t_us: int, address: int, dat: bytes, bus: int):
+    t_us = max(t_us, self._last_t)
+    if self._cnt == 0:
+      self._first_t = t_us
+    self._last_t = t_us
+    self._buf += RECORD_HEADER.pack(t_us, address, bus, len(dat))
+    self._buf += dat
+    self._chunk_ids.add((address, bus))
+    self._cnt += 1
+    if self._cnt >= self._chunk_records:
+      self._flush_chunk()
+
+  def _flush_chunk(self):
+    if self._cnt == 0:
+      return
+    chunk = len(self._chunks)
+    self._chunks.append((self._f.tell(), self._first_t, self._last_t, self._cnt))
+    for key in self._chunk_ids:
+      self._ids.setdefault(key, array('I')).append(chunk)
+    self._f.write(self._buf)
+    self._buf = bytearray()
+    self._chunk_ids = set()
+    self._cnt = 0
+
+  def close(self):
+    if self._f.closed:
+      return
+    self._flush_chunk()
+    index_offset = self._f.tell()
+    self._f.write(b"".join(CHUNK_ENTRY.pack(*c) for c in self._chunks))
+    self._f.write(ID_COUNT.pack(len(self._ids)))
+    for (address, bus), chunks in sorted(self._ids.items()):
+      self._f.write(ID_ENTRY.pack(address, bus, len(chunks)))
+      self._f.write(chunks.tobytes())
+    self._f.write(TRAILER.pack(index_offset, len(self._chunks), INDEX_MAGIC))
+    self._f.close()
+
+
+class CanLogReader:
+  """
+  Memory-maps a binary CAN log. Time range reads bisect the chunk index and per ID
+  reads only visit the chunks that ID is in.
+  """
+
+  def __init__(self, path: str):
+    self._f = open(path, "rb")
+    size = os.fstat(self._f.fileno()).st_size
+    self._mm = mmap.mmap(self._f.fileno(), 0, access=mmap.ACCESS_READ) if size > 0 else b""
+    if size < FILE_HEADER.size:
+      raise ValueError("not a CAN log: too short")
+    magic, version = FILE_HEADER.unpack_from(self._mm, 0)
+    if magic != FILE_MAGIC or version != VERSION:
+      raise ValueError(f"not a CAN log: {magic=} {version=}")
+
+    self.chunks: list[tuple[int, int, int, int]] = []
+    self.ids: dict[tuple[int, int], list[int]] = {}
+    self._end = size
+    if not self._load_index(size):
+      self._rebuild_index()
+    self._chunk_last_t = [c[2] for c in self.chunks]
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args):
+    self.close()
+
+  def close(self):
+    if isinstance(self._mm, mmap.mmap):
+      self._mm.close()
+    self._f.close()
+
+  def __len__(self):
+    return sum(c[3] for c in self.chunks)
+
+  def _load_index(self, size) -> bool:
+    if size < FILE_HEADER.size + TRAILER.size:
+      return False
+    index_offset, n_chunks, magic = TRAILER.unpack_from(self._mm, size - TRAILER.size)
+    if magic != INDEX_MAGIC:
+      return False
+
+    pos = index_offset
+    for _ in range(n_chunks):
+      self.chunks.append(CHUNK_ENTRY.unpack_from(self._mm, pos))
+      pos += CHUNK_ENTRY.size
+    n_ids, = ID_COUNT.unpack_from(self._mm, pos)
+    pos += ID_COUNT.size
+    for _ in range(n_ids):
+      address, bus, cnt = ID_ENTRY.unpack_from(self._mm, pos)
+      pos += ID_ENTRY.size
+      self.ids[(address, bus)] = array('I', self._mm[pos:pos + 4 * cnt]).tolist()
+      pos += 4 * cnt
+    self._end = index_offset
+    return True
+
+  def _rebuild_index(self):
+    # no index, cut the records into chunks ourselves, dropping a partially written last record
+    pos = FILE_HEADER.size
+    chunk_start, cnt, first_t, last_t = pos, 0, 0, 0
+    while pos + RECORD_HEADER.size <= self._end:
+      t, address, bus, ln = RECORD_HEADER.unpack_from(self._mm, pos)
+      if pos + RECORD_HEADER.size + ln > self._end:
+        break
+      if cnt == 0:
+        first_t = t
+      last_t = t
+      chunk = len(self.chunks)
+      ids = self.ids.setdefault((address, bus), [])
+      if len(ids) == 0 or ids[-1] != chunk:
+        ids.append(chunk)
+      cnt += 1
+      pos += RECORD_HEADER.size + ln
+      if cnt == CHUNK_RECORDS:
+        self.chunks.append((chunk_start, first_t, last_t, cnt))
+        chunk_start, cnt = pos, 0
+    if cnt > 0:
+      self.chunks.append((chunk_start, first_t, last_t, cnt))
+    self._end = pos
+
+  def _chunk_records(self, chunk: int):
+    offset, _, _, cnt = self.chunks[chunk]
+    mm = self._mm
+    pos = offset
+    for _ in range(cnt):
+      t, address, bus, ln = RECORD_HEADER.unpack_from(mm, pos)
+      pos += RECORD_HEADER.size
+      yield t, address, mm[pos:pos + ln], bus
+      pos += ln
+
+  @property
+  def start_time(self) -> int | None:
+    return self.chunks[0][1] if len(self.chunks) else None
+
+  @property
+  def end_time(self) -> int | None:
+    return self.chunks[-1][2] if len(self.chunks) else None
+
+  def records(self, start: int | None = None, end: int | None = None, address: int | None = None, bus: int | None = None):
+    """
+    Yields (time_us, address, dat, bus) with start <= time_us < end, optionally only for one
+    address (and bus). Times are in the log's microseconds.
+    """
+    first = 0 if start is None else bisect.bisect_left(self._chunk_last_t, start)
+    if address is None:
+      chunks: Iterable[int] = range(first, len(self.chunks))
+    else:
+      chunks = sorted({c for (a, b), cs in self.ids.items() if a == address and (bus is None or b == bus) for c in cs if c >= first})
+
+    for chunk in chunks:
+      if end is not None and self.chunks[chunk][1] >= end:
+        break
+      for rec in self._chunk_records(chunk):
+        t = rec[0]
+        if start is not None and t < start:
+          continue
+        if end is not None and t >= end:
+          return
+        if address is not None and (rec[1] != address or (bus is not None and rec[3] != bus)):
+          continue
+        yield rec
+
+  def __iter__(self):
+    return self.records()
+
+  def frames(self, start: int | None = None, end: int | None = None, batch_records: int = 1 << 18):
+    """
+    Like records(), but yields numpy arrays of CAN_FRAME_DTYPE (see canpack.py) with up to about
+    batch_records each, for vectorized processing. Returned/rejected are in the flags.
+    """
+    chunk = 0 if start is None else bisect.bisect_left(self._chunk_last_t, start)
+    while chunk < len(self.chunks) and (end is None or self.chunks[chunk][1] < end):
+      # whole chunks at a time, they're back to back in the file
+      last, cnt = chunk, 0
+      while last < len(self.chunks) and (end is None or self.chunks[last][1] < end) and \
+            (cnt == 0 or cnt + self.chunks[last][3] <= batch_records):
+        cnt += self.chunks[last][3]
+        last += 1
+      offset = self.chunks[chunk][0]
+      stop = self.chunks[last][0] if last < len(self.chunks) else self._end
+      chunk = last
+
+      with memoryview(self._mm)[offset:stop] as dat:
+        if canpack.canpack_lib is not None:
+          frames, _ = canpack.canpack_lib.unpack_log_frames(dat, cnt)
+        else:
+          frames = _unpack_log_frames_py(dat, cnt)
+
+      if (start is not None and frames["timestamp"][0] < start) or (end is not None and frames["timestamp"][-1] >= end):
+        t = frames["timestamp"]
+        frames = frames[((start is None) | (t >= (start or 0))) & ((end is None) | (t < (end or 0)))]
+      if len(frames):
+        yield frames
+
+
+def _unpack_log_frames_py(dat, cnt):
+  np = canpack.np
+  frames = np.zeros(cnt, dtype=canpack.CAN_FRAME_DTYPE)
+  pos = 0
+  for i in range(cnt):
+    t, address, bus, ln = RECORD_HEADER.unpack_from(dat, pos)
+    pos += RECORD_HEADER.size
+    flags = CAN_FRAME_FLAG_EXTENDED if address >= 0x800 else 0
+    if bus >= 192:
+      bus, flags = bus - 192, flags | CAN_FRAME_FLAG_REJECTED
+    elif bus >= 128:
+      bus, flags = bus - 128, flags | CAN_FRAME_FLAG_RETURNED
+    frames[i] = (address, bus, flags, LEN_TO_DLC[ln], ln, t, np.frombuffer(bytes(dat[pos:pos + ln]).ljust(64, b"\x00"), dtype=np.uint8))
+    pos += ln
+  return frames
+
+
+def _parse_csv_row(row, cabana):
+  # can_logger.py's (Bus, MessageID, Message, MessageLength, Time), or cabana's (time, addr, bus, data)
+  if cabana:
+    t, address, bus, data = row[0], row[1], row[2], row[3]
+  else:
+    bus, address, data = row[0], row[1], row[2]
+    t = row[4] if len(row) > 4 else "0"
+  address = int(address, 16) if address.startswith("0x") else int(address)
+  data = data[2:] if data.startswith("0x") else data
+  return int(float(t) * 1e6), address, bytes.fromhex(data), int(bus)
+
+def csv_to_canlog(csv_path: str, log_path: str) -> int:
+  """Converts a can_logger.py or cabana CSV to a binary CAN log, returns the number of records."""
+  cnt = 0
+  with open(csv_path, newline='') as inp, CanLogWriter(log_path) as log:
+    reader = csv.reader(inp)
+    header = next(reader, None)
+    cabana = header is not None and header[0] == "time"
+    for row in reader:
+      if len(row) == 0:
+        continue
+      log.write_record(*_parse_csv_row(row, cabana))
+      cnt += 1
+  return cnt
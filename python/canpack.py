@@ -0,0 +1,255 @@
+# CAN packet packing/parsing, see CANPacket_t in board/can.h.
+# Uses libcanpack (python/libcanpack) through cffi when it's built, the pure Python version otherwise.
+import os
+from array import array
+
+from .utils import logger
+
+try:
+  import numpy as np
+except ImportError:
+  np = None  # type: ignore[assignment]
+
+CANPACKET_HEAD_SIZE = 0x6
+DLC_TO_LEN = [0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64]
+LEN_TO_DLC = {length: dlc for (dlc, length) in enumerate(DLC_TO_LEN)}
+CHUNK_SIZE = 256
+
+# Columnar receive, see Panda.can_recv_batch. The packets carry no timestamp, so it's the host's receive time.
+# CAN_FRAME_DTYPE must match can_frame_t in libcanpack.
+CAN_FRAME_FLAG_FD = 1
+CAN_FRAME_FLAG_EXTENDED = 2
+CAN_FRAME_FLAG_RETURNED = 4
+CAN_FRAME_FLAG_REJECTED = 8
+
+if np is not None:
+  CAN_FRAME_DTYPE = np.dtype([
+    ("address", np.uint32),
+    ("bus", np.uint8),
+    ("flags", np.uint8),
+    ("dlc", np.uint8),
+    ("len", np.uint8),
+    ("timestamp", np.uint64),  # host monotonic time, in microseconds
+    ("data", np.uint8, (64, )),
+  ])
+  _DATA_COLS = np.arange(64, dtype=np.uint32)
+
+
+def calculate_checksum(data):
+  res = 0
+  for b in data:
+    res ^= b
+  return res
+
+def pack_can_buffer_py(arr, chunk=False, fd=False):
+  snds = [bytearray(), ]
+  for address, dat, bus in arr:
+    extended = 1 if address >= 0x800 else 0
+    data_len_code = LEN_TO_DLC[len(dat)]
+    header = bytearray(CANPACKET_HEAD_SIZE)
+    word_4b = (address << 3) | (extended << 2)
+    header[0] = (data_len_code << 4) | (bus << 1) | int(fd)
+    header[1] = word_4b & 0xFF
+    header[2] = (word_4b >> 8) & 0xFF
+    header[3] = (word_4b >> 16) & 0xFF
+    header[4] = (word_4b >> 24) & 0xFF
+    header[5] = calculate_checksum(header[:5] + dat)
+
+    snds[-1].extend(header)
+    snds[-1].extend(dat)
+    if chunk and len(snds[-1]) > CHUNK_SIZE:
+      snds.append(bytearray())
+
+  return snds
+
+def unpack_can_buffer_py(dat):
+  ret = []
+
+  # walk the buffer with an offset, slicing off the consumed part every packet is quadratic
+  pos = 0
+  while len(dat) - pos >= CANPACKET_HEAD_SIZE:
+    data_len = DLC_TO_LEN[(dat[pos]>>4)]
+
+    header = dat[pos:pos+CANPACKET_HEAD_SIZE]
+
+    bus = (header[0] >> 1) & 0x7
+    address = (header[4] << 24 | header[3] << 16 | header[2] << 8 | header[1]) >> 3
+
+    if (header[1] >> 1) & 0x1:
+      # returned
+      bus += 128
+    if header[1] & 0x1:
+      # rejected
+      bus += 192
+
+    # we need more from the next transfer
+    if data_len > len(dat) - pos - CANPACKET_HEAD_SIZE:
+      break
+
+    end = pos + CANPACKET_HEAD_SIZE + data_len
+    assert calculate_checksum(dat[pos:end]) == 0, "CAN packet checksum incorrect"
+
+    ret.append((address, dat[pos+CANPACKET_HEAD_SIZE:end], bus))
+    pos = end
+
+  return (ret, dat[pos:])
+
+def _unpack_offsets_py(dat):
+  # where each whole packet's data starts, and its length
+  offsets, lens = [], []
+  pos = 0
+  while len(dat) - pos >= CANPACKET_HEAD_SIZE:
+    data_len = DLC_TO_LEN[(dat[pos]>>4)]
+    if data_len > len(dat) - pos - CANPACKET_HEAD_SIZE:
+      break
+    end = pos + CANPACKET_HEAD_SIZE + data_len
+    assert calculate_checksum(dat[pos:end]) == 0, "CAN packet checksum incorrect"
+    offsets.append(pos + CANPACKET_HEAD_SIZE)
+    lens.append(data_len)
+    pos = end
+  return np.array(offsets, dtype=np.uint32), np.array(lens, dtype=np.uint8), pos
+
+
+class _CanPackLib:
+  """
+  Thin cffi wrapper around libcanpack, in ABI mode so no compiler is needed at import time.
+  """
+
+  def __init__(self, path: str):
+    from cffi import FFI
+    self.ffi = FFI()
+    self.ffi.cdef("""
+      int canpack_pack(const uint32_t *addrs, const uint8_t *buses, const uint8_t *lens, const uint8_t *data, uint32_t n,
+                       uint8_t fd, uint32_t chunk_size, uint8_t *out, uint32_t out_size, uint32_t *chunk_ends);
+      int canpack_unpack(const uint8_t *dat, uint32_t len, uint32_t max_msgs, uint32_t *addrs, uint16_t *buses,
+                         uint32_t *offsets, uint8_t *lens, uint32_t *consumed);
+      int canpack_unpack_frames(const uint8_t *dat, uint32_t len, uint32_t max_frames, void *frames,
+                                uint64_t timestamp, uint32_t *consumed);
+      int canlog_unpack_frames(const uint8_t *dat, uint32_t len, uint32_t max_frames, void *frames, uint32_t *consumed);
+    """)
+    self.lib = self.ffi.dlopen(path)
+
+  def pack(self, arr, chunk=False, fd=False):
+    n = len(arr)
+    if n == 0:
+      return [bytearray(), ]
+
+    try:
+      addrs = array('I', [m[0] for m in arr])
+      buses = bytes([m[2] for m in arr])
+      datas = [m[1] for m in arr]
+      lens = bytes(map(len, datas))
+    except (ValueError, OverflowError):
+      # out of range, have the Python version raise its usual error
+      return pack_can_buffer_py(arr, chunk, fd)
+    data = b"".join(datas)
+
+    out = bytearray(n * CANPACKET_HEAD_SIZE + len(data))
+    chunk_ends = array('I', bytes(4 * (n + 1)))
+    ffi = self.ffi
+    cnt = self.lib.canpack_pack(ffi.from_buffer("uint32_t[]", addrs), ffi.from_buffer(buses), ffi.from_buffer(lens), ffi.from_buffer(data),
+                                n, int(fd), CHUNK_SIZE if chunk else 0, ffi.from_buffer(out), len(out), ffi.from_buffer("uint32_t[]", chunk_ends))
+    if cnt < 0:
+      # invalid data length
+      return pack_can_buffer_py(arr, chunk, fd)
+    if cnt == 1:
+      return [out, ]
+
+    snds = []
+    start = 0
+    for end in chunk_ends[:cnt]:
+      snds.append(out[start:end])
+      start = end
+    return snds
+
+  def unpack(self, dat):
+    max_msgs = len(dat) // CANPACKET_HEAD_SIZE
+    if max_msgs == 0:
+      return ([], dat)
+
+    addrs = array('I', bytes(4 * max_msgs))
+    buses = array('H', bytes(2 * max_msgs))
+    offsets = array('I', bytes(4 * max_msgs))
+    lens = bytearray(max_msgs)
+    ffi = self.ffi
+    consumed = ffi.new("uint32_t *")
+    n = self.lib.canpack_unpack(ffi.from_buffer(dat), len(dat), max_msgs, ffi.from_buffer("uint32_t[]", addrs),
+                                ffi.from_buffer("uint16_t[]", buses), ffi.from_buffer("uint32_t[]", offsets),
+                                ffi.from_buffer(lens), consumed)
+    assert n >= 0, "CAN packet checksum incorrect"
+
+    ret = [(a, dat[o:o+ln], b) for a, o, ln, b in zip(addrs[:n], offsets[:n], lens[:n], buses[:n], strict=True)]
+    return (ret, dat[consumed[0]:])
+
+  def unpack_frames(self, dat, timestamp):
+    frames = np.empty(len(dat) // CANPACKET_HEAD_SIZE, dtype=CAN_FRAME_DTYPE)
+    if len(frames) == 0:
+      return frames, dat
+
+    ffi = self.ffi
+    consumed = ffi.new("uint32_t *")
+    n = self.lib.canpack_unpack_frames(ffi.from_buffer(dat), len(dat), len(frames), ffi.from_buffer(frames),
+                                       timestamp, consumed)
+    assert n >= 0, "CAN packet checksum incorrect"
+    return frames[:n], dat[consumed[0]:]
+
+  def unpack_log_frames(self, dat, max_frames):
+    frames = np.empty(max_frames, dtype=CAN_FRAME_DTYPE)
+    ffi = self.ffi
+    consumed = ffi.new("uint32_t *")
+    n = self.lib.canlog_unpack_frames(ffi.from_buffer(dat), len(dat), max_frames, ffi.from_buffer(frames), consumed)
+    assert n >= 0, "invalid CAN log record"
+    return frames[:n], consumed[0]
+
+
+def _load_lib():
+  path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libcanpack", "libcanpack.so")
+  if "PANDA_NO_LIBCANPACK" in os.environ or not os.path.isfile(path):
+    return None
+  try:
+    return _CanPackLib(path)
+  except (ImportError, OSError):
+    logger.debug("failed to load libcanpack, using the Python CAN packing", exc_info=True)
+    return None
+
+canpack_lib = _load_lib()
+
+if canpack_lib is not None:
+  pack_can_buffer = canpack_lib.pack
+  unpack_can_buffer = canpack_lib.unpack
+else:
+  pack_can_buffer = pack_can_buffer_py
+  unpack_can_buffer = unpack_can_buffer_py
+
+
+def unpack_can_frames(dat, timestamp=0):
+  """
+  Like unpack_can_buffer, but returns the messages as a CAN_FRAME_DTYPE array. The bus is
+  the physical bus, returned/rejected are in the flags instead, and data is zero padded.
+  """
+  if np is None:
+    raise ImportError("numpy is required for columnar CAN receive")
+
+  if canpack_lib is not None:
+    return canpack_lib.unpack_frames(dat, timestamp)
+
+  offsets, lens, consumed = _unpack_offsets_py(dat)
+  buf = np.frombuffer(dat, dtype=np.uint8)
+  head = offsets - CANPACKET_HEAD_SIZE
+  b0 = buf[head]
+  b1 = buf[head + 1]
+
+  frames = np.zeros(len(offsets), dtype=CAN_FRAME_DTYPE)
+  frames["address"] = (b1.astype(np.uint32) | (buf[head + 2].astype(np.uint32) << 8) |
+                       (buf[head + 3].astype(np.uint32) << 16) | (buf[head + 4].astype(np.uint32) << 24)) >> 3
+  frames["bus"] = (b0 >> 1) & 0x7
+  frames["flags"] = (b0 & 0x1) | (((b1 >> 2) & 0x1) << 1) | (((b1 >> 1) & 0x1) << 2) | ((b1 & 0x1) << 3)
+  frames["dlc"] = b0 >> 4
+  frames["len"] = lens
+  frames["timestamp"] = timestamp
+
+  # gather all the payloads at once, row i takes lens[i] bytes from offsets[i]
+  mask = _DATA_COLS < lens[:, None]
+  frames["data"][mask] = buf[(offsets[:, None] + _DATA_COLS)[mask]]
+
+  return frames, dat[consumed:]
@@ -0,0 +1,194 @@
+# Background CAN receive, see Panda.start_can_reader.
+import threading
+import time
+from array import array
+
+from .utils import logger
+
+
+class CanRing:
+  """
+  Single producer, single consumer ring of CAN messages, preallocated so pushing doesn't allocate.
+  Each side only writes its own index, which relies on the GIL making the slot and index stores
+  visible in order, so there are no locks.
+  """
+
+  def __init__(self, size: int):
+    assert size > 0 and (size & (size - 1)) == 0, "ring size must be a power of two"
+    self.size = size
+    self._mask = size - 1
+    self._msgs: list = [None] * size
+    self._times = array('d', bytes(8 * size))
+    self._head = 0  # written by the producer only
+    self._tail = 0  # written by the consumer only
+
+  def __len__(self):
+    return self._head - self._tail
+
+  def push_many(self, msgs, t: float) -> int:
+    """Pushes as many of msgs as fit, returns how many were dropped."""
+    head = self._head
+    n = min(len(msgs), self.size - (head - self._tail))
+    for i in range(n):
+      self._msgs[(head + i) & self._mask] = msgs[i]
+      self._times[(head + i) & self._mask] = t
+    self._head = head + n
+    return len(msgs) - n
+
+  def pop_many(self, max_msgs: int):
+    """Returns up to max_msgs messages, and the receive time of the oldest one."""
+    tail = self._tail
+    n = min(self._head - tail, max_msgs)
+    if n == 0:
+      return [], None
+
+    oldest = self._times[tail & self._mask]
+    ret = []
+    for i in range(n):
+      idx = (tail + i) & self._mask
+      ret.append(self._msgs[idx])
+      self._msgs[idx] = None
+    self._tail = tail + n
+    return ret, oldest
+
+  def pop_timed(self, max_msgs: int):
+    """Returns up to max_msgs messages, and each one's receive time."""
+    tail = self._tail
+    n = min(self._head - tail, max_msgs)
+    idx = [(tail + i) & self._mask for i in range(n)]
+    ret = [self._msgs[i] for i in idx]
+    times = [self._times[i] for i in idx]
+    for i in idx:
+      self._msgs[i] = None
+    self._tail = tail + n
+    return ret, times
+
+
+class CanReader:
+  """
+  Drains a panda's CAN RX stream from a thread, so host stalls (GC, logging, slow callers)
+  are absorbed by the host ring rather than overflowing the panda's can_rx_q.
+  """
+
+  def __init__(self, recv, ring_size: int = 1 << 16, callback=None, poll_interval: float = 0.001,
+               data_ready: threading.Event | None = None, stall_threshold: float = 0.05):
+    self._recv = recv
+    self._callback = callback
+    self._poll_interval = poll_interval
+    self._stall_threshold = stall_threshold
+    self.ring = CanRing(ring_size)
+    self._data_ready = data_ready if data_ready is not None else threading.Event()
+    self._stop = threading.Event()
+    self._thread: threading.Thread | None = None
+    self.error: Exception | None = None
+
+    # counters, see stats()
+    self.received = 0
+    self.dropped = 0
+    self.max_fill = 0
+    self.max_gap = 0.0
+    self.stalls = 0
+    self.started = 0.0
+    self.max_latency = 0.0
+    self._latency_sum = 0.0
+    self._latency_cnt = 0
+
+  def start(self):
+    assert self._thread is None, "reader already running"
+    self._stop.clear()
+    self.started = time.monotonic()
+    self._thread = threading.Thread(target=self._run, name="panda-can-reader", daemon=True)
+    self._thread.start()
+
+  def stop(self):
+    if self._thread is not None:
+      self._stop.set()
+      self._thread.join()
+      self._thread = None
+
+  @property
+  def running(self) -> bool:
+    return self._thread is not None and self._thread.is_alive()
+
+  def _run(self):
+    # an exception from recv or the callback ends the thread, read() raises it
+    try:
+      self._loop()
+    except Exception as e:
+      logger.exception("CAN reader stopped")
+      self.error = e
+      self._data_ready.set()
+
+  def _loop(self):
+    last = time.monotonic()
+    while not self._stop.is_set():
+      msgs = self._recv()
+
+      now = time.monotonic()
+      self.max_gap = max(self.max_gap, now - last)
+      if now - last > self._stall_threshold:
+        self.stalls += 1
+      last = now
+
+      if len(msgs) == 0:
+        time.sleep(self._poll_interval)
+        continue
+
+      self.received += len(msgs)
+      if self._callback is not None:
+        self._callback(msgs)
+      else:
+        self.dropped += self.ring.push_many(msgs, now)
+        self.max_fill = max(self.max_fill, len(self.ring))
+        self._data_ready.set()
+
+  def read(self, timeout: float | None = None, max_msgs: int = 1 << 16):
+    """Returns the received messages, waiting up to timeout seconds (forever for None) for at least one."""
+    deadline = None if timeout is None else time.monotonic() + timeout
+    while True:
+      # clear before checking, so a push after the check still wakes the wait below
+      self._data_ready.clear()
+      msgs, oldest = self.ring.pop_many(max_msgs)
+      if len(msgs):
+        self._record_latency(oldest)
+        return msgs
+
+      if self.error is not None:
+        raise self.error
+      remaining = None if deadline is None else deadline - time.monotonic()
+      if (remaining is not None and remaining <= 0) or not self.running:
+        return []
+      self._data_ready.wait(remaining)
+
+  def pop_timed(self, max_msgs: int = 1 << 16):
+    """Returns the received messages and each one's receive time, without waiting."""
+    msgs, times = self.ring.pop_timed(max_msgs)
+    if len(msgs):
+      self._record_latency(times[0])
+    return msgs, times
+
+  def _record_latency(self, oldest: float):
+    latency = time.monotonic() - oldest
+    self.max_latency = max(self.max_latency, latency)
+    self._latency_sum += latency
+    self._latency_cnt += 1
+
+  def stats(self) -> dict:
+    """
+    Host side counters. dropped is messages lost to a full ring, max_gap the longest time between
+    two reads from the panda, stalls how many gaps were over the stall threshold and latency the
+    time messages spent in the ring before read() (in seconds).
+    """
+    elapsed = time.monotonic() - self.started if self.started else 0.0
+    return {
+      "received": self.received,
+      "rate": self.received / elapsed if elapsed > 0 else 0.0,
+      "dropped": self.dropped,
+      "ring_size": self.ring.size,
+      "ring_fill": len(self.ring),
+      "max_fill": self.max_fill,
+      "max_gap": self.max_gap,
+      "stalls": self.stalls,
+      "max_latency": self.max_latency,
+      "avg_latency": (self._latency_sum / self._latency_cnt) if self._latency_cnt else 0.0,
+    }
@@ -1,4 +1,5 @@
 import os
+import time
 import usb1
 import struct
 import binascii
@@ -7,6 +8,7 @@ from .base import BaseSTBootloaderHandle
 from .spi import STBootloaderSPIHandle, PandaSpiException
 from .usb import STBootloaderUSBHandle
 from .constants import FW_PATH, McuType
+from .utils import logger
 
 
 class PandaDFU:
@@ -113,22 +115,35 @@ class PandaDFU:
   def reset(self):
     self._handle.jump(self._mcu_type.config.bootstub_address)
 
-  def program_bootstub(self, code_bootstub):
+  def program_bootstub(self, code_bootstub) -> dict[str, float]:
+    """Erases the bootstub and app and writes code_bootstub, returns how long each phase took."""
+    timings = {}
+    st = time.monotonic()
     self._handle.clear_status()
 
     # erase bootstub + app sectors
     for i in (0, 1):
       self._handle.erase_sector(i)
+    timings["erase"] = time.monotonic() - st
 
     # write bootstub
+    st = time.monotonic()
     self._handle.program(self._mcu_type.config.bootstub_address, code_bootstub)
+    timings["program"] = time.monotonic() - st
+    return timings
 
-  def recover(self):
+  def bootstub_code(self) -> bytes:
     fn = os.path.join(FW_PATH, self._mcu_type.config.bootstub_fn)
     with open(fn, "rb") as f:
-      code = f.read()
-    self.program_bootstub(code)
+      return f.read()
+
+  def recover(self) -> dict[str, float]:
+    timings = self.program_bootstub(self.bootstub_code())
+    st = time.monotonic()
     self.reset()
+    timings["reset"] = time.monotonic() - st
+    logger.info("recover: " + ", ".join(f"{k} {v:.2f}s" for k, v in timings.items()))
+    return timings
 
   @staticmethod
   def list() -> list[str]:
@@ -0,0 +1,225 @@
+// Packs and parses whole buffers of panda CAN packets in one call, for python/canpack.py.
+// The packet format is CANPacket_t in board/can.h.
+
+#include <stdint.h>
+#include <string.h>
+
+#define CANPACKET_HEAD_SIZE 6U
+#define BUS_RETURNED 128U
+#define BUS_REJECTED 192U
+
+// one row of CAN_FRAME_DTYPE in python/canpack.py
+typedef struct {
+  uint32_t address;
+  uint8_t bus;
+  uint8_t flags;
+  uint8_t dlc;
+  uint8_t len;
+  uint64_t timestamp;
+  uint8_t data[64];
+} can_frame_t;
+
+#define FRAME_FLAG_FD 1U
+#define FRAME_FLAG_EXTENDED 2U
+#define FRAME_FLAG_RETURNED 4U
+#define FRAME_FLAG_REJECTED 8U
+
+_Static_assert(sizeof(can_frame_t) == 80U, "can_frame_t must match CAN_FRAME_DTYPE");
+
+static const uint8_t dlc_to_len[16] = {0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U, 12U, 16U, 20U, 24U, 32U, 48U, 64U};
+
+static int len_to_dlc(uint8_t len) {
+  int ret = -1;
+  for (int dlc = 0; dlc < 16; dlc++) {
+    if (dlc_to_len[dlc] == len) {
+      ret = dlc;
+      break;
+    }
+  }
+  return ret;
+}
+
+// Packs n messages, whose data is concatenated in data. A new chunk is started once the current one
+// is over chunk_size bytes (0 disables chunking); chunk_ends gets the end offset of every chunk.
+// Returns the number of chunks, -1 for an invalid data length or -2 if out is too small.
+int canpack_pack(const uint32_t *addrs, const uint8_t *buses, const uint8_t *lens, const uint8_t *data, uint32_t n,
+                 uint8_t fd, uint32_t chunk_size, uint8_t *out, uint32_t out_size, uint32_t *chunk_ends) {
+  uint32_t pos = 0U;
+  uint32_t chunk_start = 0U;
+  int chunk_cnt = 0;
+
+  for (uint32_t i = 0U; i < n; i++) {
+    int dlc = len_to_dlc(lens[i]);
+    if (dlc < 0) {
+      return -1;
+    }
+    if ((pos + CANPACKET_HEAD_SIZE + lens[i]) > out_size) {
+      return -2;
+    }
+
+    uint32_t extended = (addrs[i] >= 0x800U) ? 1U : 0U;
+    uint32_t word_4b = (addrs[i] << 3) | (extended << 2);
+    uint8_t *pkt = &out[pos];
+    pkt[0] = ((uint8_t)dlc << 4) | (uint8_t)(buses[i] << 1) | (fd & 1U);
+    pkt[1] = word_4b & 0xFFU;
+    pkt[2] = (word_4b >> 8) & 0xFFU;
+    pkt[3] = (word_4b >> 16) & 0xFFU;
+    pkt[4] = (word_4b >> 24) & 0xFFU;
+    (void)memcpy(&pkt[CANPACKET_HEAD_SIZE], data, lens[i]);
+
+    uint8_t checksum = 0U;
+    for (uint32_t j = 0U; j < (CANPACKET_HEAD_SIZE + lens[i]); j++) {
+      checksum ^= (j == 5U) ? 0U : pkt[j];
+    }
+    pkt[5] = checksum;
+
+    data += lens[i];
+    pos += CANPACKET_HEAD_SIZE + lens[i];
+    if ((chunk_size > 0U) && ((pos - chunk_start) > chunk_size)) {
+      chunk_ends[chunk_cnt] = pos;
+      chunk_cnt++;
+      chunk_start = pos;
+    }
+  }
+
+  // the last chunk, which may be empty
+  chunk_ends[chunk_cnt] = pos;
+  return chunk_cnt + 1;
+}
+
+// Parses the whole packets in dat, up to max_msgs. Each message's data is at dat[offsets[i]], and
+// returned/rejected messages get 128/192 added to their bus. *consumed is set to where parsing stopped,
+// anything after that is a partial packet. Returns the number of messages, or -1 on a bad checksum.
+int canpack_unpack(const uint8_t *dat, uint32_t len, uint32_t max_msgs, uint32_t *addrs, uint16_t *buses,
+                   uint32_t *offsets, uint8_t *lens, uint32_t *consumed) {
+  uint32_t pos = 0U;
+  uint32_t n = 0U;
+
+  while (((len - pos) >= CANPACKET_HEAD_SIZE) && (n < max_msgs)) {
+    const uint8_t *pkt = &dat[pos];
+    uint8_t data_len = dlc_to_len[pkt[0] >> 4];
+    if ((len - pos) < (CANPACKET_HEAD_SIZE + data_len)) {
+      break;
+    }
+
+    uint8_t checksum = 0U;
+    for (uint32_t j = 0U; j < (CANPACKET_HEAD_SIZE + data_len); j++) {
+      checksum ^= pkt[j];
+    }
+    if (checksum != 0U) {
+      *consumed = pos;
+      return -1;
+    }
+
+    uint16_t bus = (pkt[0] >> 1) & 0x7U;
+    if (((pkt[1] >> 1) & 1U) != 0U) {
+      bus += BUS_RETURNED;
+    }
+    if ((pkt[1] & 1U) != 0U) {
+      bus += BUS_REJECTED;
+    }
+
+    addrs[n] = ((uint32_t)pkt[4] << 24 | (uint32_t)pkt[3] << 16 | (uint32_t)pkt[2] << 8 | pkt[1]) >> 3;
+    buses[n] = bus;
+    offsets[n] = pos + CANPACKET_HEAD_SIZE;
+    lens[n] = data_len;
+    n++;
+    pos += CANPACKET_HEAD_SIZE + data_len;
+  }
+
+  *consumed = pos;
+  return (int)n;
+}
+
+// Same as canpack_unpack, but fills CAN_FRAME_DTYPE rows directly. The bus is the physical bus, with
+// returned/rejected in the flags, and the data is zero padded. Returns the number of frames, or -1 on a bad checksum.
+int canpack_unpack_frames(const uint8_t *dat, uint32_t len, uint32_t max_frames, can_frame_t *frames,
+                          uint64_t timestamp, uint32_t *consumed) {
+  uint32_t pos = 0U;
+  uint32_t n = 0U;
+
+  while (((len - pos) >= CANPACKET_HEAD_SIZE) && (n < max_frames)) {
+    const uint8_t *pkt = &dat[pos];
+    uint8_t data_len = dlc_to_len[pkt[0] >> 4];
+    if ((len - pos) < (CANPACKET_HEAD_SIZE + data_len)) {
+      break;
+    }
+
+    uint8_t checksum = 0U;
+    for (uint32_t j = 0U; j < (CANPACKET_HEAD_SIZE + data_len); j++) {
+      checksum ^= pkt[j];
+    }
+    if (checksum != 0U) {
+      *consumed = pos;
+      return -1;
+    }
+
+    can_frame_t *f = &frames[n];
+    f->address = ((uint32_t)pkt[4] << 24 | (uint32_t)pkt[3] << 16 | (uint32_t)pkt[2] << 8 | pkt[1]) >> 3;
+    f->bus = (pkt[0] >> 1) & 0x7U;
+    f->flags = (uint8_t)(((pkt[0] & 1U) != 0U) ? FRAME_FLAG_FD : 0U) |
+               (uint8_t)((((pkt[1] >> 2) & 1U) != 0U) ? FRAME_FLAG_EXTENDED : 0U) |
+               (uint8_t)((((pkt[1] >> 1) & 1U) != 0U) ? FRAME_FLAG_RETURNED : 0U) |
+               (uint8_t)(((pkt[1] & 1U) != 0U) ? FRAME_FLAG_REJECTED : 0U);
+    f->dlc = pkt[0] >> 4;
+    f->len = data_len;
+    f->timestamp = timestamp;
+    (void)memcpy(f->data, &pkt[CANPACKET_HEAD_SIZE], data_len);
+    (void)memset(&f->data[data_len], 0, sizeof(f->data) - data_len);
+    n++;
+    pos += CANPACKET_HEAD_SIZE + data_len;
+  }
+
+  *consumed = pos;
+  return (int)n;
+}
+
+// Parses the records of a binary CAN log (python/canlog.py) into CAN_FRAME_DTYPE rows. Returned/rejected
+// messages are logged with 128/192 added to their bus, which goes to the flags like in canpack_unpack_frames.
+// *consumed is set to where parsing stopped. Returns the number of frames, or -1 on an invalid length.
+#define CANLOG_RECORD_HEADER_SIZE 15U
+
+int canlog_unpack_frames(const uint8_t *dat, uint32_t len, uint32_t max_frames, can_frame_t *frames, uint32_t *consumed) {
+  uint32_t pos = 0U;
+  uint32_t n = 0U;
+
+  while (((len - pos) >= CANLOG_RECORD_HEADER_SIZE) && (n < max_frames)) {
+    const uint8_t *rec = &dat[pos];
+    uint8_t data_len = rec[14];
+    if ((len - pos) < (CANLOG_RECORD_HEADER_SIZE + data_len)) {
+      break;
+    }
+    int dlc = len_to_dlc(data_len);
+    if (dlc < 0) {
+      *consumed = pos;
+      return -1;
+    }
+
+    can_frame_t *f = &frames[n];
+    (void)memcpy(&f->timestamp, &rec[0], sizeof(f->timestamp));
+    (void)memcpy(&f->address, &rec[8], sizeof(f->address));
+    uint16_t bus = (uint16_t)rec[12] | ((uint16_t)rec[13] << 8);
+    f->flags = 0U;
+    if (bus >= BUS_REJECTED) {
+      bus -= BUS_REJECTED;
+      f->flags |= FRAME_FLAG_REJECTED;
+    } else if (bus >= BUS_RETURNED) {
+      bus -= BUS_RETURNED;
+      f->flags |= FRAME_FLAG_RETURNED;
+    } else {
+    }
+    if (f->address >= 0x800U) {
+      f->flags |= FRAME_FLAG_EXTENDED;
+    }
+    f->bus = (uint8_t)bus;
+    f->dlc = (uint8_t)dlc;
+    f->len = data_len;
+    (void)memcpy(f->data, &rec[CANLOG_RECORD_HEADER_SIZE], data_len);
+    (void)memset(&f->data[data_len], 0, sizeof(f->data) - data_len);
+    n++;
+    pos += CANLOG_RECORD_HEADER_SIZE + data_len;
+  }
+
+  *consumed = pos;
+  return (int)n;
+}
@@ -0,0 +1,109 @@
+# Drives several pandas/jungles at once, see PandaGroup.
+import heapq
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from .canreader import CanReader
+
+
+class PandaGroup:
+  """
+  Runs a CAN reader thread per device, so one slow device doesn't hold up the others,
+  and merges their streams into one ordered by host receive time. Sends fan out to
+  all (or some) devices concurrently.
+
+    with PandaGroup.connect() as g:
+      g.can_send_many([(0x123, b"\\x01", 0)])
+      for t, serial, address, dat, bus in g.can_read(timeout=1):
+        ...
+  """
+
+  def __init__(self, devices: dict, ring_size: int = 1 << 16, poll_interval: float = 0.001, stall_threshold: float = 0.05):
+    """devices maps serial to a connected Panda or PandaJungle."""
+    self.devices = dict(devices)
+    self._data_ready = threading.Event()
+    self._readers = {s: CanReader(p.can_recv, ring_size=ring_size, poll_interval=poll_interval,
+                                  data_ready=self._data_ready, stall_threshold=stall_threshold)
+                     for s, p in self.devices.items()}
+    self._pool = ThreadPoolExecutor(max_workers=max(len(self.devices), 1), thread_name_prefix="panda-group")
+    self._started = False
+
+  @classmethod
+  def connect(cls, serials=None, jungle_serials=None, **kwargs):
+    """Opens the pandas in serials (all connected ones for None) and the jungles in jungle_serials, in parallel."""
+    from . import Panda
+    if serials is None:
+      serials = Panda.list()
+    to_open = [(Panda, s) for s in serials]
+    if jungle_serials:
+      from ..board.jungle import PandaJungle
+      to_open += [(PandaJungle, s) for s in jungle_serials]
+
+    with ThreadPoolExecutor(max_workers=max(len(to_open), 1)) as pool:
+      devices = list(pool.map(lambda d: d[0](d[1], cli=False), to_open))
+    return cls({s: p for (_, s), p in zip(to_open, devices, strict=True)}, **kwargs)
+
+  def __enter__(self):
+    self.start()
+    return self
+
+  def __exit__(self, *args):
+    self.close()
+
+  def start(self):
+    if not self._started:
+      for r in self._readers.values():
+        r.start()
+      self._started = True
+
+  def stop(self):
+    if self._started:
+      for r in self._readers.values():
+        r.stop()
+      self._started = False
+
+  def close(self):
+    self.stop()
+    self._pool.shutdown()
+    for p in self.devices.values():
+      p.close()
+
+  def can_read(self, timeout=None):
+    """
+    Returns the messages received from all devices as (time, serial, address, dat, bus), ordered
+    by receive time, waiting up to timeout seconds (forever for None) for at least one.
+    """
+    deadline = None if timeout is None else time.monotonic() + timeout
+    while True:
+      self._data_ready.clear()
+      streams = []
+      for serial, r in self._readers.items():
+        msgs, times = r.pop_timed()
+        if len(msgs):
+          streams.append([(t, serial, address, dat, bus) for t, (address, dat, bus) in zip(times, msgs, strict=True)])
+        elif r.error is not None:
+          raise r.error
+
+      if len(streams):
+        return list(heapq.merge(*streams, key=lambda m: m[0]))
+      remaining = None if deadline is None else deadline - time.monotonic()
+      if remaining is not None and remaining <= 0:
+        return []
+      self._data_ready.wait(remaining)
+
+  def can_send_many(self, arr, *, serials=None, **kwargs):
+    """Sends arr on every device in serials (all of them for None), concurrently."""
+    targets = self.devices if serials is None else {s: self.devices[s] for s in serials}
+    futs = [self._pool.submit(p.can_send_many, arr, **kwargs) for p in targets.values()]
+    for f in futs:
+      f.result()
+
+  def call(self, name, *args, **kwargs):
+    """Calls a Panda method on every device concurrently, returns {serial: result}."""
+    futs = {s: self._pool.submit(getattr(p, name), *args, **kwargs) for s, p in self.devices.items()}
+    return {s: f.result() for s, f in futs.items()}
+
+  def stats(self):
+    """Per device throughput (rate, in msgs/s) and stall metrics, see CanReader.stats()."""
+    return {s: r.stats() for s, r in self._readers.items()}
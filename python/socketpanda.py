@@ -1,5 +1,8 @@
+import ctypes
+import errno
 import socket
 import struct
+import sys
 import time
 
 # /**
@@ -20,12 +23,17 @@ import time
 # 	__u8    data[CANFD_MAX_DLEN] __attribute__((aligned(8)));
 # };
 CAN_HEADER_FMT = "=IBB2x"
+CAN_HEADER = struct.Struct(CAN_HEADER_FMT)
 CAN_HEADER_LEN = struct.calcsize(CAN_HEADER_FMT)
 CAN_MAX_DLEN = 8
 CANFD_MAX_DLEN = 64
+CAN_MTU = CAN_HEADER_LEN + CAN_MAX_DLEN
+CANFD_MTU = CAN_HEADER_LEN + CANFD_MAX_DLEN
 
 CAN_CONFIRM_FLAG = 0x800
 CAN_EFF_FLAG = 0x80000000
+CAN_SFF_MASK = 0x7FF
+CAN_EFF_MASK = 0x1FFFFFFF
 
 CANFD_BRS = 0x01 # bit rate switch (second bitrate for payload data)
 CANFD_FDF = 0x04 # mark CAN FD for dual use of struct canfd_frame
@@ -33,29 +41,188 @@ CANFD_FDF = 0x04 # mark CAN FD for dual use of struct canfd_frame
 # socket.SO_RXQ_OVFL is missing
 # https://github.com/torvalds/linux/blob/47ac09b91befbb6a235ab620c32af719f8208399/include/uapi/asm-generic/socket.h#L61
 SO_RXQ_OVFL = 40
+SOL_SOCKET = 1
+MSG_DONTWAIT = 0x40
+
+# frames per recvmmsg/sendmmsg call
+BATCH_SIZE = 256
 
 import typing
 @typing.no_type_check # mypy struggles with macOS here...
-def create_socketcan(interface:str, recv_buffer_size:int) -> socket.socket:
+def create_socketcan(interface:str, recv_buffer_size:int, can_filters=None) -> socket.socket:
   # settings mostly from https://github.com/linux-can/can-utils/blob/master/candump.c
   socketcan = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
   socketcan.setblocking(False)
   socketcan.setsockopt(socket.SOL_CAN_RAW, socket.CAN_RAW_FD_FRAMES, 1)
   socketcan.setsockopt(socket.SOL_CAN_RAW, socket.CAN_RAW_RECV_OWN_MSGS, 1)
   socketcan.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, recv_buffer_size)
-  # TODO: why is it always 2x the requested size?
+  # the kernel doubles it for bookkeeping overhead, see socket(7)
   assert socketcan.getsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF) == recv_buffer_size * 2
-  # TODO: how to dectect and alert on buffer overflow?
+  # every received message then carries the socket's total drop count, see SocketPanda.rx_dropped
   socketcan.setsockopt(socket.SOL_SOCKET, SO_RXQ_OVFL, 1)
+  if can_filters is not None:
+    socketcan.setsockopt(socket.SOL_CAN_RAW, socket.CAN_RAW_FILTER, pack_can_filters(can_filters))
   socketcan.bind((interface,))
   return socketcan
 
+
+def pack_can_filters(can_filters) -> bytes:
+  """
+  Packs filters for CAN_RAW_FILTER, a frame is received if it matches any of them.
+  Same format as python-can: [{"can_id": 0x123, "can_mask": 0x7ff, "extended": False}, ...],
+  extended is optional and matches both kinds of IDs if missing. An empty list receives nothing.
+  """
+  dat = b""
+  for f in can_filters:
+    can_id, can_mask = f["can_id"], f["can_mask"]
+    if "extended" in f:
+      can_mask |= CAN_EFF_FLAG
+      if f["extended"]:
+        can_id |= CAN_EFF_FLAG
+    dat += struct.pack("=II", can_id, can_mask)
+  return dat
+
+
+# *** batched I/O with recvmmsg/sendmmsg, Linux only ***
+
+class iovec(ctypes.Structure):
+  _fields_ = [("iov_base", ctypes.c_void_p), ("iov_len", ctypes.c_size_t)]
+
+class msghdr(ctypes.Structure):
+  _fields_ = [
+    ("msg_name", ctypes.c_void_p),
+    ("msg_namelen", ctypes.c_uint32),
+    ("msg_iov", ctypes.POINTER(iovec)),
+    ("msg_iovlen", ctypes.c_size_t),
+    ("msg_control", ctypes.c_void_p),
+    ("msg_controllen", ctypes.c_size_t),
+    ("msg_flags", ctypes.c_int),
+  ]
+
+class mmsghdr(ctypes.Structure):
+  _fields_ = [("msg_hdr", msghdr), ("msg_len", ctypes.c_uint)]
+
+# struct cmsghdr {size_t cmsg_len; int cmsg_level; int cmsg_type;} followed by the data, 8 byte aligned
+CMSG_HEADER = struct.Struct("@Nii")
+CMSG_SPACE = 32  # room for the SO_RXQ_OVFL u32, with slack for anything else the kernel adds
+
+_libc = None
+if sys.platform == "linux":
+  try:
+    _libc = ctypes.CDLL(None, use_errno=True)
+    _libc.recvmmsg.argtypes = [ctypes.c_int, ctypes.POINTER(mmsghdr), ctypes.c_uint, ctypes.c_int, ctypes.c_void_p]
+    _libc.sendmmsg.argtypes = [ctypes.c_int, ctypes.POINTER(mmsghdr), ctypes.c_uint, ctypes.c_int]
+  except (OSError, AttributeError):
+    _libc = None
+
+
+class MmsgBuffers:
+  """Preallocated frame, iovec and control buffers for n messages, reused by every call."""
+
+  def __init__(self, n: int = BATCH_SIZE, control: bool = False):
+    self.n = n
+    self.frames = ctypes.create_string_buffer(n * CANFD_MTU)
+    self.view = memoryview(self.frames).cast("B")
+    self.iov = (iovec * n)()
+    self.msgs = (mmsghdr * n)()
+    self.control = ctypes.create_string_buffer(n * CMSG_SPACE) if control else None
+    base = ctypes.addressof(self.frames)
+    for i in range(n):
+      self.iov[i].iov_base = base + i * CANFD_MTU
+      self.iov[i].iov_len = CANFD_MTU
+      self.msgs[i].msg_hdr.msg_iov = ctypes.pointer(self.iov[i])
+      self.msgs[i].msg_hdr.msg_iovlen = 1
+      if self.control is not None:
+        self.msgs[i].msg_hdr.msg_control = ctypes.addressof(self.control) + i * CMSG_SPACE
+        self.msgs[i].msg_hdr.msg_controllen = CMSG_SPACE
+    # the kernel only shrinks msg_controllen of the headers it fills, those are re-armed on the next recv
+    self._filled = 0
+
+  def recv(self, fd: int) -> int:
+    """Receives up to n frames without blocking, returns how many (0 if none are queued)."""
+    if self.control is not None:
+      for i in range(self._filled):
+        self.msgs[i].msg_hdr.msg_controllen = CMSG_SPACE
+    self._filled = 0
+    assert _libc is not None
+    ret: int = _libc.recvmmsg(fd, self.msgs, self.n, MSG_DONTWAIT, None)
+    if ret < 0:
+      err = ctypes.get_errno()
+      if err in (errno.EAGAIN, errno.EWOULDBLOCK):
+        return 0
+      raise OSError(err, f"recvmmsg: {errno.errorcode.get(err, err)}")
+    self._filled = ret
+    return ret
+
+  def frame(self, i: int):
+    """(can_id, dat, msg_flags) of received message i."""
+    can_id, msg_len, _ = CAN_HEADER.unpack_from(self.view, i * CANFD_MTU)
+    assert self.msgs[i].msg_len >= CAN_HEADER_LEN + msg_len, f"ERROR: received {self.msgs[i].msg_len} bytes, expected at least {CAN_HEADER_LEN + msg_len} bytes"
+    start = i * CANFD_MTU + CAN_HEADER_LEN
+    return can_id, bytes(self.view[start:start + msg_len]), self.msgs[i].msg_hdr.msg_flags
+
+  def dropped(self, i: int) -> int | None:
+    """The socket's SO_RXQ_OVFL drop count, if message i carried it."""
+    return _parse_rxq_ovfl(self.control.raw[i * CMSG_SPACE:i * CMSG_SPACE + self.msgs[i].msg_hdr.msg_controllen]) if self.control is not None else None
+
+  def pack(self, i: int, frame: bytes) -> None:
+    start = i * CANFD_MTU
+    self.view[start:start + len(frame)] = frame
+    self.iov[i].iov_len = len(frame)
+
+  def send(self, fd: int, start: int, cnt: int) -> int:
+    """Sends frames start..start+cnt without blocking, returns how many the kernel took (0 if its queue is full)."""
+    assert _libc is not None
+    ret: int = _libc.sendmmsg(fd, ctypes.byref(self.msgs[start]), cnt, MSG_DONTWAIT)
+    if ret < 0:
+      err = ctypes.get_errno()
+      if err in (errno.EAGAIN, errno.EWOULDBLOCK, errno.ENOBUFS):
+        return 0
+      raise OSError(err, f"sendmmsg: {errno.errorcode.get(err, err)}")
+    return ret
+
+
+def _parse_rxq_ovfl(control: bytes) -> int | None:
+  pos = 0
+  while pos + CMSG_HEADER.size <= len(control):
+    cmsg_len, level, typ = CMSG_HEADER.unpack_from(control, pos)
+    if cmsg_len < CMSG_HEADER.size:
+      break
+    if level == SOL_SOCKET and typ == SO_RXQ_OVFL:
+      return int(struct.unpack_from("=I", control, pos + CMSG_HEADER.size)[0])
+    pos += (cmsg_len + 7) & ~7
+  return None
+
+
+def pack_can_frame(addr: int, dat: bytes, fd: bool = False) -> bytes:
+  # Even if the CANFD_FDF flag is not set, the data still must be 8 bytes for classic CAN frames.
+  data_len = CANFD_MAX_DLEN if fd else CAN_MAX_DLEN
+  msg_len = len(dat)
+  msg_dat = dat.ljust(data_len, b'\x00')
+
+  # Set extended ID flag
+  if addr > 0x7ff:
+    addr |= CAN_EFF_FLAG
+
+  # Set FD flags
+  flags = CANFD_BRS | CANFD_FDF if fd else 0
+
+  return struct.pack(CAN_HEADER_FMT, addr, msg_len, flags) + msg_dat
+
 # Panda class substitute for socketcan device (to support using the uds/iso-tp/xcp/ccp library)
 class SocketPanda():
-  def __init__(self, interface:str="can0", recv_buffer_size:int=212992) -> None:
+  def __init__(self, interface:str="can0", recv_buffer_size:int=212992, can_filters=None) -> None:
     self.interface = interface
     self.recv_buffer_size = recv_buffer_size
-    self.socket = create_socketcan(interface, recv_buffer_size)
+    self.can_filters = can_filters
+    self.socket = create_socketcan(interface, recv_buffer_size, can_filters)
+
+    # frames the kernel dropped because the socket's receive queue was full
+    self.rx_dropped = 0
+    self._rx_dropped_base = 0
+
+    self._rx_bufs = MmsgBuffers(control=True) if _libc is not None else None
+    self._tx_bufs = MmsgBuffers() if _libc is not None else None
 
   def __del__(self):
     self.socket.close()
@@ -68,29 +235,42 @@ class SocketPanda():
 
   def can_clear(self, bus:int) -> None:
     self.socket.close()
-    self.socket = create_socketcan(self.interface, self.recv_buffer_size)
+    self.socket = create_socketcan(self.interface, self.recv_buffer_size, self.can_filters)
+    # the new socket counts from 0
+    self._rx_dropped_base = self.rx_dropped
+
+  def set_can_filters(self, can_filters) -> None:
+    """Only receive frames matching one of can_filters (see pack_can_filters), None receives everything."""
+    self.can_filters = can_filters
+    dat = pack_can_filters(can_filters) if can_filters is not None else struct.pack("=II", 0, 0)
+    self.socket.setsockopt(socket.SOL_CAN_RAW, socket.CAN_RAW_FILTER, dat)
 
   def set_safety_mode(self, mode:int, param=0) -> None:
     pass
 
   def can_send_many(self, arr, *, fd=False, timeout=0) -> None:
-    for msg in arr:
-      self.can_send(*msg, fd=fd, timeout=timeout)
-
-  def can_send(self, addr, dat, bus, *, fd=False, timeout=0) -> None:
-    # Even if the CANFD_FDF flag is not set, the data still must be 8 bytes for classic CAN frames.
-    data_len = CANFD_MAX_DLEN if fd else CAN_MAX_DLEN
-    msg_len = len(dat)
-    msg_dat = dat.ljust(data_len, b'\x00')
+    if self._tx_bufs is None:
+      for msg in arr:
+        self.can_send(*msg, fd=fd, timeout=timeout)
+      return
 
-    # Set extended ID flag
-    if addr > 0x7ff:
-      addr |= CAN_EFF_FLAG
-
-    # Set FD flags
-    flags = CANFD_BRS | CANFD_FDF if fd else 0
+    # Try to send until timeout. sendmmsg takes fewer frames than asked for if the TX buffer fills up.
+    # TX buffer size can also be adjusted through `ip link set can0 txqueuelen <size>` if needed
+    bufs = self._tx_bufs
+    start_t = time.monotonic()
+    fileno = self.socket.fileno()
+    for batch in range(0, len(arr), bufs.n):
+      msgs = arr[batch:batch + bufs.n]
+      for i, (addr, dat, _) in enumerate(msgs):
+        bufs.pack(i, pack_can_frame(addr, dat, fd))
+      sent = 0
+      while sent < len(msgs):
+        sent += bufs.send(fileno, sent, len(msgs) - sent)
+        if sent < len(msgs) and timeout != 0 and time.monotonic() - start_t >= timeout / 1000:
+          raise TimeoutError
 
-    can_frame = struct.pack(CAN_HEADER_FMT, addr, msg_len, flags) + msg_dat
+  def can_send(self, addr, dat, bus, *, fd=False, timeout=0) -> None:
+    can_frame = pack_can_frame(addr, dat, fd)
 
     # Try to send until timeout. sendto might block if the TX buffer is full.
     # TX buffer size can also be adjusted through `ip link set can0 txqueuelen <size>` if needed
@@ -104,12 +284,34 @@ class SocketPanda():
     else:
       raise TimeoutError
 
+  def _update_dropped(self, dropped: int | None) -> None:
+    if dropped is not None:
+      self.rx_dropped = self._rx_dropped_base + dropped
 
   def can_recv(self) -> list[tuple[int, bytes, int]]:
+    if self._rx_bufs is None:
+      return self._can_recv_single()
+
+    msgs = list()
+    bufs = self._rx_bufs
+    fileno = self.socket.fileno()
+    while True:
+      n = bufs.recv(fileno)
+      for i in range(n):
+        can_id, msg_dat, msg_flags = bufs.frame(i)
+        bus = 128 if (msg_flags & CAN_CONFIRM_FLAG) else 0
+        msgs.append((can_id, msg_dat, bus))
+      if n > 0:
+        self._update_dropped(bufs.dropped(n - 1))
+      if n < bufs.n:
+        break # buffered data exhausted
+    return msgs
+
+  def _can_recv_single(self) -> list[tuple[int, bytes, int]]:
     msgs = list()
     while True:
       try:
-        dat, _, msg_flags, _ = self.socket.recvmsg(self.recv_buffer_size)
+        dat, ancdata, msg_flags, _ = self.socket.recvmsg(self.recv_buffer_size, socket.CMSG_SPACE(4))
         assert len(dat) >= CAN_HEADER_LEN, f"ERROR: received {len(dat)} bytes"
 
         can_id, msg_len, _ = struct.unpack(CAN_HEADER_FMT, dat[:CAN_HEADER_LEN])
@@ -118,6 +320,9 @@ class SocketPanda():
         msg_dat = dat[CAN_HEADER_LEN:CAN_HEADER_LEN+msg_len]
         bus = 128 if (msg_flags & CAN_CONFIRM_FLAG) else 0
         msgs.append((can_id, msg_dat, bus))
+        for level, typ, cdat in ancdata:
+          if level == socket.SOL_SOCKET and typ == SO_RXQ_OVFL:
+            self._update_dropped(struct.unpack("=I", cdat[:4])[0])
       except BlockingIOError:
         break # buffered data exhausted
     return msgs
@@ -1,14 +1,16 @@
 import binascii
+import ctypes
 import os
 import fcntl
 import math
 import time
 import struct
 import threading
+import zlib
 from contextlib import contextmanager
 from functools import reduce
 
-from .base import BaseHandle, BaseSTBootloaderHandle, TIMEOUT
+from .base import BaseHandle, BaseSTBootloaderHandle, TIMEOUT, is_erased
 from .constants import McuType, MCU_TYPE_BY_IDCODE, USBPACKET_MAX_SIZE
 from .utils import logger
 
@@ -19,6 +21,8 @@ except ImportError:
 
 # Constants
 SYNC = 0x5A
+SYNC_V3 = 0x5B  # header and data in one burst, no HACK
+SYNC_V3_CRC32 = 0x5C  # v3 with a CRC-32 for the data and the response
 HACK = 0x79
 DACK = 0x85
 NACK = 0x1F
@@ -32,18 +36,50 @@ XFER_SIZE = SPI_BUF_SIZE - 0x40 # give some room for SPI protocol overhead
 
 DEV_PATH = "/dev/spidev0.0"
 
+# v3 pauses after the header, with CS still asserted, so the panda can re-arm its RX DMA
+# for the data before the SPI RX FIFO overruns
+V3_HEADER_GAP_US = 20
 
-def crc8(data):
-  crc = 0xFF    # standard init value
-  poly = 0xD5   # standard crc8: x8+x7+x6+x4+x2+1
-  size = len(data)
-  for i in range(size - 1, -1, -1):
-    crc ^= data[i]
+# struct spi_ioc_transfer from linux/spi/spidev.h
+SPI_IOC_TRANSFER = struct.Struct("=QQIIHBBBBBx")
+SPI_IOC_MESSAGE_1 = (1 << 30) | (SPI_IOC_TRANSFER.size << 16) | (ord('k') << 8)
+SPI_IOC_MESSAGE_2 = (1 << 30) | ((2 * SPI_IOC_TRANSFER.size) << 16) | (ord('k') << 8)
+
+
+def xor_checksum(data, start: int = CHECKSUM_START) -> int:
+  n = len(data)
+  if n <= 16:
+    for b in data:
+      start ^= b
+    return start
+
+  # fold the buffer as one big int, halving it each round
+  x = int.from_bytes(data, "little")
+  while n > 1:
+    half = (n + 1) // 2
+    x = (x >> (half * 8)) ^ (x & ((1 << (half * 8)) - 1))
+    n = half
+  return (x & 0xFF) ^ start
+
+
+def _crc8_table(poly):
+  table = []
+  for i in range(256):
+    crc = i
     for _ in range(8):
       if ((crc & 0x80) != 0):
         crc = ((crc << 1) ^ poly) & 0xFF
       else:
         crc <<= 1
+    table.append(crc)
+  return table
+
+CRC8_TABLE = _crc8_table(0xD5)  # standard crc8: x8+x7+x6+x4+x2+1
+
+def crc8(data):
+  crc = 0xFF    # standard init value
+  for b in reversed(data):
+    crc = CRC8_TABLE[crc ^ b]
   return crc
 
 
@@ -86,6 +122,7 @@ class SpiDevice:
     if spidev is None:
       raise PandaSpiUnavailable("spidev is not installed")
 
+    self.speed = speed
     with SPI_LOCK:
       if speed not in SPI_DEVICES:
         SPI_DEVICES[speed] = spidev.SpiDev()
@@ -107,52 +144,125 @@ class SpiDevice:
     pass
 
 
+class SpiBuffers:
+  """
+  Preallocated TX/RX buffers, sent with one SPI_IOC_MESSAGE ioctl per transfer
+  straight from/into the buffers, instead of building lists for spidev.xfer2.
+  """
+
+  def __init__(self, size: int = SPI_BUF_SIZE):
+    self.tx = bytearray(size)
+    self.rx = bytearray(size)
+    self.tx_mv = memoryview(self.tx)
+    self.rx_mv = memoryview(self.rx)
+    self._tx_addr = ctypes.addressof(ctypes.c_char.from_buffer(self.tx))
+    self._rx_addr = ctypes.addressof(ctypes.c_char.from_buffer(self.rx))
+
+    # constant TX for reads, e.g. while polling for an ACK
+    self._fill: dict[int, int] = {}
+    self._fill_bufs: list[bytearray] = []
+    self._ioc = bytearray(2 * SPI_IOC_TRANSFER.size)
+
+  def _fill_addr(self, val: int) -> int:
+    if val not in self._fill:
+      buf = bytearray([val, ]) * len(self.tx)
+      self._fill_bufs.append(buf)
+      self._fill[val] = ctypes.addressof(ctypes.c_char.from_buffer(buf))
+    return self._fill[val]
+
+  def xfer(self, spi, length: int, rx_offset: int = 0, fill: int | None = None, gap_at: int = 0) -> None:
+    """
+    Sends tx[:length] (or length fill bytes) and receives into rx[rx_offset:rx_offset + length].
+    With gap_at, the clock pauses for V3_HEADER_GAP_US after that many bytes.
+    """
+    assert rx_offset + length <= len(self.rx)
+    assert gap_at < length
+    tx_addr = self._tx_addr if fill is None else self._fill_addr(fill)
+    rx_addr = self._rx_addr + rx_offset
+    if gap_at == 0:
+      SPI_IOC_TRANSFER.pack_into(self._ioc, 0, tx_addr, rx_addr, length, 0, 0, 0, 0, 0, 0, 0)
+      fcntl.ioctl(spi.fileno(), SPI_IOC_MESSAGE_1, self._ioc)
+    else:
+      SPI_IOC_TRANSFER.pack_into(self._ioc, 0, tx_addr, rx_addr, gap_at, 0, V3_HEADER_GAP_US, 0, 0, 0, 0, 0)
+      SPI_IOC_TRANSFER.pack_into(self._ioc, SPI_IOC_TRANSFER.size, tx_addr + gap_at, rx_addr + gap_at, length - gap_at,
+                                 0, 0, 0, 0, 0, 0, 0)
+      fcntl.ioctl(spi.fileno(), SPI_IOC_MESSAGE_2, self._ioc)
+
+
 class PandaSpiHandle(BaseHandle):
   """
   A class that mimics a libusb1 handle for panda SPI communications.
   """
 
-  PROTOCOL_VERSION = 2
+  PROTOCOL_VERSION = 3
+  LEGACY_PROTOCOL_VERSIONS = (2, )
   HEADER = struct.Struct("<BBHH")
 
-  def __init__(self) -> None:
-    self.dev = SpiDevice()
+  def __init__(self, dev: SpiDevice | None = None) -> None:
+    self.dev = SpiDevice() if dev is None else dev
+    self._buf = SpiBuffers()
     self.no_retry = "NO_RETRY" in os.environ
+    # v3 isn't validated on hardware yet, opt in with SPI_V3=1. SPI_CRC32=1 only applies to v3
+    self.v3 = os.getenv("SPI_V3", "0") == "1"
+    self.crc32 = os.getenv("SPI_CRC32", "0") == "1"
+    # version spoken by the panda, set once it's known
+    self.protocol_version = min(self.LEGACY_PROTOCOL_VERSIONS)
 
   # helpers
-  def _calc_checksum(self, data: bytes) -> int:
-    cksum = CHECKSUM_START
-    for b in data:
-      cksum ^= b
-    return cksum
+  def _calc_checksum(self, data) -> int:
+    return xor_checksum(data)
 
-  def _wait_for_ack(self, spi, ack_val: int, timeout: int, tx: int, length: int = 1) -> bytes:
+  def _wait_for_ack(self, spi, ack_val: int, timeout: int, tx: int, length: int = 1) -> int:
+    # the response lands at the start of the RX buffer
     timeout_s = max(MIN_ACK_TIMEOUT_MS, timeout) * 1e-3
+    rx = self._buf.rx
 
     start = time.monotonic()
     while (timeout == 0) or ((time.monotonic() - start) < timeout_s):
-      dat = spi.xfer2([tx, ] * length)
-      if dat[0] == ack_val:
-        return bytes(dat)
-      elif dat[0] == NACK:
+      self._buf.xfer(spi, length, fill=tx)
+      if rx[0] == ack_val:
+        return length
+      elif rx[0] == NACK:
         raise PandaSpiNackResponse
 
     raise PandaSpiMissingAck
 
-  def _transfer_spidev(self, spi, endpoint: int, data, timeout: int, max_rx_len: int = 1000, expect_disconnect: bool = False) -> bytes:
+  def _transfer_spidev(self, spi, endpoint: int, data, timeout: int, max_rx_len: int = 1000, expect_disconnect: bool = False,
+                       pipelined: bool = False) -> bytes:
     max_rx_len = max(USBPACKET_MAX_SIZE, max_rx_len)
+    tx, tx_mv = self._buf.tx, self._buf.tx_mv
+    header_len = self.HEADER.size
+    data_len = len(data)
+    if header_len + 1 + data_len + 4 > len(tx):
+      raise PandaSpiException(f"data too long ({data_len})")
+
+    crc32 = pipelined and self.crc32
+    if pipelined:
+      logger.debug("- send header and data")
+      self.HEADER.pack_into(tx, 0, SYNC_V3_CRC32 if crc32 else SYNC_V3, endpoint, data_len, max_rx_len)
+      tx[header_len] = self._calc_checksum(tx_mv[:header_len])
+      data_start = header_len + 1
+      tx[data_start:data_start + data_len] = data
+      data_mv = tx_mv[data_start:data_start + data_len]
+      if crc32:
+        struct.pack_into("<I", tx, data_start + data_len, zlib.crc32(data_mv))
+        self._buf.xfer(spi, data_start + data_len + 4, gap_at=data_start)
+      else:
+        tx[data_start + data_len] = self._calc_checksum(data_mv)
+        self._buf.xfer(spi, data_start + data_len + 1, gap_at=data_start)
+    else:
+      logger.debug("- send header")
+      self.HEADER.pack_into(tx, 0, SYNC, endpoint, data_len, max_rx_len)
+      tx[header_len] = self._calc_checksum(tx_mv[:header_len])
+      self._buf.xfer(spi, header_len + 1)
 
-    logger.debug("- send header")
-    packet = self.HEADER.pack(SYNC, endpoint, len(data), max_rx_len)
-    packet += bytes([self._calc_checksum(packet), ])
-    spi.xfer2(packet)
-
-    logger.debug("- waiting for header ACK")
-    self._wait_for_ack(spi, HACK, MIN_ACK_TIMEOUT_MS, 0x11)
+      logger.debug("- waiting for header ACK")
+      self._wait_for_ack(spi, HACK, MIN_ACK_TIMEOUT_MS, 0x11)
 
-    logger.debug("- sending data")
-    packet = bytes([*data, self._calc_checksum(data)])
-    spi.xfer2(packet)
+      logger.debug("- sending data")
+      tx[:data_len] = data
+      tx[data_len] = self._calc_checksum(tx_mv[:data_len])
+      self._buf.xfer(spi, data_len + 1)
 
     if expect_disconnect:
       logger.debug("- expecting disconnect, returning")
@@ -160,23 +270,29 @@ class PandaSpiHandle(BaseHandle):
     else:
       logger.debug("- waiting for data ACK")
       preread_len = USBPACKET_MAX_SIZE + 1  # read enough for a controlRead
-      dat = self._wait_for_ack(spi, DACK, timeout, 0x13, length=3 + preread_len)
+      read_len = self._wait_for_ack(spi, DACK, timeout, 0x13, length=3 + preread_len)
+      rx, rx_mv = self._buf.rx, self._buf.rx_mv
 
       # get response length, then response
-      response_len = struct.unpack("<H", dat[1:3])[0]
+      response_len = rx[1] | (rx[2] << 8)
       if response_len > max_rx_len:
         raise PandaSpiException(f"response length greater than max ({max_rx_len} {response_len})")
 
-      # read rest
-      remaining = (response_len + 1) - preread_len
-      if remaining > 0:
-        dat += bytes(spi.readbytes(remaining))
-
-      dat = dat[:3 + response_len + 1]
-      if self._calc_checksum(dat) != 0:
+      # read rest, right after what we already have
+      check_len = 4 if crc32 else 1
+      total_len = 3 + response_len + check_len
+      if total_len > len(rx):
+        raise PandaSpiException(f"response length greater than buffer ({response_len})")
+      if total_len > read_len:
+        self._buf.xfer(spi, total_len - read_len, rx_offset=read_len, fill=0)
+
+      if crc32:
+        if zlib.crc32(rx_mv[:total_len - 4]) != struct.unpack_from("<I", rx, total_len - 4)[0]:
+          raise PandaSpiBadChecksum
+      elif self._calc_checksum(rx_mv[:total_len]) != 0:
         raise PandaSpiBadChecksum
 
-      return dat[3:-1]
+      return bytes(rx_mv[3:3 + response_len])
 
   def _transfer(self, endpoint: int, data, timeout: int, max_rx_len: int = 1000, expect_disconnect: bool = False) -> bytes:
     logger.debug("starting transfer: endpoint=%d, max_rx_len=%d", endpoint, max_rx_len)
@@ -190,7 +306,9 @@ class PandaSpiHandle(BaseHandle):
       logger.debug("\ntry #%d", n)
       with self.dev.acquire() as spi:
         try:
-          return self._transfer_spidev(spi, endpoint, data, timeout, max_rx_len, expect_disconnect)
+          # retries fall back to the v2 handshake, in case the panda missed part of the burst
+          pipelined = self.v3 and (self.protocol_version >= 3) and (n == 1)
+          return self._transfer_spidev(spi, endpoint, data, timeout, max_rx_len, expect_disconnect, pipelined)
         except PandaSpiException as e:
           exc = e
           logger.debug("SPI transfer failed, retrying", exc_info=True)
@@ -263,14 +381,19 @@ class PandaSpiHandle(BaseHandle):
       self._transfer(endpoint, mv[XFER_SIZE*x:XFER_SIZE*(x+1)], timeout)
     return len(data)
 
+  def bulkTransfer(self, endpoint: int, data: bytes, length: int, timeout: int = TIMEOUT) -> bytes:
+    """Sends data and reads the response of up to length bytes in a single transaction."""
+    assert len(data) <= XFER_SIZE and length <= XFER_SIZE
+    return self._transfer(endpoint, data, timeout, max_rx_len=length)
+
   def bulkRead(self, endpoint: int, length: int, timeout: int = TIMEOUT) -> bytes:
-    ret = b""
+    ret = []
     for _ in range(math.ceil(length / XFER_SIZE)):
-      d = self._transfer(endpoint, [], timeout, max_rx_len=XFER_SIZE)
-      ret += d
+      d = self._transfer(endpoint, b"", timeout, max_rx_len=XFER_SIZE)
+      ret.append(d)
       if len(d) < XFER_SIZE:
         break
-    return ret
+    return ret[0] if len(ret) == 1 else b"".join(ret)
 
 
 class STBootloaderSPIHandle(BaseSTBootloaderHandle):
@@ -316,7 +439,7 @@ class STBootloaderSPIHandle(BaseSTBootloaderHandle):
     elif data != self.ACK:
       raise PandaSpiMissingAck
 
-  def _cmd_no_retry(self, cmd: int, data: list[bytes] | None = None, read_bytes: int = 0, predata=None) -> bytes:
+  def _cmd_no_retry(self, cmd: int, data: list[bytes] | None = None, read_bytes: int = 0, predata=None, ack_timeout: float = 20) -> bytes:
     ret = b""
     with self.dev.acquire() as spi:
       # sync + command
@@ -336,7 +459,7 @@ class STBootloaderSPIHandle(BaseSTBootloaderHandle):
             spi.xfer(d + self._checksum(predata + d))
           else:
             spi.xfer(d + self._checksum(d))
-          self._get_ack(spi, timeout=20)
+          self._get_ack(spi, timeout=ack_timeout)
 
       # receive
       if read_bytes > 0:
@@ -346,11 +469,11 @@ class STBootloaderSPIHandle(BaseSTBootloaderHandle):
 
     return bytes(ret)
 
-  def _cmd(self, cmd: int, data: list[bytes] | None = None, read_bytes: int = 0, predata=None) -> bytes:
+  def _cmd(self, cmd: int, data: list[bytes] | None = None, read_bytes: int = 0, predata=None, ack_timeout: float = 20) -> bytes:
     exc = PandaSpiException()
     for n in range(MAX_XFER_RETRY_COUNT):
       try:
-        return self._cmd_no_retry(cmd, data, read_bytes, predata)
+        return self._cmd_no_retry(cmd, data, read_bytes, predata, ack_timeout)
       except PandaSpiException as e:
         exc = e
         logger.debug("SPI transfer failed, %d retries left", MAX_XFER_RETRY_COUNT - n - 1, exc_info=True)
@@ -406,12 +529,18 @@ class STBootloaderSPIHandle(BaseSTBootloaderHandle):
   def program(self, address, dat):
     bs = 256  # max block size for writing to flash over SPI
     dat += b"\xFF" * ((bs - len(dat)) % bs)
+    skipped = 0
     for i in range(len(dat) // bs):
       block = dat[i * bs:(i + 1) * bs]
+      if is_erased(block):
+        skipped += 1
+        continue
+      # a 256 byte write takes about a millisecond, only erases need the long ack timeout
       self._cmd(0x31, data=[
         struct.pack('>I', address + i*bs),
         bytes([len(block) - 1]) + block,
-      ])
+      ], ack_timeout=1)
+    logger.debug("programmed %d blocks of %d bytes, skipped %d erased", len(dat) // bs - skipped, bs, skipped)
 
   def jump(self, address):
     self.go_cmd(self._mcu_type.config.bootstub_address)
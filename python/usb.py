@@ -1,7 +1,9 @@
 import struct
+import time
 
-from .base import BaseHandle, BaseSTBootloaderHandle, TIMEOUT
+from .base import BaseHandle, BaseSTBootloaderHandle, TIMEOUT, is_erased
 from .constants import McuType
+from .utils import logger
 
 class PandaUsbHandle(BaseHandle):
   def __init__(self, libusb_handle):
@@ -31,6 +33,11 @@ class STBootloaderUSBHandle(BaseSTBootloaderHandle):
   DFU_CLRSTATUS = 4
   DFU_ABORT = 6
 
+  # DFU states, from the DFU 1.1 spec
+  STATE_DNBUSY = 4
+  STATE_MANIFEST = 7
+  STATE_ERROR = 10
+
   def __init__(self, libusb_device, libusb_handle):
     self._libusb_handle = libusb_handle
 
@@ -46,10 +53,17 @@ class STBootloaderUSBHandle(BaseSTBootloaderHandle):
     self._mcu_type = mcu_by_sector_count[sector_count]
 
   def _status(self) -> None:
+    # the bootloader only starts a write or erase on the first GETSTATUS after the DNLOAD,
+    # then reports how long it'll be busy for, so wait that out instead of spinning on GETSTATUS
     while 1:
       dat = self._libusb_handle.controlRead(0x21, self.DFU_GETSTATUS, 0, 0, 6)
-      if dat[1] == 0:
+      state = dat[4]
+      if state == self.STATE_ERROR:
+        raise RuntimeError(f"DFU error, status {dat[0]}")
+      if state not in (self.STATE_DNBUSY, self.STATE_MANIFEST):
         break
+      poll_timeout = dat[1] | (dat[2] << 8) | (dat[3] << 16)
+      time.sleep(poll_timeout / 1000)
 
   def _erase_page_address(self, address: int) -> None:
     self._libusb_handle.controlWrite(0x21, self.DFU_DNLOAD, 0, 0, b"\x41" + struct.pack("I", address))
@@ -79,14 +93,18 @@ class STBootloaderUSBHandle(BaseSTBootloaderHandle):
     self._libusb_handle.controlWrite(0x21, self.DFU_DNLOAD, 0, 0, b"\x21" + struct.pack("I", address))
     self._status()
 
-    # Program
+    # Program, the block number is the offset from the address pointer so erased blocks can be skipped
     bs = min(len(dat), self._mcu_type.config.block_size)
     dat += b"\xFF" * ((bs - len(dat)) % bs)
+    skipped = 0
     for i in range(len(dat) // bs):
       ldat = dat[i * bs:(i + 1) * bs]
-      print("programming %d with length %d" % (i, len(ldat)))
+      if is_erased(ldat):
+        skipped += 1
+        continue
       self._libusb_handle.controlWrite(0x21, self.DFU_DNLOAD, 2 + i, 0, ldat)
       self._status()
+    logger.debug("programmed %d blocks of %d bytes, skipped %d erased", len(dat) // bs - skipped, bs, skipped)
 
   def jump(self, address):
     self._libusb_handle.controlWrite(0x21, self.DFU_DNLOAD, 0, 0, b"\x21" + struct.pack("I", address))
@@ -0,0 +1,110 @@
+# Persistent, hotplug driven view of the attached USB devices, see UsbRegistry.
+import os
+import threading
+
+import usb1
+
+from .utils import logger
+
+
+class UsbRegistry:
+  """
+  Keeps one libusb context open and tracks device arrival/removal with hotplug callbacks,
+  so listing and (re)connecting don't enumerate the bus and open every device for its
+  serial each time. Serials are read once per device, on first lookup, since hotplug
+  callbacks must not do I/O.
+
+  Devices opened from the registry belong to its context, which stays open for the
+  life of the process. A forked child gets its own registry, the parent's context and
+  event thread don't carry over.
+  """
+
+  _instance: "UsbRegistry | None" = None
+  _instance_lock = threading.Lock()
+  _unsupported = False
+
+  @classmethod
+  def get(cls) -> "UsbRegistry | None":
+    """The process wide registry, None if libusb can't do hotplug here (callers enumerate instead)."""
+    if cls._instance is None and not cls._unsupported:
+      with cls._instance_lock:
+        if cls._instance is None and not cls._unsupported:
+          try:
+            cls._instance = cls(usb1.USBContext())
+          except Exception:
+            logger.debug("USB hotplug unavailable, enumerating instead", exc_info=True)
+            cls._unsupported = True
+    return cls._instance
+
+  @classmethod
+  def _after_fork(cls) -> None:
+    # the lock may have been held by another thread at the fork
+    cls._instance = None
+    cls._instance_lock = threading.Lock()
+
+  def __init__(self, context) -> None:
+    self.context = context
+    self.context.open()
+    if not self.context.hasCapability(usb1.CAP_HAS_HOTPLUG):
+      self.context.close()
+      raise RuntimeError("libusb has no hotplug support")
+
+    self._cond = threading.Condition()
+    self._generation = 0
+    self._devices: dict[tuple[int, int], list] = {}  # (bus, address): [device, serial or None]
+
+    # existing devices are reported right away
+    self.context.hotplugRegisterCallback(self._hotplug, flags=usb1.HOTPLUG_ENUMERATE)
+    self._thread = threading.Thread(target=self._handle_events, name="panda-usb-hotplug", daemon=True)
+    self._thread.start()
+
+  def _handle_events(self):
+    while True:
+      try:
+        self.context.handleEventsTimeout(1)
+      except Exception:
+        logger.exception("USB hotplug event handling failed")
+        return
+
+  def _hotplug(self, context, device, event):
+    key = (device.getBusNumber(), device.getDeviceAddress())
+    with self._cond:
+      if event == usb1.HOTPLUG_EVENT_DEVICE_ARRIVED:
+        self._devices[key] = [device, None]
+      else:
+        self._devices.pop(key, None)
+      self._generation += 1
+      self._cond.notify_all()
+    return False  # stay registered
+
+  @property
+  def generation(self) -> int:
+    """Bumped on every arrival/removal, see wait()."""
+    return self._generation
+
+  def wait(self, generation: int, timeout: float | None = None) -> bool:
+    """Waits until a device arrives or leaves after generation was read, returns whether one did."""
+    with self._cond:
+      return bool(self._cond.wait_for(lambda: self._generation != generation, timeout))
+
+  def devices(self, vids, pids, no_error: bool = False):
+    """Returns [(device, serial)] of the attached devices with one of vids and pids."""
+    with self._cond:
+      entries = [e for e in self._devices.values() if e[0].getVendorID() in vids and e[0].getProductID() in pids]
+
+    ret = []
+    for entry in entries:
+      if entry[1] is None:
+        try:
+          entry[1] = entry[0].getSerialNumber()
+        except Exception:
+          # not cached, it's retried on the next lookup. USB hubs need some time to initialize after a panda reset
+          if not no_error:
+            logger.exception("failed to get serial number of USB device")
+          continue
+      ret.append((entry[0], entry[1]))
+    return ret
+
+
+if hasattr(os, "register_at_fork"):
+  os.register_at_fork(after_in_child=UsbRegistry._after_fork)
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# Sustained CAN throughput with loopback, sync Panda API against AsyncPanda.
+import argparse
+import asyncio
+import time
+
+from opendbc.car.structs import CarParams
+from panda import Panda
+from panda.python.asyncpanda import AsyncPanda
+
+
+def get_msgs(n):
+  return [(0x100 + (i % 0x600), i.to_bytes(8, "little"), i % 3) for i in range(n)]
+
+def run_sync(p, msgs):
+  st = time.monotonic()
+  p.can_send_many(msgs, timeout=0)
+  rx = 0
+  last_rx = time.monotonic()
+  while rx < len(msgs) and time.monotonic() - last_rx < 1:
+    n = len(p.can_recv())
+    rx += n
+    if n:
+      last_rx = time.monotonic()
+  return rx, time.monotonic() - st
+
+async def run_async(p, msgs, rx_transfers, tx_transfers):
+  async with AsyncPanda(p, rx_transfers=rx_transfers, tx_transfers=tx_transfers, tx_timeout=0) as ap:
+    st = time.monotonic()
+    send = asyncio.create_task(ap.can_send_many(msgs))
+    rx = 0
+    try:
+      while rx < len(msgs):
+        rx += len(await asyncio.wait_for(ap.recv(), 1))
+    except TimeoutError:
+      pass
+    await send
+    return rx, time.monotonic() - st
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("-n", type=int, default=50000, help="messages per test")
+  parser.add_argument("--rx-transfers", type=int, default=4)
+  parser.add_argument("--tx-transfers", type=int, default=4)
+  args = parser.parse_args()
+
+  p = Panda()
+  p.set_safety_mode(CarParams.SafetyModel.allOutput)
+  p.set_can_loopback(True)
+  p.can_clear(0xFFFF)
+  msgs = get_msgs(args.n)
+
+  for desc, fn in (("sync", lambda: run_sync(p, msgs)),
+                   ("async", lambda: asyncio.run(run_async(p, msgs, args.rx_transfers, args.tx_transfers)))):
+    rx, dt = fn()
+    print(f"{desc:<6} {rx}/{len(msgs)} received in {dt:.2f}s, {rx / dt:.0f} msgs/s")
+    p.can_clear(0xFFFF)
+
+  p.set_can_loopback(False)
@@ -11,6 +11,8 @@ from panda.tests.hitl.helpers import get_random_can_messages
 
 
 PROFILE = "PROFILE" in os.environ
+# no hardware, the firmware's comms code from tests/libpanda with a simulated bus
+VIRTUAL = "VIRTUAL" in os.environ
 
 @contextmanager
 def print_time(desc):
@@ -30,23 +32,39 @@ def print_time(desc):
 
 
 if __name__ == "__main__":
-  with print_time("Panda()"):
-    p = Panda()
+  if VIRTUAL:
+    from opendbc.car.structs import CarParams
+    from panda.tests.libpanda.virtual_panda import VirtualPanda
+    with print_time("VirtualPanda()"):
+      p = VirtualPanda()
+  else:
+    with print_time("Panda()"):
+      p = Panda()
 
-  with print_time("PandaDFU.list()"):
-    PandaDFU.list()
+    with print_time("PandaDFU.list()"):
+      PandaDFU.list()
+
+    for _ in range(2):
+      # the first list() starts the USB registry
+      with print_time("Panda.list()"):
+        Panda.list()
 
   fxn = [
     'reset',
     'reconnect',
-    'up_to_date',
+    'connect',
     'health',
     #'flash',
   ]
+  if not VIRTUAL:
+    fxn.insert(3, 'up_to_date')
   for f in fxn:
     with print_time(f"Panda.{f}()"):
       getattr(p, f)()
 
+  if VIRTUAL:
+    # reset() put it back in silent
+    p.set_safety_mode(CarParams.SafetyModel.allOutput)
   p.set_can_loopback(True)
 
   for n in range(6):
@@ -0,0 +1,31 @@
+#!/usr/bin/env python3
+# Times full vs incremental flashing, e.g. between two builds a one line change apart:
+#   ./flash_benchmark.py base.bin.signed changed.bin.signed
+import sys
+import time
+
+from panda import Panda
+
+
+def flash(p, fn, incremental):
+  st = time.monotonic()
+  p.flash(fn=fn, incremental=incremental)
+  return time.monotonic() - st
+
+
+if __name__ == "__main__":
+  assert len(sys.argv) == 3, f"usage: {sys.argv[0]} <base firmware> <changed firmware>"
+  base, changed = sys.argv[1:]
+  assert Panda.get_signature_from_firmware(base) != Panda.get_signature_from_firmware(changed), \
+    "firmwares are identical, flash() would skip them"
+
+  p = Panda()
+  # start from base, so both timed flashes write changed over it
+  flash(p, base, incremental=False)
+  full = flash(p, changed, incremental=False)
+  flash(p, base, incremental=False)
+  incremental = flash(p, changed, incremental=True)
+  p.close()
+
+  print(f"full:        {full:.2f}s")
+  print(f"incremental: {incremental:.2f}s ({full / incremental:.1f}x)")
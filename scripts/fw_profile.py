@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# Where the firmware's time goes, from the profiler probes of a debug build (board/drivers/profiler.h):
+#   ./fw_profile.py -t 10 --save idle.json      # 10s of probe stats, also stored
+#   ./fw_profile.py --diff idle.json busy.json  # two stored snapshots side by side
+import argparse
+import json
+import time
+
+from panda import Panda
+
+CPU_HZ = 240e6  # cycles count at the CPU clock, see stm32h7/clock.h
+
+
+def snapshot(p, duration):
+  p.get_profile(reset=True)
+  time.sleep(duration)
+  probes = p.get_profile()
+  assert len(probes), "panda doesn't have the profiler, flash a debug build"
+  return {"duration": duration, "probes": probes}
+
+
+def us(cycles):
+  return cycles / CPU_HZ * 1e6
+
+
+def cpu_share(snap, probe):
+  return probe["total_cycles"] / (snap["duration"] * CPU_HZ)
+
+
+def show(snap):
+  print(f"{'probe':<14}{'calls/s':>10}{'min us':>9}{'avg us':>9}{'max us':>9}{'cpu':>8}")
+  for name, s in snap["probes"].items():
+    times = "".join(f"{us(s[k]):>9.2f}" for k in ("min_cycles", "avg_cycles", "max_cycles"))
+    print(f"{name:<14}{s['count'] / snap['duration']:>10.0f}{times}{cpu_share(snap, s):>8.2%}")
+
+
+def diff(a, b):
+  print(f"{'probe':<14}{'avg us':>16}{'max us':>16}{'cpu':>18}")
+  for name in b["probes"]:
+    if name not in a["probes"]:
+      continue
+    sa, sb = a["probes"][name], b["probes"][name]
+    times = "".join(f"{us(sa[k]):>7.2f} -> {us(sb[k]):<5.2f}" for k in ("avg_cycles", "max_cycles"))
+    print(f"{name:<14}{times}{cpu_share(a, sa):>8.2%} -> {cpu_share(b, sb):<6.2%}")
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("-t", "--duration", type=float, default=5., help="seconds to collect for")
+  parser.add_argument("--save", help="also write the snapshot to this JSON file")
+  parser.add_argument("--diff", nargs=2, metavar=("BEFORE", "AFTER"), help="compare two saved snapshots instead")
+  args = parser.parse_args()
+
+  if args.diff:
+    with open(args.diff[0]) as f, open(args.diff[1]) as g:
+      diff(json.load(f), json.load(g))
+  else:
+    p = Panda()
+    snap = snapshot(p, args.duration)
+    show(snap)
+    if args.save:
+      with open(args.save, "w") as f:
+        json.dump(snap, f, indent=2)
@@ -14,6 +14,9 @@ JUNGLE = "JUNGLE" in os.environ
 if JUNGLE:
   from panda import PandaJungle
 
+# no hardware, one virtual panda in loopback sends to itself
+VIRTUAL = "VIRTUAL" in os.environ
+
 # Generate unique messages
 NUM_MESSAGES_PER_BUS = 10000
 messages = [bytes(struct.pack("Q", i)) for i in range(NUM_MESSAGES_PER_BUS)]
@@ -36,8 +39,12 @@ def flood_tx(panda):
 
 if __name__ == "__main__":
   serials = Panda.list()
-  receiver: Panda | PandaJungle
-  if JUNGLE:
+  receiver: "Panda | PandaJungle"
+  if VIRTUAL:
+    from panda.tests.libpanda.virtual_panda import VirtualPanda
+    sender = receiver = VirtualPanda()
+    sender.set_can_loopback(True)
+  elif JUNGLE:
     sender = Panda()
     receiver = PandaJungle()
   else:
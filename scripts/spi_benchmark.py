@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+import time
+import argparse
+import statistics
+
+from panda import Panda
+
+
+def run(p, n, fn):
+  p.get_spi_timing(reset=True)
+
+  lat = []
+  for _ in range(n):
+    st = time.perf_counter()
+    fn()
+    lat.append((time.perf_counter() - st) * 1e6)
+  lat.sort()
+
+  fw = p.get_spi_timing()
+  return {
+    "host avg": statistics.mean(lat),
+    "host p50": lat[len(lat) // 2],
+    "host p99": lat[int(len(lat) * 0.99)],
+    "panda avg": fw['avg_us'],
+    "panda max": fw['max_us'],
+  }
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="SPI transfer latency per protocol version, in microseconds")
+  parser.add_argument("-n", type=int, default=2000, help="transfers per test")
+  args = parser.parse_args()
+
+  p = Panda()
+  assert p.spi, "panda isn't connected over SPI"
+  panda_version = p._handle.protocol_version
+  print(f"panda speaks SPI protocol v{panda_version}\n")
+
+  tests = {
+    "get_type (control, no processing)": p.get_type,
+    "health (control)": p.health,
+    "can_recv (bulk read)": p.can_recv,
+    "can_send (bulk write)": lambda: p.can_send(0x123, b"\x00" * 8, 3),
+  }
+
+  modes = [(2, False), ]
+  if panda_version >= 3:
+    modes += [(3, False), (3, True)]
+
+  for version, crc32 in modes:
+    p._handle.protocol_version = version
+    p._handle.crc32 = crc32
+    print(f"*** v{version}" + (" + CRC-32" if crc32 else ""))
+    for desc, fn in tests.items():
+      r = run(p, args.n, fn)
+      print(f"{desc:<36}" + "  ".join(f"{k} {v:7.1f}" for k, v in r.items()))
+    print()
+  p._handle.protocol_version = panda_version
+  p._handle.crc32 = False
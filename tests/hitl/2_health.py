@@ -63,3 +63,23 @@ def test_microsecond_timer(p):
 
   time_diff = (end_time - start_time) / 1e6
   assert 0.98 < time_diff  < 1.02, f"Timer not running at the correct speed! (got {time_diff:.2f}s instead of 1.0s)"
+
+def test_telemetry(p):
+  received = []
+  p.set_telemetry_rate(8, callback=lambda name, bus, record: received.append((name, bus)))
+  try:
+    st = time.monotonic()
+    while time.monotonic() - st < 1.:
+      assert not any(bus == 7 for _, _, bus in p.can_recv())
+      time.sleep(0.05)
+  finally:
+    p.set_telemetry_rate(0)
+
+  assert ("health", None) in received
+  for bus in range(3):
+    assert ("can_health", bus) in received
+
+  t = p.telemetry()
+  assert t['health']['uptime'] > 0
+  assert all(h is not None for h in t['can_health'])
+  assert t['can_health'][0]['can_speed'] == p.can_health(0)['can_speed']
@@ -1,18 +1,24 @@
 import binascii
 import pytest
 import random
+import time
 from unittest.mock import patch
 
+from opendbc.car.structs import CarParams
 from panda import Panda
 from panda.python.spi import PandaProtocolMismatch, PandaSpiNackResponse
 
 
+def acks_per_transfer(panda):
+  # v3 has no header ACK
+  return 1 if panda._handle.protocol_version >= 3 else 2
+
 class TestSpi:
   def _ping(self, mocker, panda):
     # should work with no retries
     spy = mocker.spy(panda._handle, '_wait_for_ack')
     panda.health()
-    assert spy.call_count == 2
+    assert spy.call_count == acks_per_transfer(panda)
     mocker.stop(spy)
 
   def test_protocol_version_check(self, p):
@@ -42,19 +48,55 @@ class TestSpi:
 
   def test_all_comm_types(self, mocker, p):
     spy = mocker.spy(p._handle, '_wait_for_ack')
+    acks = acks_per_transfer(p)
 
     # controlRead + controlWrite
     p.health()
     p.can_clear(0)
-    assert spy.call_count == 2*2
+    assert spy.call_count == acks*2
 
     # bulkRead + bulkWrite
     p.can_recv()
     p.can_send(0x123, b"somedata", 0)
-    assert spy.call_count == 2*4
+    assert spy.call_count == acks*4
+
+    # combined CAN write + read
+    p.can_send_recv([[0x123, b"somedata", 0]])
+    assert spy.call_count == acks*5
+
+  def test_protocol_v2_fallback(self, mocker, p):
+    assert p._handle.protocol_version == p._handle.PROTOCOL_VERSION
+    p._handle.protocol_version = 2
+    try:
+      self._ping(mocker, p)
+      self.test_all_comm_types(mocker, p)
+    finally:
+      p._handle.protocol_version = p._handle.PROTOCOL_VERSION
+
+  def test_can_send_recv(self, p):
+    p.set_safety_mode(CarParams.SafetyModel.allOutput)
+    p.set_can_loopback(True)
+    p.set_can_speed_kbps(0, 1000)
+
+    addrs = list(range(100, 200))
+    st = time.monotonic()
+    r = p.can_send_recv([(j, b"\xaa" * 8, 0) for j in addrs])
+    while len(r) < 200 and (time.monotonic() - st) < 0.5:
+      r.extend(p.can_send_recv([]))
+
+    assert sorted([x[0] for x in r if x[2] == 0x80]) == addrs
+    assert sorted([x[0] for x in r if x[2] == 0]) == addrs
+
+  def test_crc32(self, mocker, p):
+    p._handle.crc32 = True
+    try:
+      self._ping(mocker, p)
+      self.test_all_comm_types(mocker, p)
+    finally:
+      p._handle.crc32 = False
 
   def test_bad_header(self, mocker, p):
-    with patch('panda.python.spi.SYNC', return_value=0):
+    with patch('panda.python.spi.SYNC', return_value=0), patch('panda.python.spi.SYNC_V3', return_value=0):
       with pytest.raises(PandaSpiNackResponse):
         p._handle.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, p.HEALTH_STRUCT.size, timeout=50)
     self._ping(mocker, p)
@@ -69,7 +111,7 @@ class TestSpi:
 
   def test_non_existent_endpoint(self, mocker, p):
     for _ in range(10):
-      ep = random.randint(4, 20)
+      ep = random.randint(5, 20)
       with pytest.raises(PandaSpiNackResponse):
         p._handle.bulkRead(ep, random.randint(1, 1000), timeout=50)
 
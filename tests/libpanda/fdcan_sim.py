@@ -0,0 +1,84 @@
+from panda import DLC_TO_LEN, LEN_TO_DLC
+from panda.tests.libpanda.libpanda_py import ffi, libpanda_fdcan as lpf
+
+PANDA_CAN_CNT = 3
+
+
+def make_frame(addr: int, dat: bytes, bus: int = 0, fd: bool = False):
+  ret = ffi.new("CANPacket_t *")
+  ret.extended = 1 if addr >= 0x800 else 0
+  ret.addr = addr
+  ret.data_len_code = LEN_TO_DLC[len(dat)]
+  ret.bus = bus
+  ret.fd = fd
+  ret.data = bytes(dat)
+  lpf.can_set_checksum(ret)
+  return ret
+
+
+def frame_tuple(p) -> tuple[int, bytes, int]:
+  """(address, dat, bus) like can_recv(), with the returned/rejected flags in bus."""
+  dat = bytes(ffi.buffer(p.data, DLC_TO_LEN[p.data_len_code]))
+  return p.addr, dat, p.bus + (192 if p.rejected else (128 if p.returned else 0))
+
+
+class FdcanSim:
+  """
+  The firmware's FDCAN driver (llfdcan.h, fdcan.h) on simulated cores and message RAM, see
+  sim_fdcan.h. Frames come in from the bus with receive(), go through the driver's RX interrupt
+  into the RX queue (forwarding, safety and ignition hooks included) and are read with rx().
+  Frames queued with send() are put in the TX FIFO by the driver and taken off the bus with
+  transmit(), each completion firing the TX FIFO empty interrupt like on hardware.
+
+  libpanda_fdcan's state is global, there can only be one per process.
+  """
+
+  def __init__(self):
+    self.reset()
+
+  def reset(self):
+    if not lpf.sim_fdcan_reset():
+      raise RuntimeError("FDCAN message RAM address is not available in this process")
+    self._frame = ffi.new("CANPacket_t *")
+
+  def set_loopback(self, enabled: bool):
+    lpf.can_loopback = enabled
+    lpf.can_init_all()
+
+  def set_silent(self, enabled: bool):
+    lpf.can_silent = enabled
+    lpf.can_init_all()
+
+  def set_irq_enabled(self, bus: int, enabled: bool):
+    """Masks/unmasks both of bus's interrupt lines in the NVIC, pending ones run on unmask."""
+    (lpf.llcan_irq_enable if enabled else lpf.llcan_irq_disable)(lpf.cans[bus])
+
+  def receive(self, addr: int, dat: bytes, bus: int = 0, fd: bool = False) -> bool:
+    """A frame on bus, returns False if RX FIFO 0 lost one."""
+    return bool(lpf.sim_fdcan_receive(bus, make_frame(addr, dat, bus, fd)))
+
+  def send(self, addr: int, dat: bytes, bus: int = 0, fd: bool = False):
+    """Queues a frame for bus like a USB/SPI write, without the safety TX hook."""
+    lpf.can_send(make_frame(addr, dat, bus, fd), bus, True)
+
+  def transmit(self, bus: int = 0) -> tuple[int, bytes, int] | None:
+    """The next frame bus puts on the wire, None if there's nothing to send."""
+    if not lpf.sim_fdcan_transmit(bus, self._frame):
+      return None
+    return frame_tuple(self._frame)
+
+  def transmit_all(self, bus: int = 0) -> list[tuple[int, bytes, int]]:
+    ret = []
+    while (f := self.transmit(bus)) is not None:
+      ret.append(f)
+    return ret
+
+  def rx(self) -> list[tuple[int, bytes, int]]:
+    """Drains the RX queue (what goes to the host over USB/SPI)."""
+    ret = []
+    while lpf.can_pop(lpf.rx_q, self._frame):
+      ret.append(frame_tuple(self._frame))
+    return ret
+
+  def health(self, bus: int = 0):
+    return lpf.can_health[bus]
@@ -0,0 +1,107 @@
+// The bootstub's flasher (board/flasher.h) on a simulated flash, see test_flasher.py.
+// Like the H7, programming goes through a write buffer of one 256-bit flash word that
+// only reaches the flash once it's full or flushed.
+#include "fake_stm.h"
+#include "config.h"
+#include "libc.h"
+#include "comms_definitions.h"
+typedef struct harness_configuration harness_configuration;
+#include "boards/board_declarations.h"
+#include "crypto/sha.c"
+
+#define SIM_FLASH_SECTORS 8U
+#define SIM_FLASH_SECTOR_SIZE 0x20000U
+#define SIM_FLASH_WORD_SIZE 32U
+
+uint8_t sim_flash[SIM_FLASH_SECTORS * SIM_FLASH_SECTOR_SIZE];
+#define APP_START_ADDRESS ((uintptr_t)&sim_flash[SIM_FLASH_SECTOR_SIZE])
+
+bool sim_flash_locked = true;
+uint32_t sim_flash_errors = 0U;
+static uint8_t sim_write_buffer[SIM_FLASH_WORD_SIZE];
+static uint32_t sim_write_buffer_len = 0U;
+static uintptr_t sim_write_buffer_addr = 0U;
+
+bool flash_is_locked(void) { return sim_flash_locked; }
+void flash_unlock(void) { sim_flash_locked = false; }
+
+bool flash_erase_sector(uint8_t sector, bool unlocked) {
+  bool ret = false;
+  if ((sector != 0U) && (sector < SIM_FLASH_SECTORS) && unlocked) {
+    (void)memset(&sim_flash[sector * SIM_FLASH_SECTOR_SIZE], 0xFF, SIM_FLASH_SECTOR_SIZE);
+    ret = true;
+  }
+  return ret;
+}
+
+// unwritten bytes of a flushed word keep their erased value
+void flush_write_buffer(void) {
+  if (sim_write_buffer_len > 0U) {
+    uint8_t *dst = (uint8_t *)sim_write_buffer_addr;
+    for (uint32_t i = 0U; i < sim_write_buffer_len; i++) {
+      dst[i] &= sim_write_buffer[i];
+    }
+    sim_write_buffer_len = 0U;
+  }
+}
+
+void flash_write_word(void *prog_ptr, uint32_t data) {
+  uintptr_t addr = (uintptr_t)prog_ptr;
+  bool in_flash = (addr >= (uintptr_t)sim_flash) && ((addr + 4U) <= (uintptr_t)&sim_flash[sizeof(sim_flash)]);
+  if (sim_flash_locked || !in_flash || ((sim_write_buffer_len > 0U) && (addr != (sim_write_buffer_addr + sim_write_buffer_len)))) {
+    sim_flash_errors += 1U;
+  } else {
+    if (sim_write_buffer_len == 0U) {
+      sim_write_buffer_addr = addr;
+    }
+    (void)memcpy(&sim_write_buffer[sim_write_buffer_len], &data, 4U);
+    sim_write_buffer_len += 4U;
+    if (((addr + 4U) % SIM_FLASH_WORD_SIZE) == 0U) {
+      flush_write_buffer();
+    }
+  }
+}
+
+// *** board ***
+
+uint8_t hw_type = 0U;
+struct board *current_board;
+#define LED_RED 0U
+#define LED_GREEN 1U
+void led_set(uint8_t color, bool enabled) { UNUSED(color); UNUSED(enabled); }
+void led_init(void) {}
+void flasher_peripherals_init(void) {}
+void gpio_usart2_init(void) {}
+void gpio_usb_init(void) {}
+void gpio_spi_init(void) {}
+void usb_init(void) {}
+void spi_init(void) {}
+void enable_interrupts(void) {}
+
+static const uint8_t sim_uid[12] = "virtualpanda";
+#define UID_BASE ((uintptr_t)sim_uid)
+static uint8_t sim_flash_otp[0x20];
+#define DEVICE_SERIAL_NUMBER_ADDRESS ((uintptr_t)sim_flash_otp)
+#define PROVISION_CHUNK_ADDRESS ((uintptr_t)sim_flash_otp)
+const uint8_t gitversion[8] = "virtual";
+
+#define ENTER_BOOTLOADER_MAGIC 0xdeadbeefU
+#define ENTER_SOFTLOADER_MAGIC 0xdeadc0deU
+uint32_t enter_bootloader_mode;
+bool sim_reset_requested = false;
+void NVIC_SystemReset(void) { sim_reset_requested = true; }
+
+#include "provision.h"
+#include "flasher.h"
+
+// a bootstub after power-on, with the app area erased
+void sim_flasher_reset(void) {
+  (void)memset(sim_flash, 0xFF, sizeof(sim_flash));
+  (void)memset(sim_flash_otp, 0xFF, sizeof(sim_flash_otp));
+  sim_flash_locked = true;
+  sim_flash_errors = 0U;
+  sim_write_buffer_len = 0U;
+  sim_reset_requested = false;
+  prog_ptr = NULL;
+  unlocked = false;
+}
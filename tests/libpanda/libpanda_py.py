@@ -6,6 +6,8 @@ from panda import LEN_TO_DLC
 
 libpanda_dir = os.path.dirname(os.path.abspath(__file__))
 libpanda_fn = os.path.join(libpanda_dir, "libpanda.so")
+libpanda_fdcan_fn = os.path.join(libpanda_dir, "libpanda_fdcan.so")
+libflasher_fn = os.path.join(libpanda_dir, "libflasher.so")
 
 ffi = FFI()
 
@@ -47,6 +49,177 @@ int comms_can_read(uint8_t *data, uint32_t max_len);
 void comms_can_write(uint8_t *data, uint32_t len);
 void comms_can_reset(void);
 uint32_t can_slots_empty(can_ring *q);
+
+typedef struct {
+  uint32_t r_ptr;
+  uint32_t end_ptr;
+  uint32_t read_cnt;
+  uint32_t len;
+} can_read_prefetch_t;
+uint32_t comms_can_read_prefetch(uint8_t *data, uint32_t max_len, can_read_prefetch_t *pf);
+bool comms_can_read_commit(can_read_prefetch_t *pf);
+""")
+
+ffi.cdef("""
+typedef struct {
+  uint8_t bus_lookup;
+  uint8_t can_num_lookup;
+  int8_t forwarding_bus;
+  uint32_t can_speed;
+  uint32_t can_data_speed;
+  bool canfd_auto;
+  bool canfd_enabled;
+  bool brs_enabled;
+  bool canfd_non_iso;
+} bus_config_t;
+
+extern bus_config_t bus_config[3];
+extern bool can_loopback;
+extern uint32_t safety_tx_blocked;
+extern uint32_t tx_buffer_overflow;
+extern uint32_t rx_buffer_overflow;
+
+void can_clear(can_ring *q);
+bool can_tx_check_min_slots_free(uint32_t min);
+uint32_t sim_can_transmit(uint8_t bus, uint64_t *budget_ns);
+""")
+
+ffi.cdef("""
+typedef struct {
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+} profile_stats_t;
+""", packed=True)
+
+ffi.cdef("""
+typedef struct {
+  uint32_t CTRL;
+  uint32_t CYCCNT;
+  uint32_t LAR;
+} DWT_Type;
+
+extern DWT_Type dwt;
+extern profile_stats_t profile_stats[7];
+void profiler_record(int probe, uint32_t start);
+void profiler_reset(void);
+""")
+
+# libpanda_fdcan.so only, see sim_fdcan.h
+ffi.cdef("""
+typedef struct {
+  uint8_t bus_off;
+  uint32_t bus_off_cnt;
+  uint8_t error_warning;
+  uint8_t error_passive;
+  uint8_t last_error;
+  uint8_t last_stored_error;
+  uint8_t last_data_error;
+  uint8_t last_data_stored_error;
+  uint8_t receive_error_cnt;
+  uint8_t transmit_error_cnt;
+  uint32_t total_error_cnt;
+  uint32_t total_tx_lost_cnt;
+  uint32_t total_rx_lost_cnt;
+  uint32_t total_tx_cnt;
+  uint32_t total_rx_cnt;
+  uint32_t total_fwd_cnt;
+  uint32_t total_tx_checksum_error_cnt;
+  uint16_t can_speed;
+  uint16_t can_data_speed;
+  uint8_t canfd_enabled;
+  uint8_t brs_enabled;
+  uint8_t canfd_non_iso;
+  uint32_t irq0_call_rate;
+  uint32_t irq1_call_rate;
+  uint32_t irq2_call_rate;
+  uint32_t can_core_reset_cnt;
+} can_health_t;
+""", packed=True)
+
+ffi.cdef("""
+extern can_health_t can_health[3];
+extern bool can_silent;
+extern uint32_t sim_led_blue_cnt;
+
+extern void *cans[3];
+
+bool can_init(uint8_t can_number);
+void can_init_all(void);
+void llcan_irq_disable(const void *FDCANx);
+void llcan_irq_enable(const void *FDCANx);
+void can_send(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook);
+bool sim_fdcan_reset(void);
+bool sim_fdcan_receive(uint8_t can_number, const CANPacket_t *frame);
+bool sim_fdcan_transmit(uint8_t can_number, CANPacket_t *frame);
+uint32_t sim_fdcan_receive_many(uint8_t can_number, CANPacket_t *const *frames, uint32_t n);
+uint32_t sim_fdcan_transmit_many(uint8_t can_number, CANPacket_t *const *frames, uint32_t n);
+""")
+
+ffi.cdef("""
+typedef struct {
+  int irq_type;
+  void (*handler)(void);
+  uint32_t call_counter;
+  uint32_t call_rate;
+  uint32_t max_call_rate;
+  uint32_t call_rate_fault;
+  uint32_t busy_counter;
+  uint32_t busy_us;
+  uint32_t max_duration_counter;
+  uint32_t max_duration_us;
+  uint32_t max_latency_counter;
+  uint32_t max_latency_us;
+  bool pending;
+  uint32_t pending_since;
+  uint32_t raised_ts;
+} interrupt;
+
+typedef struct {
+  uint32_t ISPR[8];
+} NVIC_Type;
+
+typedef struct {
+  uint32_t CNT;
+  uint32_t SR;
+} TIM_TypeDef;
+
+extern interrupt interrupts[163];
+extern TIM_TypeDef timer;
+extern TIM_TypeDef sim_interrupt_timer;
+extern NVIC_Type sim_nvic;
+void handle_interrupt(int irq_type);
+void interrupt_timer_handler(void);
+""")
+
+# libpanda.so only, see sim_comms.h
+ffi.cdef("""
+typedef struct {
+  uint8_t request;
+  uint16_t param1;
+  uint16_t param2;
+  uint16_t length;
+} ControlPacket_t;
+""", packed=True)
+
+ffi.cdef("""
+extern uint8_t hw_type;
+extern uint32_t uptime_cnt;
+extern bool sim_reset_requested;
+
+int comms_control_handler(ControlPacket_t *req, uint8_t *resp);
+void sim_comms_reset(void);
+void sim_telemetry_tick(void);
+""")
+
+# the bootstub's flasher, see flasher.c
+ffi.cdef("""
+extern uint8_t sim_flash[0x100000];
+extern uint32_t sim_flash_errors;
+
+void comms_endpoint2_write(const uint8_t *data, uint32_t len);
+void sim_flasher_reset(void);
 """)
 
 class CANPacket:
@@ -71,6 +244,8 @@ class Panda(Protocol):
 
 
 libpanda: Panda = ffi.dlopen(libpanda_fn)
+libpanda_fdcan: Any = ffi.dlopen(libpanda_fdcan_fn)
+libflasher: Any = ffi.dlopen(libflasher_fn)
 
 
 # helpers
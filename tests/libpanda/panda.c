@@ -2,8 +2,10 @@
 #include "config.h"
 #include "can.h"
 
+#ifndef SIM_FDCAN
 bool can_init(uint8_t can_number) { return true; }
 void process_can(uint8_t can_number) { }
+#endif
 //int safety_tx_hook(CANPacket_t *to_send) { return 1; }
 
 typedef struct harness_configuration harness_configuration;
@@ -17,6 +19,7 @@ void can_tx_comms_resume_spi(void) { };
 #include "boards/board_declarations.h"
 #include "opendbc/safety/safety.h"
 #include "main_definitions.h"
+#include "drivers/profiler.h"
 #include "drivers/can_common.h"
 
 can_ring *rx_q = &can_rx_q;
@@ -26,3 +29,63 @@ can_ring *tx3_q = &can_tx3_q;
 
 #include "comms_definitions.h"
 #include "can_comms.h"
+
+#ifdef SIM_FDCAN
+// the real FDCAN driver on simulated cores, see sim_fdcan.h
+#include "sim_fdcan.h"
+#else
+// *** simulated CAN bus, see virtual_panda.py ***
+
+// time on the wire in ns, ignoring bit stuffing
+static uint64_t sim_frame_time_ns(const CANPacket_t *p, const bus_config_t *cfg) {
+  uint64_t len = dlc_to_len[p->data_len_code];
+  uint64_t nominal_bits;
+  uint64_t data_bits = 0U;
+  if (p->fd != 0U) {
+    // arbitration + ACK/EOF/IFS at the nominal rate, DLC + data + CRC at the data rate
+    nominal_bits = ((p->extended != 0U) ? 49U : 29U) + 12U;
+    data_bits = 4U + (8U * len) + ((len > 16U) ? 26U : 22U);
+    if (!cfg->brs_enabled) {
+      nominal_bits += data_bits;
+      data_bits = 0U;
+    }
+  } else {
+    nominal_bits = ((p->extended != 0U) ? 67U : 47U) + (8U * len);
+  }
+  // speeds are in 100 bps
+  return ((nominal_bits * 10000000U) / cfg->can_speed) + ((data_bits * 10000000U) / cfg->can_data_speed);
+}
+
+// Puts the frames in bus's TX queue on the wire while they fit in budget_ns, which is decremented.
+// Each one comes back as the returned echo, and also as a received frame in loopback mode.
+uint32_t sim_can_transmit(uint8_t bus, uint64_t *budget_ns) {
+  can_ring *q = can_queues[bus];
+  uint32_t cnt = 0U;
+  while (q->w_ptr != q->r_ptr) {
+    uint64_t t = sim_frame_time_ns(&q->elems[q->r_ptr], &bus_config[bus]);
+    if (t > *budget_ns) {
+      break;
+    }
+    *budget_ns -= t;
+
+    CANPacket_t to_push;
+    (void)can_pop(q, &to_push);
+    if (can_loopback) {
+      CANPacket_t looped = to_push;
+      looped.returned = 0U;
+      looped.rejected = 0U;
+      can_set_checksum(&looped);
+      rx_buffer_overflow += can_push(&can_rx_q, &looped) ? 0U : 1U;
+    }
+    to_push.returned = 1U;
+    to_push.rejected = 0U;
+    can_set_checksum(&to_push);
+    rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    can_health[bus].total_tx_cnt += 1U;
+    cnt++;
+  }
+  return cnt;
+}
+
+#include "sim_comms.h"
+#endif
@@ -0,0 +1,101 @@
+// The firmware's control handler (board/main_comms.h) and safety mode switching on a
+// stubbed board, so the virtual panda answers control requests with the firmware's own
+// code. The board reads as a 12V red panda without UARTs, fan or harness; see virtual_panda.py.
+
+typedef uint32_t adc_signal_t;
+typedef uint32_t USART_TypeDef;
+
+#include "power_saving_declarations.h"
+#include "drivers/harness_declarations.h"
+#include "drivers/fan_declarations.h"
+#include "drivers/spi_declarations.h"
+#include "drivers/uart_declarations.h"
+
+typedef int32_t IRQn_Type;
+#define NUM_INTERRUPTS 163U
+#include "drivers/interrupts_declarations.h"
+interrupt interrupts[NUM_INTERRUPTS];
+float interrupt_load = 0.0f;
+
+// *** board ***
+
+static void sim_board_set_can_mode(uint8_t mode) { UNUSED(mode); }
+static uint32_t sim_board_read_voltage_mV(void) { return 12000U; }
+static uint32_t sim_board_read_current_mA(void) { return 0U; }
+static void sim_board_set_ir_power(uint8_t percentage) { UNUSED(percentage); }
+static bool sim_board_read_som_gpio(void) { return false; }
+
+static struct board sim_board = {
+  .set_can_mode = sim_board_set_can_mode,
+  .read_voltage_mV = sim_board_read_voltage_mV,
+  .read_current_mA = sim_board_read_current_mA,
+  .set_ir_power = sim_board_set_ir_power,
+  .read_som_gpio = sim_board_read_som_gpio,
+};
+
+struct harness_t harness = { .status = HARNESS_STATUS_NORMAL };
+bool harness_check_ignition(void) { return false; }
+void set_intercept_relay(bool intercept, bool ignition_relay) { UNUSED(intercept); UNUSED(ignition_relay); }
+
+struct fan_state_t fan_state;
+void fan_set_power(uint8_t percentage) { fan_state.power = percentage; }
+void clock_source_set_timer_params(uint16_t param1, uint16_t param2) { UNUSED(param1); UNUSED(param2); }
+
+int power_save_status = POWER_SAVE_STATUS_DISABLED;
+void set_power_save_state(int state) { power_save_status = state; }
+
+bool bootkick_reset_triggered = false;
+uint16_t spi_error_count = 0U;
+spi_timing_t spi_timing;
+void spi_set_data_ready_mode(spi_data_ready_fn fn) { UNUSED(fn); }
+
+uart_ring *get_ring_by_number(int a) { UNUSED(a); return NULL; }
+bool get_char(uart_ring *q, char *elem) { UNUSED(q); UNUSED(elem); return false; }
+bool put_char(uart_ring *q, char elem) { UNUSED(q); UNUSED(elem); return true; }
+
+// the CAN cores, frames in the TX FIFO are on the simulated bus already
+typedef uint32_t FDCAN_GlobalTypeDef;
+FDCAN_GlobalTypeDef *cans[PANDA_CAN_CNT];
+void can_clear_send(FDCAN_GlobalTypeDef *FDCANx, uint8_t can_number) { UNUSED(FDCANx); UNUSED(can_number); }
+void update_can_health_pkt(uint8_t can_number, uint32_t ir_reg) { UNUSED(can_number); UNUSED(ir_reg); }
+const uint32_t speeds[] = {100U, 200U, 500U, 1000U, 1250U, 2500U, 5000U, 10000U};
+const uint32_t data_speeds[] = {100U, 200U, 500U, 1000U, 1250U, 2500U, 5000U, 10000U, 20000U, 50000U};
+
+// *** MCU ***
+
+static const uint8_t sim_uid[12] = "virtualpanda";
+#define UID_BASE ((uintptr_t)sim_uid)
+static uint8_t sim_flash_otp[0x20];
+#define DEVICE_SERIAL_NUMBER_ADDRESS ((uintptr_t)sim_flash_otp)
+#define PROVISION_CHUNK_ADDRESS ((uintptr_t)sim_flash_otp)
+int _app_start[0xc000];
+const uint8_t gitversion[8] = "virtual";
+
+#define ENTER_BOOTLOADER_MAGIC 0xdeadbeefU
+#define ENTER_SOFTLOADER_MAGIC 0xdeadc0deU
+uint32_t enter_bootloader_mode;
+// the host resets the virtual panda when it's set
+bool sim_reset_requested = false;
+void NVIC_SystemReset(void) { sim_reset_requested = true; }
+
+#include "provision.h"
+#include "safety_mode.h"
+#include "main_comms.h"
+
+void sim_telemetry_tick(void) {
+  telemetry_tick();
+}
+
+// a freshly booted panda, like main()
+void sim_comms_reset(void) {
+  current_board = &sim_board;
+  heartbeat_counter = 0U;
+  heartbeat_lost = false;
+  heartbeat_disabled = false;
+  power_save_status = POWER_SAVE_STATUS_DISABLED;
+  (void)telemetry_set_rate(0U);
+  sim_reset_requested = false;
+  (void)memset(sim_flash_otp, 0xFF, sizeof(sim_flash_otp));
+  (void)memset(can_health, 0, sizeof(can_health));
+  set_safety_mode(SAFETY_SILENT, 0U);
+}
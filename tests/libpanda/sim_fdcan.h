@@ -0,0 +1,455 @@
+// Host model of the three FDCAN cores and their message RAM, so the real driver
+// (board/stm32h7/llfdcan.h, board/drivers/fdcan.h) runs in libpanda_fdcan.so.
+//
+// Modeled: RX FIFO 0 (blocking and overwrite mode), the TX FIFO, IR with its two interrupt
+// lines, the RXF0S/TXFQS status and the RXF0A/TXBAR write side effects, INIT/CCE and internal
+// loopback. Not modeled: filters, TX buffers/event FIFO, RX FIFO 1, bit timing and bus errors.
+// The bus side is sim_fdcan_receive() and sim_fdcan_transmit(), see fdcan_sim.py.
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+// register bits and IRQ numbers from the device header, without the Cortex-M core
+#define __CORE_CM7_H_GENERIC
+#define __CORE_CM7_H_DEPENDANT
+#define SYSTEM_STM32H7XX_H
+#define __IO volatile
+#define __I volatile const
+#define __O volatile
+#define __IM volatile const
+#define __OM volatile
+#define __IOM volatile
+#define FDCAN_GlobalTypeDef hw_FDCAN_GlobalTypeDef
+#define TIM_TypeDef hw_TIM_TypeDef
+#define GPIO_TypeDef hw_GPIO_TypeDef
+#include "stm32h7/inc/stm32h725xx.h"
+#undef FDCAN_GlobalTypeDef
+#undef TIM_TypeDef
+#undef GPIO_TypeDef
+#undef FDCAN1
+#undef FDCAN2
+#undef FDCAN3
+
+// Registers with side effects the driver relies on, e.g. RXF0S must reflect the RXF0A write
+// right before it, are read through sim_fdcan_update(). They keep their hardware offsets.
+typedef struct {
+  __IO uint32_t reg;
+} sim_fdcan_reg_t;
+
+uint32_t sim_fdcan_update(void);
+#define CCCR CCCR_[sim_fdcan_update()].reg
+#define RXF0S RXF0S_[sim_fdcan_update()].reg
+#define TXFQS TXFQS_[sim_fdcan_update()].reg
+
+typedef struct {
+  __IO uint32_t CREL;
+  __IO uint32_t ENDN;
+  __IO uint32_t RESERVED1;
+  __IO uint32_t DBTP;
+  __IO uint32_t TEST;
+  __IO uint32_t RWD;
+  sim_fdcan_reg_t CCCR_[1];
+  __IO uint32_t NBTP;
+  __IO uint32_t TSCC;
+  __IO uint32_t TSCV;
+  __IO uint32_t TOCC;
+  __IO uint32_t TOCV;
+  __IO uint32_t RESERVED2[4];
+  __IO uint32_t ECR;
+  __IO uint32_t PSR;
+  __IO uint32_t TDCR;
+  __IO uint32_t RESERVED3;
+  __IO uint32_t IR;
+  __IO uint32_t IE;
+  __IO uint32_t ILS;
+  __IO uint32_t ILE;
+  __IO uint32_t RESERVED4[8];
+  __IO uint32_t GFC;
+  __IO uint32_t SIDFC;
+  __IO uint32_t XIDFC;
+  __IO uint32_t RESERVED5;
+  __IO uint32_t XIDAM;
+  __IO uint32_t HPMS;
+  __IO uint32_t NDAT1;
+  __IO uint32_t NDAT2;
+  __IO uint32_t RXF0C;
+  sim_fdcan_reg_t RXF0S_[1];
+  __IO uint32_t RXF0A;
+  __IO uint32_t RXBC;
+  __IO uint32_t RXF1C;
+  __IO uint32_t RXF1S;
+  __IO uint32_t RXF1A;
+  __IO uint32_t RXESC;
+  __IO uint32_t TXBC;
+  sim_fdcan_reg_t TXFQS_[1];
+  __IO uint32_t TXESC;
+  __IO uint32_t TXBRP;
+  __IO uint32_t TXBAR;
+  __IO uint32_t TXBCR;
+  __IO uint32_t TXBTO;
+  __IO uint32_t TXBCF;
+  __IO uint32_t TXBTIE;
+  __IO uint32_t TXBCIE;
+  __IO uint32_t RESERVED6[2];
+  __IO uint32_t TXEFC;
+  __IO uint32_t TXEFS;
+  __IO uint32_t TXEFA;
+  __IO uint32_t RESERVED7;
+} FDCAN_GlobalTypeDef;
+
+_Static_assert(offsetof(FDCAN_GlobalTypeDef, CCCR_) == 0x018U, "CCCR offset");
+_Static_assert(offsetof(FDCAN_GlobalTypeDef, RXF0S_) == 0x0A4U, "RXF0S offset");
+_Static_assert(offsetof(FDCAN_GlobalTypeDef, TXFQS_) == 0x0C4U, "TXFQS offset");
+_Static_assert(sizeof(FDCAN_GlobalTypeDef) == sizeof(hw_FDCAN_GlobalTypeDef), "FDCAN register layout");
+
+FDCAN_GlobalTypeDef sim_fdcan_regs[PANDA_CAN_CNT];
+#define FDCAN1 (&sim_fdcan_regs[0])
+#define FDCAN2 (&sim_fdcan_regs[1])
+#define FDCAN3 (&sim_fdcan_regs[2])
+
+// RXF0A holds this while there's no acknowledge to process
+#define SIM_FDCAN_NO_ACK 0xFFFFFFFFU
+
+// message RAM (SRAMCAN), the driver addresses it by its 32 bit bus address
+#define SIM_FDCAN_RAM_PAGE (FDCAN_START_ADDRESS & ~0xFFFUL)
+#define SIM_FDCAN_RAM_SIZE 0x4000UL
+
+typedef struct {
+  uint32_t rx_put;
+  uint32_t rx_get;
+  uint32_t rx_fill;
+  uint32_t tx_put;
+  uint32_t tx_get;
+  uint32_t tx_pending;
+  bool line_pending[2];
+  bool line_enabled[2];
+} sim_fdcan_t;
+
+static sim_fdcan_t sim_fdcan[PANDA_CAN_CNT];
+static bool sim_fdcan_ram_mapped = false;
+
+// *** NVIC and the board bits the driver uses ***
+
+#define CAN_INTERRUPT_RATE 16000U
+#define NUM_INTERRUPTS 163U
+typedef struct {
+  uint32_t ISPR[8];
+} NVIC_Type;
+NVIC_Type sim_nvic;
+#define NVIC (&sim_nvic)
+TIM_TypeDef sim_interrupt_timer;
+#define INTERRUPT_TIMER (&sim_interrupt_timer)
+void interrupt_timer_init(void) {}
+#include "drivers/interrupts.h"
+
+static const IRQn_Type sim_fdcan_irqs[PANDA_CAN_CNT][2] = {
+  { FDCAN1_IT0_IRQn, FDCAN1_IT1_IRQn },
+  { FDCAN2_IT0_IRQn, FDCAN2_IT1_IRQn },
+  { FDCAN3_IT0_IRQn, FDCAN3_IT1_IRQn },
+};
+
+static void sim_fdcan_dispatch(void);
+
+// line_pending mirrored in the NVIC's pending bits, which handle_interrupt reads
+static void sim_fdcan_set_pending(uint8_t can_number, uint8_t line, bool pending) {
+  IRQn_Type irq = sim_fdcan_irqs[can_number][line];
+  sim_fdcan[can_number].line_pending[line] = pending;
+  if (pending) {
+    NVIC->ISPR[(uint32_t)irq >> 5U] |= (1UL << ((uint32_t)irq & 0x1FU));
+  } else {
+    NVIC->ISPR[(uint32_t)irq >> 5U] &= ~(1UL << ((uint32_t)irq & 0x1FU));
+  }
+}
+
+static void sim_fdcan_set_irq(IRQn_Type irq, bool enabled) {
+  for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+    for (uint8_t line = 0U; line < 2U; line++) {
+      if (sim_fdcan_irqs[i][line] == irq) {
+        sim_fdcan[i].line_enabled[line] = enabled;
+      }
+    }
+  }
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq) {
+  sim_fdcan_set_irq(irq, true);
+  sim_fdcan_dispatch();
+}
+
+void NVIC_DisableIRQ(IRQn_Type irq) {
+  sim_fdcan_set_irq(irq, false);
+}
+
+#define LED_BLUE 2U
+uint32_t sim_led_blue_cnt = 0U;
+void led_set(uint8_t color, bool enabled) {
+  if ((color == LED_BLUE) && enabled) {
+    sim_led_blue_cnt += 1U;
+  }
+}
+
+#include "stm32h7/llfdcan.h"
+#include "drivers/fdcan.h"
+
+// *** FDCAN core model ***
+
+static uint32_t sim_fdcan_el_size(uint32_t ds) {
+  const uint32_t data_sizes[8] = {8U, 12U, 16U, 20U, 24U, 32U, 48U, 64U};
+  return 8U + data_sizes[ds & 0x7U];
+}
+
+static uint32_t sim_fdcan_rx_size(const FDCAN_GlobalTypeDef *F) {
+  return (F->RXF0C & FDCAN_RXF0C_F0S_Msk) >> FDCAN_RXF0C_F0S_Pos;
+}
+
+static uint32_t sim_fdcan_tx_size(const FDCAN_GlobalTypeDef *F) {
+  return (F->TXBC & FDCAN_TXBC_TFQS_Msk) >> FDCAN_TXBC_TFQS_Pos;
+}
+
+static canfd_fifo *sim_fdcan_rx_element(const FDCAN_GlobalTypeDef *F, uint32_t index) {
+  uint32_t start_w = (F->RXF0C & FDCAN_RXF0C_F0SA_Msk) >> FDCAN_RXF0C_F0SA_Pos;
+  uint32_t el_size = sim_fdcan_el_size((F->RXESC & FDCAN_RXESC_F0DS_Msk) >> FDCAN_RXESC_F0DS_Pos);
+  return (canfd_fifo *)(uintptr_t)(FDCAN_START_ADDRESS + (start_w * 4U) + (index * el_size));
+}
+
+static canfd_fifo *sim_fdcan_tx_element(const FDCAN_GlobalTypeDef *F, uint32_t index) {
+  uint32_t start_w = (F->TXBC & FDCAN_TXBC_TBSA_Msk) >> FDCAN_TXBC_TBSA_Pos;
+  uint32_t el_size = sim_fdcan_el_size((F->TXESC & FDCAN_TXESC_TBDS_Msk) >> FDCAN_TXESC_TBDS_Pos);
+  return (canfd_fifo *)(uintptr_t)(FDCAN_START_ADDRESS + (start_w * 4U) + (index * el_size));
+}
+
+// CCCR_, RXF0S_ and TXFQS_ are accessed directly in here, the macros would recurse
+static void sim_fdcan_update_core(FDCAN_GlobalTypeDef *F, sim_fdcan_t *s) {
+  uint32_t cccr = F->CCCR_[0].reg;
+  if (((cccr & FDCAN_CCCR_INIT) != 0U) && ((cccr & FDCAN_CCCR_CCE) != 0U)) {
+    // setting CCE resets the FIFO states and cancels pending transmissions
+    (void)memset(s, 0, offsetof(sim_fdcan_t, line_pending));
+    F->TXBRP = 0U;
+    F->TXBAR = 0U;
+    F->RXF0A = SIM_FDCAN_NO_ACK;
+  } else if ((cccr & FDCAN_CCCR_INIT) == 0U) {
+    // CCE is cleared along with INIT
+    F->CCCR_[0].reg = cccr & ~FDCAN_CCCR_CCE;
+  } else {
+  }
+
+  uint32_t rx_size = sim_fdcan_rx_size(F);
+  if ((F->RXF0A != SIM_FDCAN_NO_ACK) && (rx_size > 0U)) {
+    // frees everything up to and including the acknowledged element
+    s->rx_get = (F->RXF0A + 1U) % rx_size;
+    s->rx_fill = (s->rx_put + rx_size - s->rx_get) % rx_size;
+    F->RXF0A = SIM_FDCAN_NO_ACK;
+  }
+
+  uint32_t tx_size = sim_fdcan_tx_size(F);
+  while ((F->TXBAR != 0U) && (tx_size > 0U)) {
+    uint32_t bit = 1UL << s->tx_put;
+    if ((F->TXBAR & bit) == 0U) {
+      // adding requests out of FIFO order is not supported
+      F->TXBAR = 0U;
+      break;
+    }
+    F->TXBAR &= ~bit;
+    F->TXBRP |= bit;
+    s->tx_put = (s->tx_put + 1U) % tx_size;
+    s->tx_pending += 1U;
+  }
+
+  F->RXF0S_[0].reg = (s->rx_fill << FDCAN_RXF0S_F0FL_Pos) | (s->rx_get << FDCAN_RXF0S_F0GI_Pos) |
+                     (s->rx_put << FDCAN_RXF0S_F0PI_Pos) | (((rx_size > 0U) && (s->rx_fill == rx_size)) ? FDCAN_RXF0S_F0F : 0U);
+  uint32_t tx_free = tx_size - s->tx_pending;
+  F->TXFQS_[0].reg = (tx_free << FDCAN_TXFQS_TFFL_Pos) | (s->tx_get << FDCAN_TXFQS_TFGI_Pos) |
+                     (s->tx_put << FDCAN_TXFQS_TFQPI_Pos) | ((tx_free == 0U) ? FDCAN_TXFQS_TFQF : 0U);
+}
+
+uint32_t sim_fdcan_update(void) {
+  for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+    sim_fdcan_update_core(&sim_fdcan_regs[i], &sim_fdcan[i]);
+  }
+  return 0U;
+}
+
+static void sim_fdcan_raise(uint8_t can_number, uint32_t flags) {
+  FDCAN_GlobalTypeDef *F = &sim_fdcan_regs[can_number];
+  F->IR |= flags;
+  uint32_t enabled = flags & F->IE;
+  if (((enabled & ~F->ILS) != 0U) && ((F->ILE & FDCAN_ILE_EINT0) != 0U)) {
+    sim_fdcan_set_pending(can_number, 0U, true);
+  }
+  if (((enabled & F->ILS) != 0U) && ((F->ILE & FDCAN_ILE_EINT1) != 0U)) {
+    sim_fdcan_set_pending(can_number, 1U, true);
+  }
+}
+
+// Runs the pending, enabled interrupt lines like the NVIC would. Not reentrant: a line that
+// becomes pending in a handler runs after it.
+static void sim_fdcan_dispatch(void) {
+  static bool active = false;
+  if (!active) {
+    active = true;
+    bool ran = true;
+    while (ran) {
+      ran = false;
+      for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+        for (uint8_t line = 0U; line < 2U; line++) {
+          sim_fdcan_t *s = &sim_fdcan[i];
+          if (s->line_pending[line] && s->line_enabled[line]) {
+            sim_fdcan_set_pending(i, line, false);
+            handle_interrupt(sim_fdcan_irqs[i][line]);
+            // both handlers do "IR |= flag", which clears every set flag since IR is write 1 to clear
+            sim_fdcan_regs[i].IR = 0U;
+            ran = true;
+          }
+        }
+      }
+    }
+    active = false;
+  }
+}
+
+static bool sim_fdcan_running(const FDCAN_GlobalTypeDef *F) {
+  return ((F->CCCR_[0].reg & FDCAN_CCCR_INIT) == 0U) && (sim_fdcan_rx_size(F) > 0U) && (sim_fdcan_tx_size(F) > 0U);
+}
+
+static bool sim_fdcan_store_rx(uint8_t can_number, const CANPacket_t *frame) {
+  FDCAN_GlobalTypeDef *F = &sim_fdcan_regs[can_number];
+  sim_fdcan_t *s = &sim_fdcan[can_number];
+  uint32_t rx_size = sim_fdcan_rx_size(F);
+  bool ret = true;
+
+  if (s->rx_fill == rx_size) {
+    if ((F->RXF0C & FDCAN_RXF0C_F0OM) != 0U) {
+      // overwrite mode: the oldest element is overwritten and both indexes move on
+      s->rx_get = (s->rx_get + 1U) % rx_size;
+      s->rx_fill -= 1U;
+    }
+    sim_fdcan_raise(can_number, FDCAN_IR_RF0L);
+    ret = false;
+  }
+
+  if (s->rx_fill < rx_size) {
+    canfd_fifo *fifo = sim_fdcan_rx_element(F, s->rx_put);
+    fifo->header[0] = (frame->extended << 30) | ((frame->extended != 0U) ? frame->addr : (frame->addr << 18));
+    // FD frames are always sent with BRS on the simulated bus
+    fifo->header[1] = (frame->data_len_code << 16) | ((frame->fd != 0U) ? ((1UL << 21) | (1UL << 20)) : 0UL);
+    uint8_t len = dlc_to_len[frame->data_len_code];
+    for (uint8_t i = 0U; i < len; i += 4U) {
+      BYTE_ARRAY_TO_WORD(fifo->data_word[i / 4U], &frame->data[i]);
+    }
+    s->rx_put = (s->rx_put + 1U) % rx_size;
+    s->rx_fill += 1U;
+    sim_fdcan_raise(can_number, FDCAN_IR_RF0N);
+  }
+  (void)sim_fdcan_update();
+  return ret;
+}
+
+static bool sim_fdcan_take_tx(uint8_t can_number, CANPacket_t *frame) {
+  FDCAN_GlobalTypeDef *F = &sim_fdcan_regs[can_number];
+  sim_fdcan_t *s = &sim_fdcan[can_number];
+  bool ret = false;
+
+  (void)sim_fdcan_update();
+  // nothing goes out in bus monitoring mode, unless it's internal loopback
+  uint32_t cccr = F->CCCR_[0].reg;
+  bool loopback = ((cccr & FDCAN_CCCR_TEST) != 0U) && ((F->TEST & FDCAN_TEST_LBCK) != 0U);
+  bool silent = ((cccr & FDCAN_CCCR_MON) != 0U) && !loopback;
+  if (sim_fdcan_running(F) && !silent && (s->tx_pending > 0U)) {
+    const canfd_fifo *fifo = sim_fdcan_tx_element(F, s->tx_get);
+    frame->extended = (fifo->header[0] >> 30) & 0x1U;
+    frame->addr = (frame->extended != 0U) ? (fifo->header[0] & 0x1FFFFFFFU) : ((fifo->header[0] >> 18) & 0x7FFU);
+    frame->data_len_code = (fifo->header[1] >> 16) & 0xFU;
+    frame->fd = (fifo->header[1] >> 21) & 0x1U;
+    frame->bus = BUS_NUM_FROM_CAN_NUM(can_number);
+    frame->returned = 0U;
+    frame->rejected = 0U;
+    uint8_t len = dlc_to_len[frame->data_len_code];
+    for (uint8_t i = 0U; i < len; i += 4U) {
+      WORD_TO_BYTE_ARRAY(&frame->data[i], fifo->data_word[i / 4U]);
+    }
+    can_set_checksum(frame);
+
+    uint32_t tx_size = sim_fdcan_tx_size(F);
+    F->TXBRP &= ~(1UL << s->tx_get);
+    F->TXBTO |= (1UL << s->tx_get);
+    s->tx_get = (s->tx_get + 1U) % tx_size;
+    s->tx_pending -= 1U;
+    sim_fdcan_raise(can_number, FDCAN_IR_TC | ((s->tx_pending == 0U) ? FDCAN_IR_TFE : 0U));
+
+    // internal loopback, the frame is also received by this core
+    if (loopback) {
+      (void)sim_fdcan_store_rx(can_number, frame);
+    }
+    (void)sim_fdcan_update();
+    ret = true;
+  }
+  return ret;
+}
+
+// *** bus side, see fdcan_sim.py ***
+
+// Maps the message RAM and resets the cores and libpanda's CAN state, not silent (like in a safety
+// mode that can send) and without loopback. Must be called before anything else, returns false if
+// the message RAM address isn't available in this process.
+bool sim_fdcan_reset(void) {
+  if (!sim_fdcan_ram_mapped) {
+    void *ram = mmap((void *)(uintptr_t)SIM_FDCAN_RAM_PAGE, SIM_FDCAN_RAM_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    sim_fdcan_ram_mapped = (ram == (void *)(uintptr_t)SIM_FDCAN_RAM_PAGE);
+  }
+
+  if (sim_fdcan_ram_mapped) {
+    (void)memset((void *)(uintptr_t)SIM_FDCAN_RAM_PAGE, 0, SIM_FDCAN_RAM_SIZE);
+    (void)memset(sim_fdcan_regs, 0, sizeof(sim_fdcan_regs));
+    (void)memset(sim_fdcan, 0, sizeof(sim_fdcan));
+    (void)memset(can_health, 0, sizeof(can_health));
+    for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+      sim_fdcan_regs[i].RXF0A = SIM_FDCAN_NO_ACK;
+      bus_config[i].forwarding_bus = -1;
+    }
+    can_loopback = false;
+    can_silent = false;
+    rx_buffer_overflow = 0U;
+    tx_buffer_overflow = 0U;
+    can_clear(&can_rx_q);
+    can_init_all();
+  }
+  return sim_fdcan_ram_mapped;
+}
+
+// A frame on can_number's bus, returns false if it didn't make it into RX FIFO 0 intact
+// (core in init, or the FIFO was full and a frame was lost)
+bool sim_fdcan_receive(uint8_t can_number, const CANPacket_t *frame) {
+  bool ret = false;
+  if (sim_fdcan_running(&sim_fdcan_regs[can_number])) {
+    ret = sim_fdcan_store_rx(can_number, frame);
+    sim_fdcan_dispatch();
+  }
+  return ret;
+}
+
+// Puts the oldest pending frame of can_number's TX FIFO on the bus, into frame.
+// Returns false if nothing is pending.
+bool sim_fdcan_transmit(uint8_t can_number, CANPacket_t *frame) {
+  bool ret = sim_fdcan_take_tx(can_number, frame);
+  sim_fdcan_dispatch();
+  return ret;
+}
+
+// Batched versions for benchmarks, n frames or until the first one that fails. Arrays of pointers,
+// since the Python side's CANPacket_t can't have the alignment padding.
+uint32_t sim_fdcan_receive_many(uint8_t can_number, CANPacket_t *const *frames, uint32_t n) {
+  uint32_t cnt = 0U;
+  while ((cnt < n) && sim_fdcan_receive(can_number, frames[cnt])) {
+    cnt++;
+  }
+  return cnt;
+}
+
+uint32_t sim_fdcan_transmit_many(uint8_t can_number, CANPacket_t *const *frames, uint32_t n) {
+  uint32_t cnt = 0U;
+  while ((cnt < n) && sim_fdcan_transmit(can_number, frames[cnt])) {
+    cnt++;
+  }
+  return cnt;
+}
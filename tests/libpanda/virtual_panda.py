@@ -0,0 +1,153 @@
+import threading
+import time
+
+import usb1
+
+from panda import Panda
+from panda.python.base import BaseHandle, TIMEOUT
+from panda.tests.libpanda.libpanda_py import ffi, libpanda as lpp
+
+PANDA_CAN_CNT = 3
+MAX_CAN_MSGS_PER_USB_BULK_TRANSFER = 51
+CAN_RX_READ_SIZE = 16384
+CONTROL_RESP_SIZE = 4096
+TICK_HZ = 8
+
+VIRTUAL_SERIAL = "virtual"
+
+
+class VirtualPandaHandle(BaseHandle):
+  """
+  A panda in this process: CAN goes through the firmware's comms code and rings compiled into
+  libpanda, and a simulated bus puts the TX queues on the wire at the configured bitrates, returning
+  every frame (and looping it back as received in loopback mode). Control requests go to the
+  firmware's comms_control_handler, on a stubbed board (see sim_comms.h).
+
+  libpanda's state is global, so there can only be one per process.
+  """
+
+  def __init__(self, simulate_bitrate: bool = True, hw_type: bytes = Panda.HW_TYPE_RED_PANDA):
+    self.simulate_bitrate = simulate_bitrate
+    self.hw_type = hw_type
+    self._lock = threading.Lock()
+    self._rx_buf = ffi.new(f"uint8_t[{CAN_RX_READ_SIZE}]")
+    self._budget = ffi.new("uint64_t *")
+    self._req = ffi.new("ControlPacket_t *")
+    self._resp = ffi.new(f"uint8_t[{CONTROL_RESP_SIZE}]")
+    self._bus_budget = [0] * PANDA_CAN_CNT
+    self._reset()
+
+  def _reset(self):
+    with self._lock:
+      for q in (lpp.rx_q, lpp.tx1_q, lpp.tx2_q, lpp.tx3_q):
+        lpp.can_clear(q)
+      for bus in range(PANDA_CAN_CNT):
+        cfg = lpp.bus_config[bus]
+        cfg.can_speed, cfg.can_data_speed = 5000, 20000
+        cfg.canfd_auto = cfg.canfd_enabled = cfg.brs_enabled = cfg.canfd_non_iso = False
+      lpp.can_loopback = False
+      lpp.hw_type = self.hw_type[0]
+      lpp.sim_comms_reset()
+      lpp.comms_can_reset()
+      lpp.safety_tx_blocked = lpp.tx_buffer_overflow = lpp.rx_buffer_overflow = 0
+
+      self._last_ns = self._started_ns = time.monotonic_ns()
+      self._ticks = 0
+
+  def close(self):
+    pass
+
+  # *** simulated bus ***
+
+  def _transmit(self):
+    # lock held
+    now = time.monotonic_ns()
+    elapsed, self._last_ns = now - self._last_ns, now
+    lpp.timer.CNT = (now // 1000) & 0xFFFFFFFF
+    lpp.uptime_cnt = (now - self._started_ns) // 1_000_000_000
+    # the main loop's tick, for the telemetry records
+    ticks = (now - self._started_ns) * TICK_HZ // 1_000_000_000
+    while self._ticks < ticks:
+      self._ticks += 1
+      lpp.sim_telemetry_tick()
+    for bus in range(PANDA_CAN_CNT):
+      self._budget[0] = self._bus_budget[bus] + elapsed if self.simulate_bitrate else (1 << 63)
+      lpp.sim_can_transmit(bus, self._budget)
+      # an idle bus can't save up time for a later burst
+      q = (lpp.tx1_q, lpp.tx2_q, lpp.tx3_q)[bus]
+      self._bus_budget[bus] = self._budget[0] if (q.w_ptr != q.r_ptr and self.simulate_bitrate) else 0
+
+  # *** bulk ***
+
+  def bulkWrite(self, endpoint: int, data: bytes, timeout: int = TIMEOUT) -> int:
+    assert endpoint == 3, f"unsupported bulk OUT endpoint {endpoint}"
+    # like the USB endpoint, NAK until the TX queues have room for a whole transfer
+    deadline = time.monotonic() + timeout / 1000 if timeout else None
+    while True:
+      with self._lock:
+        self._transmit()
+        if lpp.can_tx_check_min_slots_free(MAX_CAN_MSGS_PER_USB_BULK_TRANSFER):
+          lpp.comms_can_write(ffi.from_buffer("uint8_t[]", bytes(data)), len(data))
+          return len(data)
+      if deadline is not None and time.monotonic() > deadline:
+        e = usb1.USBErrorTimeout()
+        e.transferred = 0
+        raise e
+      time.sleep(0.0001)
+
+  def bulkRead(self, endpoint: int, length: int, timeout: int = TIMEOUT) -> bytes:
+    assert endpoint == 1, f"unsupported bulk IN endpoint {endpoint}"
+    with self._lock:
+      self._transmit()
+      n = lpp.comms_can_read(self._rx_buf, min(length, CAN_RX_READ_SIZE))
+      return bytes(ffi.buffer(self._rx_buf, n))
+
+  # *** control ***
+
+  def controlWrite(self, request_type: int, request: int, value: int, index: int, data, timeout: int = TIMEOUT, expect_disconnect: bool = False):
+    self._control(request, value, index, 0)
+
+  def controlRead(self, request_type: int, request: int, value: int, index: int, length: int, timeout: int = TIMEOUT) -> bytes:
+    return self._control(request, value, index, length)[:length]
+
+  def _control(self, request: int, param1: int, param2: int, length: int) -> bytes:
+    with self._lock:
+      self._transmit()
+      self._req.request, self._req.param1, self._req.param2, self._req.length = request, param1, param2, length
+      n = lpp.comms_control_handler(self._req, self._resp)
+      dat = bytes(ffi.buffer(self._resp, n))
+      reset = lpp.sim_reset_requested
+
+    if reset:
+      # bootstub/bootloader or plain reset, comes straight back as a fresh app
+      self._reset()
+    return dat
+
+
+class VirtualPanda(Panda):
+  """
+  The full Panda API on a VirtualPandaHandle, for host only tests and benchmarks:
+
+    with VirtualPanda() as p:
+      p.set_can_loopback(True)
+      p.can_send_many(msgs)
+      p.can_recv()
+  """
+
+  def __init__(self, simulate_bitrate: bool = True, **kwargs):
+    self._virtual_handle = VirtualPandaHandle(simulate_bitrate)
+    super().__init__(serial=VIRTUAL_SERIAL, cli=False, **kwargs)
+
+  def _probe(self, claim, wait):
+    return None, self._virtual_handle, VIRTUAL_SERIAL, False
+
+  @property
+  def spi(self) -> bool:
+    return False
+
+  def get_dfu_serial(self):
+    return None
+
+  def get_usb_serial(self):
+    return VIRTUAL_SERIAL
+
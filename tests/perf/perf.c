@@ -0,0 +1,250 @@
+// Host benchmarks of the firmware's CAN hot paths: libpanda's build of the comms and
+// ring code, optimized like the firmware. Prints ns/op per benchmark as JSON, see run.py.
+//   ./perf [repeats] [scale]
+#include <time.h>
+
+#include "tests/libpanda/panda.c"
+
+#define WRITE_STREAM_SIZE (1U << 16)
+static uint8_t write_stream[WRITE_STREAM_SIZE + 16U];
+static uint8_t read_buf[16384U];
+
+static volatile uint32_t sink;
+static uint32_t scale = 1U;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static void make_packet(CANPacket_t *p, uint32_t addr, uint8_t bus, uint8_t len) {
+  (void)memset(p, 0, sizeof(CANPacket_t));
+  p->addr = addr;
+  p->extended = (addr >= 0x800U) ? 1U : 0U;
+  p->bus = bus;
+  p->data_len_code = (len <= 8U) ? len : 15U;
+  for (uint8_t i = 0U; i < dlc_to_len[p->data_len_code]; i++) {
+    p->data[i] = (uint8_t)((addr * 7U) + i);
+  }
+  can_set_checksum(p);
+}
+
+static void reset_queues(void) {
+  can_clear(&can_rx_q);
+  for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+    can_clear(can_queues[i]);
+  }
+  comms_can_reset();
+}
+
+// *** benchmarks, each returns the ns spent on ops operations ***
+
+typedef uint64_t (*bench_fn)(uint32_t param, uint64_t *ops);
+
+static uint64_t bench_can_push(uint32_t param, uint64_t *ops) {
+  UNUSED(param);
+  CANPacket_t p;
+  make_packet(&p, 0x123U, 0U, 8U);
+  uint64_t ns = 0U;
+  for (uint32_t r = 0U; r < (64U / scale); r++) {
+    can_clear(&can_rx_q);
+    uint64_t st = now_ns();
+    for (uint32_t i = 0U; i < (CAN_RX_BUFFER_SIZE - 1U); i++) {
+      sink += can_push(&can_rx_q, &p) ? 1U : 0U;
+    }
+    ns += now_ns() - st;
+    *ops += CAN_RX_BUFFER_SIZE - 1U;
+  }
+  return ns;
+}
+
+static uint64_t bench_can_pop(uint32_t param, uint64_t *ops) {
+  UNUSED(param);
+  CANPacket_t p;
+  make_packet(&p, 0x123U, 0U, 8U);
+  uint64_t ns = 0U;
+  for (uint32_t r = 0U; r < (64U / scale); r++) {
+    can_clear(&can_rx_q);
+    for (uint32_t i = 0U; i < (CAN_RX_BUFFER_SIZE - 1U); i++) {
+      (void)can_push(&can_rx_q, &p);
+    }
+    uint64_t st = now_ns();
+    while (can_pop(&can_rx_q, &p)) {
+      sink += 1U;
+    }
+    ns += now_ns() - st;
+    *ops += CAN_RX_BUFFER_SIZE - 1U;
+  }
+  return ns;
+}
+
+static uint64_t bench_can_set_checksum(uint32_t len, uint64_t *ops) {
+  CANPacket_t p;
+  make_packet(&p, 0x123U, 0U, (uint8_t)len);
+  uint32_t n = (1U << 20) / scale;
+  uint64_t st = now_ns();
+  for (uint32_t i = 0U; i < n; i++) {
+    p.data[0] = (uint8_t)i;
+    can_set_checksum(&p);
+    sink += p.checksum;
+  }
+  *ops += n;
+  return now_ns() - st;
+}
+
+// chunk sized writes of a stream of classic frames on all buses, like USB/SPI transfers
+static uint64_t bench_comms_can_write(uint32_t chunk, uint64_t *ops) {
+  uint32_t stream_len = 0U;
+  uint32_t frame = 0U;
+  while (stream_len < WRITE_STREAM_SIZE) {
+    CANPacket_t p;
+    make_packet(&p, 0x100U + (frame % 0x400U), (uint8_t)(frame % PANDA_CAN_CNT), 8U);
+    (void)memcpy(&write_stream[stream_len], (uint8_t *)&p, CANPACKET_HEAD_SIZE + 8U);
+    stream_len += CANPACKET_HEAD_SIZE + 8U;
+    frame++;
+  }
+
+  (void)set_safety_hooks(SAFETY_ALLOUTPUT, 0U);
+  uint32_t min_free = ((chunk / (CANPACKET_HEAD_SIZE + 8U)) / PANDA_CAN_CNT) + 2U;
+  uint64_t ns = 0U;
+  for (uint32_t r = 0U; r < (16U / scale); r++) {
+    reset_queues();
+    for (uint32_t pos = 0U; (pos + chunk) <= stream_len; pos += chunk) {
+      if (!can_tx_check_min_slots_free(min_free)) {
+        for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+          can_clear(can_queues[i]);
+        }
+      }
+      uint64_t st = now_ns();
+      comms_can_write(&write_stream[pos], chunk);
+      ns += now_ns() - st;
+      *ops += 1U;
+    }
+  }
+  sink += tx_buffer_overflow;
+  return ns;
+}
+
+// chunk sized reads of a full RX queue
+static uint64_t bench_comms_can_read(uint32_t chunk, uint64_t *ops) {
+  uint64_t ns = 0U;
+  for (uint32_t r = 0U; r < (16U / scale); r++) {
+    reset_queues();
+    for (uint32_t i = 0U; i < (CAN_RX_BUFFER_SIZE - 1U); i++) {
+      CANPacket_t p;
+      make_packet(&p, 0x100U + (i % 0x400U), (uint8_t)(i % PANDA_CAN_CNT), 8U);
+      (void)can_push(&can_rx_q, &p);
+    }
+    int len = 1;
+    while (len > 0) {
+      uint64_t st = now_ns();
+      len = comms_can_read(read_buf, chunk);
+      ns += now_ns() - st;
+      *ops += 1U;
+      sink += (uint32_t)len;
+    }
+  }
+  return ns;
+}
+
+static uint64_t bench_ignition_can_hook(uint32_t addr, uint64_t *ops) {
+  CANPacket_t p;
+  make_packet(&p, addr, 0U, 8U);
+  uint32_t n = (1U << 20) / scale;
+  uint64_t st = now_ns();
+  for (uint32_t i = 0U; i < n; i++) {
+    p.data[1] = (uint8_t)i;
+    ignition_can_hook(&p);
+  }
+  *ops += n;
+  sink += ignition_can ? 1U : 0U;
+  return now_ns() - st;
+}
+
+static uint64_t bench_safety_rx_hook(uint32_t mode, uint64_t *ops) {
+  (void)set_safety_hooks((uint16_t)mode, 0U);
+  CANPacket_t p;
+  make_packet(&p, 0x123U, 0U, 8U);
+  uint32_t n = (1U << 20) / scale;
+  uint64_t st = now_ns();
+  for (uint32_t i = 0U; i < n; i++) {
+    p.addr = 0x100U + (i & 0xFFU);
+    sink += safety_rx_hook(&p) ? 1U : 0U;
+  }
+  *ops += n;
+  return now_ns() - st;
+}
+
+static uint64_t bench_safety_tx_hook(uint32_t mode, uint64_t *ops) {
+  (void)set_safety_hooks((uint16_t)mode, 0U);
+  CANPacket_t p;
+  make_packet(&p, 0x123U, 0U, 8U);
+  uint32_t n = (1U << 20) / scale;
+  uint64_t st = now_ns();
+  for (uint32_t i = 0U; i < n; i++) {
+    p.addr = 0x100U + (i & 0xFFU);
+    sink += (uint32_t)safety_tx_hook(&p);
+  }
+  *ops += n;
+  return now_ns() - st;
+}
+
+// *** runner ***
+
+typedef struct {
+  const char *name;
+  bench_fn fn;
+  uint32_t param;
+} benchmark_t;
+
+static const benchmark_t benchmarks[] = {
+  {"can_push", bench_can_push, 0U},
+  {"can_pop", bench_can_pop, 0U},
+  {"can_set_checksum/8", bench_can_set_checksum, 8U},
+  {"can_set_checksum/64", bench_can_set_checksum, 64U},
+  {"comms_can_write/64", bench_comms_can_write, 64U},
+  {"comms_can_write/512", bench_comms_can_write, 512U},
+  {"comms_can_write/4096", bench_comms_can_write, 4096U},
+  {"comms_can_write/16384", bench_comms_can_write, 16384U},
+  {"comms_can_read/64", bench_comms_can_read, 64U},
+  {"comms_can_read/512", bench_comms_can_read, 512U},
+  {"comms_can_read/4096", bench_comms_can_read, 4096U},
+  {"comms_can_read/16384", bench_comms_can_read, 16384U},
+  {"ignition_can_hook/match", bench_ignition_can_hook, 0x1F1U},
+  {"ignition_can_hook/miss", bench_ignition_can_hook, 0x123U},
+  {"safety_rx_hook/silent", bench_safety_rx_hook, SAFETY_SILENT},
+  {"safety_rx_hook/alloutput", bench_safety_rx_hook, SAFETY_ALLOUTPUT},
+  {"safety_tx_hook/silent", bench_safety_tx_hook, SAFETY_SILENT},
+  {"safety_tx_hook/alloutput", bench_safety_tx_hook, SAFETY_ALLOUTPUT},
+};
+
+int main(int argc, char **argv) {
+  uint32_t repeats = (argc > 1) ? (uint32_t)atoi(argv[1]) : 5U;
+  scale = (argc > 2) ? (uint32_t)atoi(argv[2]) : 1U;
+  if ((repeats == 0U) || (scale == 0U) || (scale > 16U)) {
+    printf("usage: %s [repeats] [scale, 1 to 16]\n", argv[0]);
+    return 1;
+  }
+
+  uint32_t cnt = sizeof(benchmarks) / sizeof(benchmarks[0]);
+  printf("{\n  \"compiler\": \"%s\",\n  \"repeats\": %u,\n  \"benchmarks\": {\n", __VERSION__, repeats);
+  for (uint32_t b = 0U; b < cnt; b++) {
+    // best of the repeats, the least disturbed by everything else running
+    double best = -1.0;
+    uint64_t best_ops = 0U;
+    for (uint32_t r = 0U; r < repeats; r++) {
+      uint64_t ops = 0U;
+      uint64_t ns = benchmarks[b].fn(benchmarks[b].param, &ops);
+      double ns_per_op = (double)ns / (double)ops;
+      if ((best < 0.0) || (ns_per_op < best)) {
+        best = ns_per_op;
+        best_ops = ops;
+      }
+    }
+    printf("    \"%s\": {\"ns_per_op\": %.3f, \"ops\": %lu}%s\n", benchmarks[b].name, best, (unsigned long)best_ops, ((b + 1U) < cnt) ? "," : "");
+  }
+  printf("  }\n}\n");
+  reset_queues();
+  return 0;
+}
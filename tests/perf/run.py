@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+# Runs the firmware comms benchmarks (perf.c) on this tree and on its merge base, and fails
+# on anything more than --tolerance slower:
+#   ./run.py                          # against the merge base with origin/master, or master without a remote
+#   ./run.py --base HEAD~1            # against another revision
+#   ./run.py --save base.json         # store this tree's run, and later
+#   ./run.py --baseline base.json     # compare against a stored run instead, same machine only
+import argparse
+import contextlib
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+PERF_DIR = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.abspath(os.path.join(PERF_DIR, "../../"))
+DEFAULT_BINARY = os.path.join(PERF_DIR, "perf")
+DEFAULT_BASES = ("origin/master", "master")
+
+
+def build(tree: str, out: str) -> str:
+  """
+  Builds perf with tree's SCons setup and firmware sources. This tree's perf.c and SConscript
+  are copied in, so older trees run the same benchmarks with the same flags.
+  """
+  if "tests/perf/SConscript" not in open(os.path.join(tree, "SConscript")).read():
+    raise RuntimeError(f"{tree} has no perf build, compare against a newer --base or a stored --baseline")
+  if os.path.abspath(tree) != ROOT:
+    for f in ("perf.c", "SConscript"):
+      shutil.copy(os.path.join(PERF_DIR, f), os.path.join(tree, "tests/perf", f))
+  subprocess.check_call(f"scons -C {tree} -j$(nproc) tests/perf/perf", shell=True)
+  shutil.copy(os.path.join(tree, "tests/perf/perf"), out)
+  return out
+
+
+def run(binary: str = DEFAULT_BINARY, repeats: int = 5, scale: int = 1) -> dict:
+  out = subprocess.check_output([binary, str(repeats), str(scale)])
+  return json.loads(out)
+
+
+def best_of(runs: list[dict]) -> dict:
+  """Merges runs of the same binary, keeping each benchmark's fastest."""
+  ret = dict(runs[0], benchmarks={})
+  for r in runs:
+    for name, b in r["benchmarks"].items():
+      if name not in ret["benchmarks"] or b["ns_per_op"] < ret["benchmarks"][name]["ns_per_op"]:
+        ret["benchmarks"][name] = b
+  ret["repeats"] = sum(r["repeats"] for r in runs)
+  return ret
+
+
+def run_interleaved(binaries: list[str], repeats: int) -> list[dict]:
+  """Runs the binaries in turns, so machine load and clock changes hit them alike."""
+  runs: list[list[dict]] = [[] for _ in binaries]
+  for _ in range(repeats):
+    for i, b in enumerate(binaries):
+      runs[i].append(run(b, 1))
+  return [best_of(r) for r in runs]
+
+
+@contextlib.contextmanager
+def worktree(rev: str):
+  """rev checked out in a temporary worktree."""
+  with tempfile.TemporaryDirectory() as tmp:
+    tree = os.path.join(tmp, "tree")
+    subprocess.check_call(["git", "worktree", "add", "--detach", "-q", tree, rev], cwd=ROOT)
+    try:
+      yield tree
+    finally:
+      subprocess.check_call(["git", "worktree", "remove", "--force", tree], cwd=ROOT)
+
+
+def resolve(rev: str) -> str | None:
+  out = subprocess.run(["git", "rev-parse", "--verify", "-q", f"{rev}^{{commit}}"], cwd=ROOT, capture_output=True, encoding="utf8")
+  return out.stdout.strip() if out.returncode == 0 else None
+
+
+def merge_base(rev: str) -> str:
+  return subprocess.check_output(["git", "merge-base", rev, "HEAD"], cwd=ROOT, encoding="utf8").strip()
+
+
+def compare(baseline: dict, current: dict, tolerance: float, min_delta_ns: float = 1.0):
+  """
+  Returns [(name, baseline ns/op, current ns/op, relative change, regressed)] for the benchmarks
+  in both. Only changes beyond tolerance and min_delta_ns count, tiny ops are noisy.
+  """
+  ret = []
+  for name, cur in current["benchmarks"].items():
+    base = baseline["benchmarks"].get(name)
+    if base is None:
+      continue
+    b, c = base["ns_per_op"], cur["ns_per_op"]
+    change = (c - b) / b if b > 0 else 0.0
+    ret.append((name, b, c, change, change > tolerance and (c - b) > min_delta_ns))
+  return ret
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--base", help=f"compare against the merge base with this revision, the first of {', '.join(DEFAULT_BASES)} that exists by default")
+  parser.add_argument("--baseline", help="compare against this stored run instead of building the base")
+  parser.add_argument("--save", help="only store this tree's run here")
+  parser.add_argument("--tolerance", type=float, default=0.10, help="allowed slowdown, relative")
+  parser.add_argument("--repeats", type=int, default=5)
+  args = parser.parse_args()
+
+  if args.baseline and not os.path.exists(args.baseline):
+    print(f"no baseline at {args.baseline}, store one with --save")
+    sys.exit(1)
+
+  if args.save or args.baseline:
+    with tempfile.TemporaryDirectory() as tmp:
+      current = run(build(ROOT, os.path.join(tmp, "perf")), args.repeats)
+  else:
+    bases = [args.base] if args.base else DEFAULT_BASES
+    base = next((b for b in bases if resolve(b) is not None), None)
+    if base is None:
+      print(f"no revision {' or '.join(bases)} here, pass one with --base or compare against --baseline")
+      sys.exit(1)
+    rev = merge_base(base)
+    with tempfile.TemporaryDirectory() as tmp, worktree(rev) as tree:
+      binaries = [build(tree, os.path.join(tmp, "perf_base")), build(ROOT, os.path.join(tmp, "perf"))]
+      baseline, current = run_interleaved(binaries, args.repeats)
+    desc = rev[:12]
+
+  if args.save:
+    with open(args.save, "w") as f:
+      json.dump(current, f, indent=2)
+    print(f"saved {len(current['benchmarks'])} benchmarks to {args.save}")
+    sys.exit(0)
+
+  if args.baseline:
+    with open(args.baseline) as f:
+      baseline = json.load(f)
+    desc = args.baseline
+  if baseline.get("compiler") != current.get("compiler"):
+    print(f"warning: baseline built with {baseline.get('compiler')}, this with {current.get('compiler')}")
+
+  results = compare(baseline, current, args.tolerance)
+  if len(results) == 0:
+    print(f"no benchmarks in common with {desc}")
+    sys.exit(1)
+
+  print(f"{'benchmark':<28}{'baseline':>12}{'current':>12}{'change':>9}    (baseline: {desc})")
+  for name, b, c, change, regressed in results:
+    print(f"{name:<28}{b:>10.1f}ns{c:>10.1f}ns{change:>+8.1%}{'  REGRESSION' if regressed else ''}")
+
+  regressions = [r[0] for r in results if r[4]]
+  if len(regressions):
+    print(f"{len(regressions)} regressed by more than {args.tolerance:.0%}: {', '.join(regressions)}")
+    sys.exit(1)
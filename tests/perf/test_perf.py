@@ -0,0 +1,41 @@
+import unittest
+
+from panda.tests.perf.run import best_of, compare, run
+
+
+def results(**ns):
+  return {"benchmarks": {name: {"ns_per_op": v, "ops": 1} for name, v in ns.items()}}
+
+
+class TestPerf(unittest.TestCase):
+  def test_compare(self):
+    base = results(can_push=10.0, can_pop=10.0, tiny=2.0, gone=5.0)
+    cur = results(can_push=12.0, can_pop=10.5, tiny=2.9, new=1.0)
+    out = {r[0]: r for r in compare(base, cur, tolerance=0.1)}
+    self.assertEqual(set(out), {"can_push", "can_pop", "tiny"})
+    self.assertTrue(out["can_push"][4])
+    self.assertAlmostEqual(out["can_push"][3], 0.2)
+    self.assertFalse(out["can_pop"][4])
+    # +45%, but below the absolute noise floor
+    self.assertFalse(out["tiny"][4])
+
+  def test_best_of(self):
+    runs = [dict(results(can_push=10.0, can_pop=8.0), repeats=1), dict(results(can_push=9.0, can_pop=9.0), repeats=1)]
+    out = best_of(runs)
+    self.assertEqual({n: r["ns_per_op"] for n, r in out["benchmarks"].items()}, {"can_push": 9.0, "can_pop": 8.0})
+    self.assertEqual(out["repeats"], 2)
+
+  def test_run(self):
+    # a quick run, every benchmark is there and took time
+    out = run(repeats=1, scale=16)
+    names = set(out["benchmarks"])
+    for prefix in ("can_push", "can_pop", "can_set_checksum/", "comms_can_read/", "comms_can_write/", "ignition_can_hook/",
+                   "safety_rx_hook/", "safety_tx_hook/"):
+      self.assertTrue(any(n.startswith(prefix) for n in names), prefix)
+    for name, r in out["benchmarks"].items():
+      self.assertGreater(r["ns_per_op"], 0, name)
+      self.assertGreater(r["ops"], 0, name)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# BitStats (python/cananalysis.py) on a synthetic binary CAN log, against the old row by row analysis on a CSV sample.
+import argparse
+import csv
+import os
+import random
+import time
+
+from panda.python import canpack
+from panda.python.canlog import CanLogWriter
+from panda.python.cananalysis import BitStats
+
+
+def make_log(path, n):
+  random.seed(0)
+  ids = [(random.randrange(3), random.randrange(0x800)) for _ in range(200)]
+  # a few static bytes, a counter and some noise per ID
+  static = {k: random.randbytes(8) for k in ids}
+  with CanLogWriter(path) as log:
+    for i in range(n):
+      bus, address = ids[i % len(ids)]
+      dat = bytearray(static[(bus, address)])
+      dat[0] = (i // len(ids)) & 0xFF
+      dat[7] = random.getrandbits(8)
+      log.write_record(i * 10, address, bytes(dat), bus)
+  return ids
+
+def make_csv(path, n):
+  random.seed(0)
+  with open(path, "w", newline='') as f:
+    w = csv.writer(f)
+    w.writerow(['Bus', 'MessageID', 'Message', 'MessageLength', 'Time'])
+    for i in range(n):
+      dat = random.randbytes(8)
+      w.writerow([i % 3, hex(0x100 + i % 200), f"0x{dat.hex()}", 8, i * 1e-5])
+
+def row_by_row(path):
+  # what can_unique.py used to do
+  ones: dict[str, list[int]] = {}
+  zeros: dict[str, list[int]] = {}
+  with open(path) as f:
+    reader = csv.reader(f)
+    next(reader)
+    for row in reader:
+      message_id = f"{row[0]}:{row[1][2:]}"
+      if message_id not in ones:
+        ones[message_id], zeros[message_id] = [0] * 64, [0] * 64
+      bts = bytearray.fromhex(row[2][2:])
+      for i in range(len(bts)):
+        ones[message_id][i] |= bts[i]
+        zeros[message_id][i] |= (~bts[i]) & 0xff
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("-n", type=int, default=10_000_000, help="frames in the synthetic log")
+  parser.add_argument("--log", default="/tmp/can_analysis_benchmark.canlog", help="reused if it exists")
+  parser.add_argument("--csv-rows", type=int, default=200_000)
+  args = parser.parse_args()
+
+  if not os.path.exists(args.log):
+    print(f"writing {args.n} frames to {args.log}...")
+    make_log(args.log, args.n)
+  print(f"libcanpack: {'yes' if canpack.canpack_lib is not None else 'no'}")
+
+  for flips in (False, True):
+    st = time.perf_counter()
+    stats = BitStats(flips=flips).add_file(args.log)
+    dt = time.perf_counter() - st
+    n = int(stats.count.sum())
+    print(f"  BitStats(flips={flips!s:<5}) {n} frames in {dt:6.2f}s, {n / dt / 1e6:5.2f}M frames/s")
+
+  csv_path = args.log + ".csv"
+  make_csv(csv_path, args.csv_rows)
+  st = time.perf_counter()
+  row_by_row(csv_path)
+  dt = time.perf_counter() - st
+  print(f"  row by row CSV         {args.csv_rows} frames in {dt:6.2f}s, {args.csv_rows / dt / 1e6:5.2f}M frames/s")
+  st = time.perf_counter()
+  BitStats(flips=False).add_file(csv_path)
+  dt = time.perf_counter() - st
+  print(f"  BitStats CSV           {args.csv_rows} frames in {dt:6.2f}s, {args.csv_rows / dt / 1e6:5.2f}M frames/s")
+  os.unlink(csv_path)
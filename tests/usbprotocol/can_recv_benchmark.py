@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# Frames/sec through Panda.can_recv (tuples) and Panda.can_recv_batch (numpy), against a canned bulk read.
+import argparse
+import random
+import time
+
+from panda import Panda, DLC_TO_LEN, pack_can_buffer
+from panda.python import canpack
+
+
+class FakeHandle:
+  def __init__(self, dat):
+    self.dat = dat
+
+  def bulkRead(self, endpoint, length, timeout=0):
+    return self.dat
+
+
+def fake_panda(dat):
+  p = Panda.__new__(Panda)
+  p._handle = FakeHandle(dat)
+  p.can_rx_overflow_buffer = b''
+  p.can_version = Panda.CAN_PACKET_VERSION
+  return p
+
+
+def measure(fn, n_frames, seconds):
+  fn()
+  cnt = 0
+  st = time.perf_counter()
+  while time.perf_counter() - st < seconds:
+    fn()
+    cnt += 1
+  return cnt * n_frames / (time.perf_counter() - st)
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("-n", type=int, default=2000, help="frames per read")
+  parser.add_argument("-t", type=float, default=2.0, help="seconds per test")
+  parser.add_argument("--fd", action="store_true", help="CAN FD sized payloads")
+  args = parser.parse_args()
+
+  lens = DLC_TO_LEN if args.fd else DLC_TO_LEN[:9]
+  msgs = [(random.randint(0, 0x7FF), random.randbytes(random.choice(lens)), random.randrange(3)) for _ in range(args.n)]
+  p = fake_panda(bytes(b"".join(pack_can_buffer(msgs))))
+
+  print(f"libcanpack: {'yes' if canpack.canpack_lib is not None else 'no'}, {args.n} frames per read")
+  tests = {
+    "can_recv": p.can_recv,
+    "can_recv_batch": p.can_recv_batch,
+    "can_recv_batch columns": lambda: p.can_recv_batch(columns=True),
+  }
+  for desc, fn in tests.items():
+    print(f"  {desc:<24} {measure(fn, args.n, args.t) / 1e3:8.0f}k frames/s")
@@ -0,0 +1,126 @@
+import ctypes
+import fcntl
+import os
+import struct
+import zlib
+from contextlib import contextmanager
+from unittest.mock import patch
+
+from panda.python.spi import SpiDevice, PandaSpiHandle, SPI_IOC_MESSAGE_1, SPI_IOC_MESSAGE_2, SPI_IOC_TRANSFER, \
+                             xor_checksum, SYNC, SYNC_V3, SYNC_V3_CRC32, HACK, DACK, NACK, V3_HEADER_GAP_US
+
+
+class FakeSpidev:
+  """
+  Stands in for spidev.SpiDev and the kernel's SPI_IOC_MESSAGE, with a panda on the other
+  end that speaks the v2 and v3 protocols. Control reads answer with `length` bytes of the
+  request number, bulk reads drain `bulk_data`, and writes are recorded in `written`.
+  """
+
+  def __init__(self):
+    self._fd = os.open(os.devnull, os.O_RDWR)
+    self._out = bytearray()
+    self._header = None
+    self.bulk_data = bytearray()
+    self.written: list[tuple[int, bytes]] = []
+    self.gaps = 0
+
+  def fileno(self):
+    return self._fd
+
+  def close(self):
+    os.close(self._fd)
+
+  def _respond(self, endpoint, data, max_rx_len, crc32):
+    if endpoint == 0:
+      request, _, _, length = struct.unpack("<BHHH", data[:7])
+      resp = bytes([request, ]) * length
+    elif endpoint in (1, 0x81) and len(data) == 0:
+      resp = bytes(self.bulk_data[:max_rx_len])
+      del self.bulk_data[:max_rx_len]
+    else:
+      self.written.append((endpoint, bytes(data)))
+      resp = b""
+
+    out = bytes([DACK, len(resp) & 0xFF, len(resp) >> 8]) + resp
+    if crc32:
+      out += struct.pack("<I", zlib.crc32(out))
+    else:
+      out += bytes([xor_checksum(out), ])
+    self._out = bytearray(out)
+
+  def _receive(self, tx):
+    if self._header is not None:
+      # v2 data phase
+      endpoint, tx_len, max_rx_len = self._header
+      self._header = None
+      if xor_checksum(tx[:tx_len + 1]) != 0:
+        self._out = bytearray([NACK, ])
+      else:
+        self._respond(endpoint, tx[:tx_len], max_rx_len, False)
+    elif tx[0] in (SYNC, SYNC_V3, SYNC_V3_CRC32):
+      sync, endpoint, tx_len, max_rx_len = PandaSpiHandle.HEADER.unpack_from(tx)
+      if xor_checksum(tx[:7]) != 0:
+        self._out = bytearray([NACK, ])
+      elif sync == SYNC:
+        self._header = (endpoint, tx_len, max_rx_len)
+        self._out = bytearray([HACK, ])
+      else:
+        crc32 = (sync == SYNC_V3_CRC32)
+        data = tx[7:7 + tx_len]
+        if crc32:
+          valid = zlib.crc32(data) == struct.unpack_from("<I", tx, 7 + tx_len)[0]
+        else:
+          valid = xor_checksum(tx[7:8 + tx_len]) == 0
+        if valid:
+          self._respond(endpoint, data, max_rx_len, crc32)
+        else:
+          self._out = bytearray([NACK, ])
+
+  def transfer(self, tx: bytes) -> bytes:
+    if len(self._out) == 0:
+      self._receive(tx)
+      return bytes(len(tx))
+    rx = bytes(self._out[:len(tx)]).ljust(len(tx), b"\x00")
+    del self._out[:len(tx)]
+    return rx
+
+  def ioctl(self, request, arg):
+    # a message of two transfers is one burst, v3's header and data with a gap in between
+    assert request in (SPI_IOC_MESSAGE_1, SPI_IOC_MESSAGE_2)
+    xfers = [SPI_IOC_TRANSFER.unpack_from(arg, i * SPI_IOC_TRANSFER.size) for i in range(1 if request == SPI_IOC_MESSAGE_1 else 2)]
+    tx = b"".join(ctypes.string_at(x[0], x[2]) if x[0] else bytes(x[2]) for x in xfers)
+    if len(xfers) == 2:
+      assert tx[0] in (SYNC_V3, SYNC_V3_CRC32) and xfers[0][2] == PandaSpiHandle.HEADER.size + 1
+      assert xfers[0][4] == V3_HEADER_GAP_US and xfers[0][6] == 0, "CS must stay asserted during the gap"
+      self.gaps += 1
+    rx = self.transfer(tx)
+    pos = 0
+    for x in xfers:
+      ctypes.memmove(x[1], rx[pos:pos + x[2]], x[2])
+      pos += x[2]
+    return 0
+
+
+@contextmanager
+def fake_spi_handle():
+  """Yields a PandaSpiHandle talking to a FakeSpidev."""
+  spi = FakeSpidev()
+  dev = SpiDevice.__new__(SpiDevice)
+  dev.speed = SpiDevice.MAX_SPEED
+  dev._spidev = spi
+
+  real_ioctl = fcntl.ioctl
+  def ioctl(fd, request, arg=0, mutate_flag=True):
+    if fd == spi.fileno():
+      return spi.ioctl(request, arg)
+    return real_ioctl(fd, request, arg, mutate_flag)
+
+  with patch("fcntl.ioctl", ioctl):
+    h = PandaSpiHandle(dev)
+    h.protocol_version = PandaSpiHandle.PROTOCOL_VERSION
+    h.v3 = True
+    try:
+      yield h, spi
+    finally:
+      spi.close()
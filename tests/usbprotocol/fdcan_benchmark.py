@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+# Frames/sec through the firmware's FDCAN driver on the simulated cores, see tests/libpanda/sim_fdcan.h
+import argparse
+import random
+import time
+
+from panda.python.canpack import pack_can_buffer
+from panda.tests.libpanda.fdcan_sim import FdcanSim, make_frame
+from panda.tests.libpanda.libpanda_py import ffi, libpanda_fdcan as lpf
+
+# fits in a TX queue (CAN_TX_BUFFER_SIZE), and in the RX queue with the returned echoes
+CHUNK = 400
+
+
+def random_msgs(n, fd):
+  lens = [8, 12, 16, 20, 24, 32, 48, 64] if fd else list(range(9))
+  return [(random.randint(0, 0x7FF), random.randbytes(random.choice(lens)), 0) for _ in range(n)]
+
+
+def frame_array(frames):
+  # the C side takes arrays of pointers, keep the frames alive with it
+  arr = ffi.new(f"CANPacket_t *[{len(frames)}]", frames)
+  return arr, frames
+
+
+def measure_rx(msgs, fd, seconds, fwd_bus=None):
+  arr, _frames = frame_array([make_frame(addr, dat, bus, fd) for addr, dat, bus in msgs])
+  out, _out_frames = frame_array([ffi.new("CANPacket_t *") for _ in msgs])
+
+  cnt = 0
+  st = time.perf_counter()
+  while time.perf_counter() - st < seconds:
+    assert lpf.sim_fdcan_receive_many(0, arr, len(msgs)) == len(msgs)
+    if fwd_bus is not None:
+      assert lpf.sim_fdcan_transmit_many(fwd_bus, out, len(msgs)) == len(msgs)
+    lpf.can_clear(lpf.rx_q)
+    cnt += len(msgs)
+  return cnt / (time.perf_counter() - st)
+
+
+def measure_tx(msgs, fd, seconds):
+  # through the USB/SPI write path: comms_can_write -> safety -> TX queue -> process_can
+  dat = pack_can_buffer(msgs, fd=fd)[0]
+  buf = ffi.from_buffer("uint8_t[]", dat)
+  out, _out_frames = frame_array([ffi.new("CANPacket_t *") for _ in msgs])
+  lpf.set_safety_hooks(17, 0)  # all output
+
+  cnt = 0
+  st = time.perf_counter()
+  while time.perf_counter() - st < seconds:
+    lpf.comms_can_write(buf, len(dat))
+    assert lpf.sim_fdcan_transmit_many(0, out, len(msgs)) == len(msgs)
+    lpf.can_clear(lpf.rx_q)
+    cnt += len(msgs)
+  return cnt / (time.perf_counter() - st)
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("-t", type=float, default=2.0, help="seconds per test")
+  parser.add_argument("--fd", action="store_true", help="CAN FD frames")
+  args = parser.parse_args()
+
+  sim = FdcanSim()
+  msgs = random_msgs(CHUNK, args.fd)
+  print(f"RX, bus -> RX FIFO 0 -> can_rx -> RX queue:           {measure_rx(msgs, args.fd, args.t):>12,.0f} frames/s")
+  sim.reset()
+  print(f"TX, comms_can_write -> process_can -> TX FIFO -> bus: {measure_tx(msgs, args.fd, args.t):>12,.0f} frames/s")
+  sim.reset()
+  lpf.bus_config[0].forwarding_bus = 1
+  print(f"RX forwarded to bus 1 and sent:                       {measure_rx(msgs, args.fd, args.t, fwd_bus=1):>12,.0f} frames/s")
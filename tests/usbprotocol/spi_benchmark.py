@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# Time and Python memory allocated per PandaSpiHandle transfer, against the fake spidev.
+# The fake panda runs in Python too, so its own overhead is included in both.
+import argparse
+import time
+import tracemalloc
+
+from panda import Panda
+from panda.tests.usbprotocol.fake_spidev import fake_spi_handle
+
+
+def measure(fn, n):
+  fn()  # warm up, e.g. the constant TX buffers
+
+  # peak traced memory above the baseline, while running one transfer at a time
+  peak = 0
+  tracemalloc.start()
+  for _ in range(min(n, 200)):
+    base = tracemalloc.get_traced_memory()[0]
+    tracemalloc.reset_peak()
+    fn()
+    peak = max(peak, tracemalloc.get_traced_memory()[1] - base)
+  tracemalloc.stop()
+
+  st = time.perf_counter()
+  for _ in range(n):
+    fn()
+  dt = time.perf_counter() - st
+  return dt / n * 1e6, peak
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("-n", type=int, default=2000)
+  args = parser.parse_args()
+
+  with fake_spi_handle() as (h, spi):
+    rx_dat = bytes(range(256)) * 4
+    tests = {
+      "controlRead (health)": lambda: h.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, 60),
+      "bulkRead 1 KB": lambda: (spi.bulk_data.extend(rx_dat), h.bulkRead(1, 0x4000)),
+      "bulkWrite 1 KB": lambda: (h.bulkWrite(3, rx_dat), spi.written.clear()),
+    }
+
+    for version, crc32 in ((2, False), (3, False), (3, True)):
+      h.protocol_version = version
+      h.v3 = version == 3
+      h.crc32 = crc32
+      print(f"*** v{version}" + (" + CRC-32" if crc32 else ""))
+      for desc, fn in tests.items():
+        us, peak = measure(fn, args.n)
+        print(f"  {desc:<24} {us:7.1f} us  {peak / 1024:6.1f} KB peak allocated")
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+import asyncio
+import queue
+import random
+import unittest
+
+import usb1
+
+from panda import Panda, pack_can_buffer
+from panda.python.asyncpanda import AsyncPanda
+from panda.python.usb import PandaUsbHandle
+
+
+class FakeTransfer:
+  def __init__(self, dev):
+    self.dev = dev
+    self.status = None
+    self.buf = b""
+    self.actual = 0
+
+  def setBulk(self, endpoint, buffer_or_len, callback=None, user_data=None, timeout=0):
+    self.endpoint = endpoint
+    self.buf = bytearray(buffer_or_len) if isinstance(buffer_or_len, int) else bytes(buffer_or_len)
+    self.callback = callback
+    self.user_data = user_data
+
+  def submit(self):
+    self.dev.submitted.put(self)
+
+  def cancel(self):
+    self.dev.cancelled.add(self)
+
+  def close(self):
+    pass
+
+  def getStatus(self):
+    return self.status
+
+  def getActualLength(self):
+    return self.actual
+
+  def getBuffer(self):
+    return self.buf
+
+  def getUserData(self):
+    return self.user_data
+
+
+class FakeUsb:
+  """libusb handle and context, with a panda that echoes written CAN packets back like loopback."""
+
+  def __init__(self):
+    self.submitted: queue.Queue = queue.Queue()
+    self.cancelled: set = set()
+    self.pending_rx: list = []
+    self.rx_data = bytearray()
+
+  def getTransfer(self):
+    return FakeTransfer(self)
+
+  def handleEventsTimeout(self, tv=0):
+    try:
+      t = self.submitted.get(timeout=tv)
+    except queue.Empty:
+      t = None
+    if t is not None and t.endpoint & 0x80:
+      self.pending_rx.append(t)
+    elif t is not None:
+      self.rx_data += t.buf
+      t.status, t.actual = usb1.TRANSFER_COMPLETED, len(t.buf)
+      t.callback(t)
+
+    for t in list(self.pending_rx):
+      if t in self.cancelled:
+        self.cancelled.discard(t)
+        t.status = usb1.TRANSFER_CANCELLED
+      elif len(self.rx_data):
+        # odd sized reads, to split packets across transfers
+        n = min(len(t.buf), len(self.rx_data), random.randrange(1, 300))
+        t.buf[:n] = self.rx_data[:n]
+        del self.rx_data[:n]
+        t.status, t.actual = usb1.TRANSFER_COMPLETED, n
+      else:
+        continue
+      self.pending_rx.remove(t)
+      t.callback(t)
+
+
+def fake_panda(usb):
+  p = Panda.__new__(Panda)
+  p._handle = PandaUsbHandle(usb)
+  p._context = usb
+  return p
+
+
+class TestAsyncPanda(unittest.TestCase):
+  def test_loopback(self):
+    msgs = [(random.randint(0, 0x7FF), random.randbytes(8), random.randrange(3)) for _ in range(2000)]
+
+    async def run():
+      usb = FakeUsb()
+      async with AsyncPanda(fake_panda(usb), rx_transfers=3, tx_transfers=2) as p:
+        await p.can_send_many(msgs)
+        self.assertEqual(p.tx_bytes, len(b"".join(pack_can_buffer(msgs))))
+
+        got = []
+        async for msg in p.frames():
+          got.append(msg)
+          if len(got) == len(msgs):
+            break
+        self.assertEqual(got, msgs)
+      self.assertEqual(len(usb.pending_rx), 0)
+
+    asyncio.run(asyncio.wait_for(run(), 10))
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+import csv
+import os
+import random
+import tempfile
+import unittest
+
+import numpy as np
+
+from panda import DLC_TO_LEN
+from panda.python.cananalysis import BitStats, _rows_to_frames, _csv_rows_to_frames, load_frames
+
+
+class TestBitStats(unittest.TestCase):
+  def test_matches_naive(self):
+    rows = []
+    for i in range(5000):
+      address = random.choice((0x100, 0x200, 0x18DAF110))
+      n = 8 if address != 0x18DAF110 else random.choice(DLC_TO_LEN)
+      rows.append((i, address, bytes(random.getrandbits(8) & random.choice((0x01, 0x0F, 0xFF)) for _ in range(n)), random.choice((0, 1, 192))))
+
+    stats = BitStats()
+    for i in range(0, len(rows), 777):
+      stats.add(_rows_to_frames(rows[i:i + 777]))
+
+    for key in stats.ids():
+      msgs = [(t, dat) for t, address, dat, bus in rows if (bus, address) == key]
+      ones, zeros, seen = [0] * 64, [0] * 64, [0] * 64
+      flips = np.zeros(512, dtype=np.uint32)
+      prev = None
+      for _, dat in msgs:
+        for i, b in enumerate(dat):
+          ones[i] |= b
+          zeros[i] |= ~b & 0xFF
+          seen[i] = 0xFF
+          if prev is not None:
+            for bit in range(8):
+              flips[i * 8 + bit] += ((b ^ prev[i]) >> bit) & 1 if i < len(prev) else (b >> bit) & 1
+        prev = dat
+
+      self.assertEqual(stats.count[stats.rows[key]], len(msgs))
+      self.assertEqual(stats.first_seen(key), msgs[0][0])
+      self.assertEqual(list(stats.ever_one(key)), ones)
+      self.assertEqual(list(stats.ever_zero(key)), zeros)
+      self.assertEqual(list(stats.always_one(key)), [s & ~z & 0xFF for s, z in zip(seen, zeros, strict=True)])
+      self.assertEqual(list(stats.always_zero(key)), [s & ~o & 0xFF for s, o in zip(seen, ones, strict=True)])
+      np.testing.assert_array_equal(stats.flip_counts(key), flips)
+
+  def test_csv_parser(self):
+    formats = {
+      "logger": (["Bus", "MessageID", "Message", "MessageLength", "Time"],
+                 lambda t, a, d, b: [b, hex(a), f"0x{d.hex()}", len(d), t]),
+      "old logger": (["Bus", "MessageID", "Message"], lambda t, a, d, b: [b, a, d.hex()]),
+      "cabana": (["time", "addr", "bus", "data"], lambda t, a, d, b: [t, a, b, d.hex()]),
+    }
+    with tempfile.TemporaryDirectory() as tmp:
+      path = os.path.join(tmp, "log.csv")
+      for name, (header, fmt) in formats.items():
+        for line_end, blank in (("\n", False), ("\r\n", False), ("\n", True)):
+          with self.subTest(format=name, line_end=line_end, blank=blank):
+            rows = [fmt(i / 1000, random.choice((0x10, 0x7ff, 0x18daf110)), random.randbytes(random.choice(DLC_TO_LEN)),
+                        random.choice((0, 2, 128))) for i in range(3000)]
+            with open(path, "w", newline="") as f:
+              w = csv.writer(f, lineterminator=line_end)
+              w.writerow(header)
+              w.writerows(rows[:1500])
+              if blank:
+                f.write(line_end)
+              w.writerows(rows[1500:])
+
+            expected = _csv_rows_to_frames([[str(c) for c in r] for r in rows], name == "cabana")
+            got = np.concatenate(list(load_frames(path, batch_records=500)))
+            np.testing.assert_array_equal(got, expected)
+
+
+if __name__ == "__main__":
+  unittest.main()
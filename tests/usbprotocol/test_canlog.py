@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+import os
+import random
+import tempfile
+import unittest
+from unittest.mock import patch
+
+from panda import DLC_TO_LEN
+from panda.python import canpack
+from panda.python.canlog import CanLogReader, CanLogWriter, csv_to_canlog
+
+
+class TestCanLog(unittest.TestCase):
+  def setUp(self):
+    self.dir = tempfile.TemporaryDirectory()
+    self.path = os.path.join(self.dir.name, "test.canlog")
+    self.records = []
+    t = 1_000_000
+    for _ in range(10000):
+      t += random.randrange(0, 500)
+      self.records.append((t, random.choice((0x100, 0x200, 0x18DAF110, random.randrange(0x800))),
+                           random.randbytes(random.choice(DLC_TO_LEN)), random.choice((0, 1, 2, 128))))
+
+  def tearDown(self):
+    self.dir.cleanup()
+
+  def _write(self, close=True):
+    log = CanLogWriter(self.path, chunk_records=100)
+    for r in self.records:
+      log.write_record(*r)
+    if close:
+      log.close()
+    else:
+      log._flush_chunk()
+      log._f.close()
+
+  def test_roundtrip(self):
+    for close in (True, False):
+      with self.subTest(index=close):
+        self._write(close)
+        with CanLogReader(self.path) as log:
+          self.assertEqual(len(log), len(self.records))
+          self.assertEqual(list(log), self.records)
+          self.assertEqual((log.start_time, log.end_time), (self.records[0][0], self.records[-1][0]))
+
+          for _ in range(20):
+            start, end = sorted(random.randrange(self.records[0][0], self.records[-1][0]) for _ in range(2))
+            self.assertEqual(list(log.records(start, end)), [r for r in self.records if start <= r[0] < end])
+
+          self.assertEqual(list(log.records(address=0x200)), [r for r in self.records if r[1] == 0x200])
+          self.assertEqual(list(log.records(address=0x100, bus=1, start=start)),
+                           [r for r in self.records if r[1] == 0x100 and r[3] == 1 and r[0] >= start])
+
+  def test_frames(self):
+    self._write()
+    start, end = self.records[1000][0], self.records[8000][0]
+    expected = [r for r in self.records if start <= r[0] < end]
+    for lib in {None, canpack.canpack_lib}:
+      with self.subTest(native=lib is not None), patch.object(canpack, "canpack_lib", lib), CanLogReader(self.path) as log:
+        got = []
+        for frames in log.frames(start, end, batch_records=1000):
+          self.assertLessEqual(len(frames), 1000)
+          for f in frames:
+            bus = int(f["bus"]) + (128 if f["flags"] & canpack.CAN_FRAME_FLAG_RETURNED else 0)
+            got.append((int(f["timestamp"]), int(f["address"]), bytes(f["data"][:f["len"]]), bus))
+        self.assertEqual(got, expected)
+
+  def test_truncated(self):
+    self._write(close=False)
+    with open(self.path, "ab") as f:
+      f.write(b"\x01\x02\x03")
+    with CanLogReader(self.path) as log:
+      self.assertEqual(list(log), self.records)
+
+  def test_csv(self):
+    csv_path = os.path.join(self.dir.name, "test.csv")
+    with open(csv_path, "w") as f:
+      f.write("Bus,MessageID,Message,MessageLength,Time\n")
+      f.write("0,0x292,0x040000001068,6,0.5\n")
+      f.write("1,0x18daf110,0x,0,1.25\n")
+    self.assertEqual(csv_to_canlog(csv_path, self.path), 2)
+    with CanLogReader(self.path) as log:
+      self.assertEqual(list(log), [(500000, 0x292, bytes.fromhex("040000001068"), 0), (1250000, 0x18daf110, b"", 1)])
+
+    with open(csv_path, "w") as f:
+      f.write("time,addr,bus,data\n240.5,53,0,0acc0ade0074bf9e\n")
+    csv_to_canlog(csv_path, self.path)
+    with CanLogReader(self.path) as log:
+      self.assertEqual(list(log), [(240500000, 53, bytes.fromhex("0acc0ade0074bf9e"), 0)])
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+import threading
+import time
+import unittest
+
+from panda.python.canreader import CanRing, CanReader
+
+
+class FakeRecv:
+  def __init__(self, total, batch):
+    self.sent = 0
+    self.total = total
+    self.batch = batch
+
+  def __call__(self):
+    n = min(self.batch, self.total - self.sent)
+    msgs = [(self.sent + i, b"", 0) for i in range(n)]
+    self.sent += n
+    return msgs
+
+
+class TestCanReader(unittest.TestCase):
+  def test_ring(self):
+    ring = CanRing(8)
+    for i in range(5):
+      self.assertEqual(ring.push_many(list(range(i * 5, i * 5 + 5)), float(i)), 0)
+      msgs, oldest = ring.pop_many(100)
+      self.assertEqual(msgs, list(range(i * 5, i * 5 + 5)))
+      self.assertEqual(oldest, float(i))
+
+    self.assertEqual(ring.push_many(list(range(10)), 0.0), 2)
+    self.assertEqual(len(ring), 8)
+    self.assertEqual(ring.pop_many(3)[0], [0, 1, 2])
+    self.assertEqual(ring.pop_many(100)[0], [3, 4, 5, 6, 7])
+    self.assertEqual(ring.pop_many(100), ([], None))
+
+  def test_reader_stall(self):
+    # the consumer stalls while the reader keeps draining, nothing is lost
+    recv = FakeRecv(20000, 100)
+    reader = CanReader(recv, ring_size=1 << 15, poll_interval=0.0001)
+    reader.start()
+    time.sleep(0.2)
+    got = []
+    while len(got) < recv.total:
+      msgs = reader.read(timeout=2)
+      self.assertGreater(len(msgs), 0)
+      got.extend(msgs)
+    reader.stop()
+
+    self.assertEqual([m[0] for m in got], list(range(recv.total)))
+    stats = reader.stats()
+    self.assertEqual(stats["received"], recv.total)
+    self.assertEqual(stats["dropped"], 0)
+    self.assertGreater(stats["max_latency"], 0.1)
+
+  def test_reader_drops(self):
+    recv = FakeRecv(1000, 100)
+    reader = CanReader(recv, ring_size=256, poll_interval=0.0001)
+    reader.start()
+    while recv.sent < recv.total:
+      time.sleep(0.01)
+    reader.stop()
+    self.assertEqual(reader.stats()["dropped"], 1000 - 256)
+    self.assertEqual(reader.read(timeout=0), [(i, b"", 0) for i in range(256)])
+
+  def test_callback_and_timeout(self):
+    got = []
+    done = threading.Event()
+    recv = FakeRecv(500, 50)
+    def callback(msgs):
+      got.extend(msgs)
+      if len(got) == recv.total:
+        done.set()
+
+    reader = CanReader(recv, callback=callback, poll_interval=0.0001)
+    reader.start()
+    self.assertTrue(done.wait(2))
+    st = time.monotonic()
+    self.assertEqual(reader.read(timeout=0.05), [])
+    self.assertGreaterEqual(time.monotonic() - st, 0.05)
+    reader.stop()
+    self.assertEqual(len(got), recv.total)
+
+  def test_error(self):
+    def recv():
+      raise OSError("gone")
+    reader = CanReader(recv)
+    reader.start()
+    with self.assertRaises(OSError):
+      reader.read(timeout=1)
+    reader.stop()
+
+  def test_callback_error(self):
+    def callback(msgs):
+      raise ValueError("bad msgs")
+    reader = CanReader(FakeRecv(10, 10), callback=callback)
+    reader.start()
+    with self.assertRaises(ValueError):
+      reader.read(timeout=1)
+    reader.stop()
+
+
+if __name__ == "__main__":
+  unittest.main()
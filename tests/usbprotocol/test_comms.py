@@ -156,6 +156,62 @@ class TestPandaComms(unittest.TestCase):
     self.assertEqual(len(rx_msgs), len(msgs))
     self.assertEqual(rx_msgs, msgs)
 
+  def _clear_rx_q(self):
+    pkt = libpanda_py.ffi.new('CANPacket_t *')
+    while lpp.can_pop(lpp.rx_q, pkt):
+      pass
+
+  def test_can_read_prefetch(self):
+    self._clear_rx_q()
+    msgs = random_can_messages(500)
+    for m in msgs:
+      lpp.can_push(lpp.rx_q, libpanda_py.make_CANPacket(m[0], m[2], m[1]))
+
+    MAX_LEN = 4000
+    dat = libpanda_py.ffi.new(f"uint8_t[{MAX_LEN}]")
+    pf = libpanda_py.ffi.new("can_read_prefetch_t *")
+
+    rx_msgs = []
+    while True:
+      prefetched = lpp.comms_can_read_prefetch(dat, MAX_LEN, pf)
+      if prefetched == 0:
+        break
+      assert prefetched <= MAX_LEN
+
+      # not popped until committed
+      assert lpp.comms_can_read_prefetch(dat, MAX_LEN, pf) == prefetched
+      assert lpp.comms_can_read_commit(pf)
+      assert not lpp.comms_can_read_commit(pf), "prefetched data can only be committed once"
+
+      unpacked, overflow = unpack_can_buffer(bytes(dat[0:prefetched]))
+      assert len(overflow) == 0, "only whole packets are prefetched"
+      rx_msgs.extend(unpacked)
+
+    self.assertEqual(rx_msgs, msgs)
+
+  def test_can_read_prefetch_stale(self):
+    self._clear_rx_q()
+    msgs = random_can_messages(10)
+    for m in msgs:
+      lpp.can_push(lpp.rx_q, libpanda_py.make_CANPacket(m[0], m[2], m[1]))
+
+    dat = libpanda_py.ffi.new("uint8_t[1024]")
+    pf = libpanda_py.ffi.new("can_read_prefetch_t *")
+    assert lpp.comms_can_read_prefetch(dat, 1024, pf) > 0
+
+    # another read invalidates the prefetched data
+    assert lpp.comms_can_read(dat, 1024) > 0
+    assert not lpp.comms_can_read_commit(pf)
+
+    # and so does a partial packet left over from a read
+    for m in msgs:
+      lpp.can_push(lpp.rx_q, libpanda_py.make_CANPacket(m[0], m[2], m[1]))
+    assert lpp.comms_can_read(dat, 3) == 3
+    assert lpp.comms_can_read_prefetch(dat, 1024, pf) == 0
+    assert not lpp.comms_can_read_commit(pf)
+    lpp.comms_can_reset()
+    self._clear_rx_q()
+
 
 if __name__ == "__main__":
   unittest.main()
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+import struct
+import unittest
+from unittest import mock
+
+from panda.python.usb import STBootloaderUSBHandle
+
+DFU_DNLOAD_IDLE = 5
+
+
+class FakeDfuDevice:
+  """Just enough of the ST DfuSe bootloader to program blocks."""
+  def __init__(self, busy_polls=1):
+    self.busy_polls = busy_polls
+    self.flash = {}
+    self.pointer = 0
+    self.pending = None
+    self.busy = 0
+    self.status_reads = 0
+
+  def getStringDescriptor(self, i, lang):
+    return "@Internal Flash  /0x08000000/08*128Kg" if i == 4 else None
+
+  def controlWrite(self, request_type, request, value, index, data, timeout=0):
+    assert request == STBootloaderUSBHandle.DFU_DNLOAD
+    assert self.pending is None and self.busy == 0, "DNLOAD before the previous one finished"
+    self.pending = (value, bytes(data))
+
+  def controlRead(self, request_type, request, value, index, length, timeout=0):
+    assert request == STBootloaderUSBHandle.DFU_GETSTATUS
+    self.status_reads += 1
+    if self.pending is not None:
+      # first GETSTATUS starts the operation
+      value, data = self.pending
+      self.pending = None
+      if value == 0 and data[0] == 0x21:
+        self.pointer = struct.unpack("I", data[1:])[0]
+      elif value >= 2:
+        self.flash[self.pointer + (value - 2) * len(data)] = data
+      self.busy = self.busy_polls
+    if self.busy > 0:
+      self.busy -= 1
+      return bytes([0, 5, 0, 0, STBootloaderUSBHandle.STATE_DNBUSY, 0])
+    return bytes([0, 0, 0, 0, DFU_DNLOAD_IDLE, 0])
+
+
+class TestDfuProgram(unittest.TestCase):
+  def setUp(self):
+    self.dev = FakeDfuDevice()
+    self.h = STBootloaderUSBHandle(None, self.dev)
+    self.bs = self.h.get_mcu_type().config.block_size
+
+  def _program(self, dat):
+    with mock.patch("time.sleep") as sleep:
+      self.h.program(0x8000000, dat)
+    return sleep
+
+  def test_program(self):
+    dat = bytes(range(256)) * (3 * self.bs // 256) + b"\x01\x02"
+    self._program(dat)
+    self.assertEqual(sorted(self.dev.flash), [0x8000000 + i * self.bs for i in range(4)])
+    self.assertEqual(b"".join(self.dev.flash[a] for a in sorted(self.dev.flash)), dat.ljust(4 * self.bs, b"\xff"))
+
+  def test_skips_erased_blocks(self):
+    blocks = [b"\x01" * self.bs, b"\xff" * self.bs, b"\xff" * self.bs, b"\x02" * self.bs, b"\xff" * 10]
+    self._program(b"".join(blocks))
+    self.assertEqual(self.dev.flash, {0x8000000: blocks[0], 0x8000000 + 3 * self.bs: blocks[3]})
+
+  def test_waits_poll_timeout(self):
+    self.dev.busy_polls = 3
+    sleep = self._program(b"\x01" * (2 * self.bs))
+    # 3 busy polls per DNLOAD (address pointer + 2 blocks), each waiting out the 5ms the device asked for
+    self.assertEqual(sleep.call_count, 9)
+    self.assertEqual(sleep.call_args.args[0], 0.005)
+    self.assertEqual(self.dev.status_reads, 12)
+
+  def test_error_state(self):
+    self.dev.controlRead = lambda *args: bytes([0x0a, 0, 0, 0, STBootloaderUSBHandle.STATE_ERROR, 0])
+    with self.assertRaises(RuntimeError):
+      self.h.program(0x8000000, b"\x01" * self.bs)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,110 @@
+import random
+import unittest
+
+from panda.tests.libpanda.fdcan_sim import FdcanSim
+from panda.tests.libpanda.libpanda_py import libpanda_fdcan as lpf
+
+RX_FIFO_0_EL_CNT = 46
+
+
+def random_msgs(n, bus=0, fd=False):
+  lens = [8, 12, 16, 20, 24, 32, 48, 64] if fd else list(range(9))
+  return [(random.randint(0, 0x1FFFFFFF if random.random() < 0.3 else 0x7FF), random.randbytes(random.choice(lens)), bus) for _ in range(n)]
+
+
+class TestFdcanSim(unittest.TestCase):
+  @classmethod
+  def setUpClass(cls):
+    cls.sim = FdcanSim()
+
+  def setUp(self):
+    random.seed(0)
+    self.sim.reset()
+
+  def test_rx(self):
+    for bus in range(3):
+      msgs = random_msgs(100, bus, fd=(bus == 2))
+      for addr, dat, b in msgs:
+        self.assertTrue(self.sim.receive(addr, dat, b, fd=(bus == 2)))
+      self.assertEqual(self.sim.rx(), msgs)
+      h = self.sim.health(bus)
+      self.assertEqual(h.total_rx_cnt, 100)
+      self.assertEqual(h.total_rx_lost_cnt, 0)
+    # the driver turns on CAN FD and BRS when it sees an FD frame
+    self.assertTrue(lpf.bus_config[2].canfd_enabled)
+    self.assertTrue(lpf.bus_config[2].brs_enabled)
+    self.assertFalse(lpf.bus_config[0].canfd_enabled)
+
+  def test_tx(self):
+    msgs = random_msgs(300, 1)
+    for addr, dat, bus in msgs:
+      self.sim.send(addr, dat, bus)
+    # the first one went into the (single element) TX FIFO right away, its echo too
+    self.assertEqual(self.sim.rx(), [(msgs[0][0], msgs[0][1], 129)])
+
+    # each completion refills the FIFO from the TX queue, from the TX FIFO empty interrupt
+    self.assertEqual(self.sim.transmit_all(1), msgs)
+    self.assertEqual(self.sim.rx(), [(a, d, 129) for a, d, _ in msgs[1:]])
+    self.assertEqual(self.sim.health(1).total_tx_cnt, len(msgs))
+    self.assertIsNone(self.sim.transmit(0))
+
+  def test_silent(self):
+    self.sim.set_silent(True)
+    self.sim.send(0x123, b"\x01", 0)
+    self.assertIsNone(self.sim.transmit(0))
+    self.sim.set_silent(False)
+    # re-initializing the core cancels whatever was in the TX FIFO
+    self.assertIsNone(self.sim.transmit(0))
+
+  def test_loopback(self):
+    self.sim.set_loopback(True)
+    msgs = random_msgs(50, 0)
+    for addr, dat, bus in msgs:
+      self.sim.send(addr, dat, bus)
+    self.assertEqual(self.sim.transmit_all(0), msgs)
+    rx = self.sim.rx()
+    self.assertEqual([m for m in rx if m[2] == 128], [(a, d, 128) for a, d, _ in msgs])
+    self.assertEqual([m for m in rx if m[2] == 0], msgs)
+
+  def test_forwarding(self):
+    lpf.bus_config[0].forwarding_bus = 2
+    msgs = random_msgs(100, 0)
+    for addr, dat, bus in msgs:
+      self.assertTrue(self.sim.receive(addr, dat, bus))
+    self.assertEqual(self.sim.transmit_all(2), [(a, d, 2) for a, d, _ in msgs])
+    self.assertEqual(self.sim.health(0).total_fwd_cnt, len(msgs))
+    self.assertEqual(self.sim.health(2).total_tx_cnt, len(msgs))
+    # the host gets both the received frames and the forwarded ones, as returned on bus 2
+    rx = self.sim.rx()
+    self.assertEqual([m for m in rx if m[2] == 0], msgs)
+    self.assertEqual([m for m in rx if m[2] == 130], [(a, d, 130) for a, d, _ in msgs])
+
+  def test_rx_fifo_overflow(self):
+    # the RX interrupt can't run, the FIFO is in overwrite mode
+    msgs = random_msgs(RX_FIFO_0_EL_CNT + 4, 0)
+    self.sim.set_irq_enabled(0, False)
+    stored = [self.sim.receive(addr, dat, bus) for addr, dat, bus in msgs]
+    self.assertEqual(stored, [True] * RX_FIFO_0_EL_CNT + [False] * 4)
+    self.assertEqual(self.sim.rx(), [])
+
+    self.sim.set_irq_enabled(0, True)
+    # the 4 oldest were overwritten, and the driver skips one more reading a full FIFO
+    self.assertEqual(self.sim.rx(), msgs[5:])
+    h = self.sim.health(0)
+    self.assertEqual(h.total_rx_cnt, RX_FIFO_0_EL_CNT - 1)
+    self.assertGreater(h.total_rx_lost_cnt, 0)
+    self.assertEqual(h.total_error_cnt, 1)
+
+    # and it keeps working
+    self.assertTrue(self.sim.receive(0x123, b"\x01\x02", 0))
+    self.assertEqual(self.sim.rx(), [(0x123, b"\x01\x02", 0)])
+
+  def test_rx_queue_overflow(self):
+    for i in range(5000):
+      self.sim.receive(0x100 + (i % 0x100), b"\x00" * 8, 0)
+    self.assertGreater(lpf.rx_buffer_overflow, 0)
+    self.assertEqual(len(self.sim.rx()), 4095)
+
+
+if __name__ == "__main__":
+  unittest.main()
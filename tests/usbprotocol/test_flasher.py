@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+import random
+import unittest
+
+from panda import Panda, McuType
+from panda.tests.libpanda.libpanda_py import ffi, libflasher as lf
+
+SECTOR_SIZE = 0x20000
+APP_START = SECTOR_SIZE
+
+
+class FlasherHandle:
+  """The bootstub's flasher in libflasher, on a simulated flash."""
+  def __init__(self):
+    self._req = ffi.new("ControlPacket_t *")
+    self._resp = ffi.new("uint8_t[64]")
+    self.requests: list[tuple[int, int]] = []
+
+  def _control(self, request, param1, param2, length):
+    self.requests.append((request, param1))
+    self._req.request, self._req.param1, self._req.param2, self._req.length = request, param1, param2, length
+    n = lf.comms_control_handler(self._req, self._resp)
+    return bytes(ffi.buffer(self._resp, n))
+
+  def controlWrite(self, request_type, request, value, index, data, timeout=0, expect_disconnect=False):
+    self._control(request, value, index, 0)
+
+  def controlRead(self, request_type, request, value, index, length, timeout=0):
+    return self._control(request, value, index, length)[:length]
+
+  def bulkWrite(self, endpoint, data, timeout=0):
+    assert endpoint == 2
+    lf.comms_endpoint2_write(ffi.from_buffer("uint8_t[]", bytes(data)), len(data))
+    return len(data)
+
+
+class TestFlasher(unittest.TestCase):
+  def setUp(self):
+    lf.sim_flasher_reset()
+
+  def flash(self, code):
+    h = FlasherHandle()
+    lf.sim_reset_requested = False
+    Panda.flash_static(h, code, mcu_type=McuType.H7)
+    self.assertTrue(lf.sim_reset_requested)
+    self.assertEqual(lf.sim_flash_errors, 0)
+    app = bytes(ffi.buffer(lf.sim_flash))[APP_START:]
+    self.assertEqual(app[:len(code)], code)
+    self.assertEqual(app[len(code):3 * SECTOR_SIZE], b"\xff" * (3 * SECTOR_SIZE - len(code)))
+    return [p for r, p in h.requests if r == 0xb2]
+
+  def test_partial_flash_word(self):
+    # the image ends mid flash word, that tail is only in the write buffer until it's flushed
+    code = random.randbytes(SECTOR_SIZE + 100)
+    self.assertNotEqual(len(code) % 32, 0)
+    self.assertEqual(self.flash(code), [1, 2])
+
+    # only the changed sector is rewritten, and verified with its tail
+    code = code[:-1] + bytes([code[-1] ^ 0xff])
+    self.assertEqual(self.flash(code), [2])
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,91 @@
+import unittest
+
+from panda.tests.libpanda.libpanda_py import ffi, libpanda_fdcan as lpf
+
+# unused by the FDCAN sim
+IRQ_A = 10
+IRQ_B = 11
+
+
+class TestInterruptStats(unittest.TestCase):
+  def setUp(self):
+    self.handlers = []
+    for irq in (IRQ_A, IRQ_B):
+      lpf.interrupts[irq] = {"irq_type": irq}
+    self.next_second()
+
+  def set_handler(self, irq, fn):
+    cb = ffi.callback("void(void)", fn)
+    self.handlers.append(cb)
+    lpf.interrupts[irq].handler = cb
+
+  def advance(self, us):
+    lpf.timer.CNT = (lpf.timer.CNT + us) & 0xFFFFFFFF
+
+  def next_second(self):
+    lpf.sim_interrupt_timer.SR = 1
+    lpf.interrupt_timer_handler()
+
+  def stats(self, irq):
+    i = lpf.interrupts[irq]
+    return i.call_rate, i.busy_us, i.max_duration_us, i.max_latency_us
+
+  def set_pending(self, irq, pending):
+    if pending:
+      lpf.sim_nvic.ISPR[irq // 32] |= 1 << (irq % 32)
+    else:
+      lpf.sim_nvic.ISPR[irq // 32] &= ~(1 << (irq % 32)) & 0xFFFFFFFF
+
+  def test_latency(self):
+    # B fires while A's handler runs, and waits for it like on the NVIC
+    def a():
+      self.advance(10)
+      self.set_pending(IRQ_B, True)
+      self.advance(5)
+    self.set_handler(IRQ_A, a)
+    self.set_handler(IRQ_B, lambda: self.advance(20))
+
+    lpf.handle_interrupt(IRQ_A)
+    self.advance(3)
+    self.set_pending(IRQ_B, False)
+    lpf.handle_interrupt(IRQ_B)
+    lpf.handle_interrupt(IRQ_B)
+    self.next_second()
+    self.assertEqual(self.stats(IRQ_A), (1, 15, 15, 0))
+    self.assertEqual(self.stats(IRQ_B), (2, 40, 20, 18))
+
+    # reset every second
+    self.next_second()
+    self.assertEqual(self.stats(IRQ_A), (0, 0, 0, 0))
+    self.assertEqual(self.stats(IRQ_B), (0, 0, 0, 0))
+
+  def test_raised_ts(self):
+    # when B fired, at the latest: A's start if it was left pending, else its own start
+    raised = []
+    def a():
+      self.set_pending(IRQ_B, True)
+      self.advance(7)
+    def b():
+      raised.append(lpf.interrupts[IRQ_B].raised_ts)
+      self.advance(2)
+    self.set_handler(IRQ_A, a)
+    self.set_handler(IRQ_B, b)
+
+    lpf.timer.CNT = 100
+    lpf.handle_interrupt(IRQ_A)
+    self.set_pending(IRQ_B, False)
+    lpf.handle_interrupt(IRQ_B)
+    self.advance(10)
+    lpf.handle_interrupt(IRQ_B)
+    self.assertEqual(raised, [100, 119])
+
+  def test_timer_wrap(self):
+    lpf.timer.CNT = 0xFFFFFFF0
+    self.set_handler(IRQ_A, lambda: self.advance(0x20))
+    lpf.handle_interrupt(IRQ_A)
+    self.next_second()
+    self.assertEqual(self.stats(IRQ_A), (1, 0x20, 0x20, 0))
+
+
+if __name__ == "__main__":
+  unittest.main()
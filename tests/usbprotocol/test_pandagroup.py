@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+import time
+import unittest
+
+from panda.python.pandagroup import PandaGroup
+
+
+class FakePanda:
+  def __init__(self, idx, delay=0.0):
+    self.idx = idx
+    self.delay = delay
+    self.rx: list = []
+    self.sent: list = []
+    self.closed = False
+
+  def can_recv(self):
+    time.sleep(self.delay)
+    ret, self.rx = self.rx, []
+    return ret
+
+  def can_send_many(self, arr, timeout=10):
+    self.sent.extend(arr)
+    # loopback
+    self.rx = self.rx + [(address, dat, bus + 128) for address, dat, bus in arr]
+
+  def get_idx(self):
+    return self.idx
+
+  def close(self):
+    self.closed = True
+
+
+class TestPandaGroup(unittest.TestCase):
+  def test_group(self):
+    devices = {"a": FakePanda(0), "b": FakePanda(1, delay=0.1), "c": FakePanda(2)}
+    with PandaGroup(devices, poll_interval=0.0001) as g:
+      self.assertEqual(g.call("get_idx"), {"a": 0, "b": 1, "c": 2})
+
+      msgs = [(0x100 + i, bytes([i]), 0) for i in range(10)]
+      g.can_send_many(msgs)
+      g.can_send_many(msgs[:1], serials=["c"])
+      for p in devices.values():
+        self.assertEqual(p.sent, msgs + (msgs[:1] if p is devices["c"] else []))
+
+      got: list = []
+      while len(got) < 31:
+        got.extend(g.can_read(timeout=2))
+
+      self.assertEqual([m[0] for m in got], sorted(m[0] for m in got))
+      for serial in devices:
+        self.assertEqual([m[2:] for m in got if m[1] == serial][:10], [(a, d, b + 128) for a, d, b in msgs])
+      self.assertEqual(g.can_read(timeout=0), [])
+
+      stats = g.stats()
+      self.assertEqual(stats["b"]["received"], 10)
+      self.assertGreater(stats["b"]["stalls"], 0)
+      self.assertEqual(stats["a"]["dropped"], 0)
+    self.assertTrue(all(p.closed for p in devices.values()))
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -2,7 +2,10 @@
 import random
 import unittest
 
+from unittest.mock import patch
+
 from panda import pack_can_buffer, unpack_can_buffer, DLC_TO_LEN
+from panda.python import canpack
 
 class PandaTestPackUnpack(unittest.TestCase):
   def test_panda_lib_pack_unpack(self):
@@ -22,5 +25,74 @@ class PandaTestPackUnpack(unittest.TestCase):
 
     self.assertEqual(unpacked, to_pack)
 
+  @unittest.skipIf(canpack.canpack_lib is None, "libcanpack isn't built")
+  def test_native_matches_python(self):
+    lib = canpack.canpack_lib
+    for _ in range(20):
+      to_pack = []
+      for _ in range(random.randrange(0, 500)):
+        address = random.choice((random.randint(0, 0x7FF), random.randint(0x800, (1 << 29) - 1)))
+        data = random.randbytes(random.choice(DLC_TO_LEN))
+        to_pack.append((address, data, random.randrange(0, 3)))
+
+      for chunk in (False, True):
+        for fd in (False, True):
+          packed = canpack.pack_can_buffer_py(to_pack, chunk=chunk, fd=fd)
+          self.assertEqual(lib.pack(to_pack, chunk=chunk, fd=fd), packed)
+
+      # split at random points, with returned and rejected flags set on some packets
+      buf = bytearray(b"".join(canpack.pack_can_buffer_py(to_pack)))
+      pos = 0
+      while pos < len(buf):
+        if random.random() < 0.2:
+          flag = random.choice((1, 2, 3))
+          buf[pos + 1] |= flag
+          buf[pos + 5] ^= flag
+        pos += 6 + DLC_TO_LEN[buf[pos] >> 4]
+
+      overflow_py, overflow_lib = b"", b""
+      while len(buf):
+        n = random.randrange(0, 300)
+        dat, buf = bytes(buf[:n]), buf[n:]
+        msgs_py, overflow_py = canpack.unpack_can_buffer_py(overflow_py + dat)
+        msgs_lib, overflow_lib = lib.unpack(overflow_lib + dat)
+        self.assertEqual(msgs_lib, msgs_py)
+        self.assertEqual(overflow_lib, overflow_py)
+
+  @unittest.skipIf(canpack.canpack_lib is None, "libcanpack isn't built")
+  def test_native_bad_checksum(self):
+    buf = bytearray(b"".join(pack_can_buffer([(0x123, b"\x01" * 8, 0)] * 3)))
+    buf[20] ^= 0xFF
+    for unpack in (canpack.unpack_can_buffer_py, canpack.canpack_lib.unpack):
+      with self.assertRaises(AssertionError):
+        unpack(bytes(buf))
+
+  def test_unpack_frames(self):
+    to_pack = []
+    for _ in range(1000):
+      address = random.choice((random.randint(0, 0x7FF), random.randint(0x800, (1 << 29) - 1)))
+      to_pack.append((address, random.randbytes(random.choice(DLC_TO_LEN)), random.randrange(0, 3)))
+    buf = bytearray(b"".join(canpack.pack_can_buffer_py(to_pack, fd=True)))
+    buf[1] |= 0x3
+    buf[5] ^= 0x3
+    buf = bytes(buf) + buf[:3]
+    expected, expected_overflow = canpack.unpack_can_buffer_py(buf)
+
+    for lib in {None, canpack.canpack_lib}:
+      with self.subTest(native=lib is not None), patch.object(canpack, "canpack_lib", lib):
+        frames, overflow = canpack.unpack_can_frames(buf, 1234)
+        self.assertEqual(overflow, expected_overflow)
+        self.assertEqual(len(frames), len(expected))
+        for f, (address, dat, bus) in zip(frames, expected, strict=True):
+          flags = int(f["flags"])
+          self.assertEqual(f["address"], address)
+          self.assertEqual(int(f["bus"]) + (128 if flags & canpack.CAN_FRAME_FLAG_RETURNED else 0) +
+                           (192 if flags & canpack.CAN_FRAME_FLAG_REJECTED else 0), bus)
+          self.assertTrue(flags & canpack.CAN_FRAME_FLAG_FD)
+          self.assertEqual(bool(flags & canpack.CAN_FRAME_FLAG_EXTENDED), address >= 0x800)
+          self.assertEqual(DLC_TO_LEN[f["dlc"]], len(dat))
+          self.assertEqual(bytes(f["data"]), dat.ljust(64, b"\x00"))
+          self.assertEqual(f["timestamp"], 1234)
+
 if __name__ == "__main__":
   unittest.main()
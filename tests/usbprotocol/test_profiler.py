@@ -0,0 +1,48 @@
+import unittest
+
+from panda import Panda
+from panda.tests.libpanda.fdcan_sim import FdcanSim, make_frame
+from panda.tests.libpanda.libpanda_py import libpanda as lpp, libpanda_fdcan as lpf
+
+PROBES = {name: i for i, name in enumerate(Panda.PROFILER_PROBES)}
+
+
+class TestProfiler(unittest.TestCase):
+  def setUp(self):
+    lpp.profiler_reset()
+
+  def record(self, probe, cycles):
+    lpp.dwt.CYCCNT = 1000
+    lpp.profiler_record(PROBES[probe], (1000 - cycles) & 0xFFFFFFFF)
+
+  def test_stats(self):
+    for c in (50, 20, 80):
+      self.record("can_rx", c)
+    s = lpp.profile_stats[PROBES["can_rx"]]
+    self.assertEqual((s.count, s.min_cycles, s.max_cycles, s.total_cycles), (3, 20, 80, 150))
+    self.assertEqual(lpp.profile_stats[PROBES["usb_irq"]].count, 0)
+
+    # counter wrapping between begin and end
+    lpp.profiler_reset()
+    self.record("usb_irq", 2000)
+    self.assertEqual(lpp.profile_stats[PROBES["usb_irq"]].min_cycles, 2000)
+    self.assertEqual(lpp.profile_stats[PROBES["can_rx"]].count, 0)
+
+  def test_probes(self):
+    sim = FdcanSim()
+    lpf.set_safety_hooks(17, 0)
+    lpf.profiler_reset()
+    for i in range(10):
+      self.assertTrue(sim.receive(0x100 + i, b"\x00" * 8, 0))
+    self.assertEqual(lpf.profile_stats[PROBES["can_rx"]].count, 10)
+    self.assertEqual(lpf.profile_stats[PROBES["safety_rx"]].count, 10)
+
+    # the TX hook only counts when it runs
+    sim.send(0x200, b"\x01", 1)
+    self.assertEqual(lpf.profile_stats[PROBES["safety_tx"]].count, 0)
+    lpf.can_send(make_frame(0x200, b"\x01", 1), 1, False)
+    self.assertEqual(lpf.profile_stats[PROBES["safety_tx"]].count, 1)
+    self.assertGreater(lpf.profile_stats[PROBES["process_can"]].count, 0)
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+import random
+import socket
+import struct
+import sys
+import unittest
+from unittest import mock
+
+from panda.python import socketpanda
+from panda.python.socketpanda import SocketPanda, pack_can_filters, CAN_EFF_FLAG, CMSG_HEADER, SOL_SOCKET, SO_RXQ_OVFL
+
+
+def random_msgs(n, fd=False):
+  lens = [0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64] if fd else list(range(9))
+  return [(random.randint(0, 0x7ff), random.randbytes(random.choice(lens)), 0) for _ in range(n)]
+
+
+@unittest.skipUnless(sys.platform == "linux" and socketpanda._libc is not None, "recvmmsg/sendmmsg are Linux only")
+class TestSocketPandaBatched(unittest.TestCase):
+  def setUp(self):
+    # datagram socketpairs keep message boundaries like CAN_RAW, enough to exercise the batching
+    self.ours, self.theirs = socket.socketpair(socket.AF_UNIX, socket.SOCK_DGRAM)
+    self.ours.setblocking(False)
+    self.theirs.setblocking(False)
+    self.ours.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 1 << 22)
+    self.theirs.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 22)
+    with mock.patch.object(socketpanda, "create_socketcan", return_value=self.ours):
+      self.p = SocketPanda("vcan0")
+    # small RX batches, so a can_recv() spans several recvmmsg calls
+    self.p._rx_bufs = socketpanda.MmsgBuffers(3, control=True)
+
+  def tearDown(self):
+    self.theirs.close()
+
+  def test_send_recv(self):
+    for fd in (False, True):
+      msgs = random_msgs(3 * socketpanda.BATCH_SIZE + 7, fd=fd)
+      self.p.can_send_many(msgs, fd=fd)
+
+      # echo back what went out
+      frames = []
+      while True:
+        try:
+          frames.append(self.theirs.recv(100))
+        except BlockingIOError:
+          break
+      self.assertEqual(len(frames), len(msgs))
+      self.assertTrue(all(len(f) == (socketpanda.CANFD_MTU if fd else socketpanda.CAN_MTU) for f in frames))
+      # in pieces, the socketpair's queue is shorter than a CAN socket's
+      received = []
+      for i in range(0, len(frames), 8):
+        for f in frames[i:i + 8]:
+          self.theirs.send(f)
+        received += self.p.can_recv()
+      self.assertEqual(received, msgs)
+      self.assertEqual(self.p.can_recv(), [])
+
+  def test_control_rearmed(self):
+    bufs = self.p._rx_bufs
+    self.theirs.send(bytes(socketpanda.CAN_MTU))
+    self.assertEqual(bufs.recv(self.ours.fileno()), 1)
+    # nothing ancillary on a socketpair
+    self.assertEqual(bufs.msgs[0].msg_hdr.msg_controllen, 0)
+    self.assertEqual(bufs.recv(self.ours.fileno()), 0)
+    self.assertEqual([m.msg_hdr.msg_controllen for m in bufs.msgs], [socketpanda.CMSG_SPACE] * bufs.n)
+
+  def test_extended_id(self):
+    self.p.can_send_many([(0x18DAF110, b"\x01", 0)])
+    can_id, = struct.unpack_from("=I", self.theirs.recv(100))
+    self.assertEqual(can_id, 0x18DAF110 | CAN_EFF_FLAG)
+
+  def test_send_timeout(self):
+    big = random_msgs(1, fd=True) * 100000
+    with self.assertRaises(TimeoutError):
+      self.p.can_send_many(big, fd=True, timeout=50)
+
+
+class TestSocketPandaHelpers(unittest.TestCase):
+  def test_pack_can_filters(self):
+    self.assertEqual(pack_can_filters([]), b"")
+    self.assertEqual(pack_can_filters([{"can_id": 0x123, "can_mask": 0x7ff}]), struct.pack("=II", 0x123, 0x7ff))
+    self.assertEqual(pack_can_filters([{"can_id": 0x123, "can_mask": 0x7ff, "extended": False}]), struct.pack("=II", 0x123, 0x7ff | CAN_EFF_FLAG))
+    self.assertEqual(pack_can_filters([{"can_id": 0x18DAF110, "can_mask": 0x1FFFFFFF, "extended": True}, {"can_id": 1, "can_mask": 1}]),
+                     struct.pack("=IIII", 0x18DAF110 | CAN_EFF_FLAG, 0x1FFFFFFF | CAN_EFF_FLAG, 1, 1))
+
+  def test_parse_rxq_ovfl(self):
+    other = CMSG_HEADER.pack(CMSG_HEADER.size + 8, SOL_SOCKET, 29) + bytes(8)
+    ovfl = CMSG_HEADER.pack(CMSG_HEADER.size + 4, SOL_SOCKET, SO_RXQ_OVFL) + struct.pack("=I", 1234) + bytes(4)
+    self.assertEqual(socketpanda._parse_rxq_ovfl(other + ovfl), 1234)
+    self.assertIsNone(socketpanda._parse_rxq_ovfl(other))
+    self.assertIsNone(socketpanda._parse_rxq_ovfl(b""))
+
+
+if __name__ == "__main__":
+  unittest.main()
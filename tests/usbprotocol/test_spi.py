@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+import os
+import random
+import unittest
+from functools import reduce
+from unittest.mock import patch
+
+from panda import Panda
+from panda.python.spi import PandaSpiHandle, xor_checksum, CHECKSUM_START, XFER_SIZE
+from panda.tests.usbprotocol.fake_spidev import fake_spi_handle
+
+class TestSpiHandle(unittest.TestCase):
+  def test_xor_checksum(self):
+    for n in list(range(20)) + [random.randrange(20, 5000) for _ in range(50)]:
+      dat = random.randbytes(n)
+      assert xor_checksum(dat) == reduce(lambda a, b: a ^ b, dat, CHECKSUM_START)
+      assert xor_checksum(memoryview(dat), 0) == reduce(lambda a, b: a ^ b, dat, 0)
+
+  def _check_transfers(self, h, spi):
+    assert h.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, 20) == b"\xd2" * 20
+    h.controlWrite(Panda.REQUEST_OUT, 0xdb, 1, 0, b"")
+
+    for n in (0, 1, 100, XFER_SIZE, XFER_SIZE + 100):
+      dat = random.randbytes(n)
+      spi.bulk_data[:] = dat
+      assert h.bulkRead(1, 2 * XFER_SIZE) == dat
+
+    spi.written.clear()
+    dat = random.randbytes(XFER_SIZE + 100)
+    assert h.bulkWrite(3, dat) == len(dat)
+    assert spi.written == [(3, dat[:XFER_SIZE]), (3, dat[XFER_SIZE:])]
+
+  def test_transfers(self):
+    for version in (2, 3):
+      for crc32 in (False, True):
+        with self.subTest(version=version, crc32=crc32), fake_spi_handle() as (h, spi):
+          h.protocol_version = version
+          h.crc32 = crc32
+          self._check_transfers(h, spi)
+          assert (spi.gaps > 0) == (version == 3)
+
+  def test_v3_opt_in(self):
+    with fake_spi_handle() as (h, spi):
+      with patch.dict(os.environ, {"SPI_V3": "0"}):
+        h = PandaSpiHandle(h.dev)
+      h.protocol_version = 3
+      self._check_transfers(h, spi)
+      assert spi.gaps == 0
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+import os
+import threading
+import time
+import unittest
+from unittest import mock
+
+import usb1
+
+from panda.python.usbregistry import UsbRegistry
+
+
+class FakeDevice:
+  def __init__(self, address, serial, vid=0xbbaa, pid=0xddcc):
+    self.address = address
+    self.serial = serial
+    self.vid = vid
+    self.pid = pid
+    self.serial_reads = 0
+
+  def getBusNumber(self):
+    return 1
+
+  def getDeviceAddress(self):
+    return self.address
+
+  def getVendorID(self):
+    return self.vid
+
+  def getProductID(self):
+    return self.pid
+
+  def getSerialNumber(self):
+    self.serial_reads += 1
+    if isinstance(self.serial, Exception):
+      raise self.serial
+    return self.serial
+
+
+class FakeContext:
+  def __init__(self, devices):
+    self.devices = devices
+    self.callback = None
+
+  def open(self):
+    pass
+
+  def close(self):
+    pass
+
+  def hasCapability(self, cap):
+    return cap == usb1.CAP_HAS_HOTPLUG
+
+  def hotplugRegisterCallback(self, callback, flags=0):
+    self.callback = callback
+    for d in self.devices:
+      callback(self, d, usb1.HOTPLUG_EVENT_DEVICE_ARRIVED)
+
+  def handleEventsTimeout(self, tv=0):
+    time.sleep(0.01)
+
+  def plug(self, d):
+    self.callback(self, d, usb1.HOTPLUG_EVENT_DEVICE_ARRIVED)
+
+  def unplug(self, d):
+    self.callback(self, d, usb1.HOTPLUG_EVENT_DEVICE_LEFT)
+
+
+class TestUsbRegistry(unittest.TestCase):
+  def setUp(self):
+    self.panda = FakeDevice(2, "a" * 24)
+    self.other = FakeDevice(3, "other", vid=0x1234)
+    self.ctx = FakeContext([self.panda, self.other])
+    self.reg = UsbRegistry(self.ctx)
+
+  def test_existing_devices(self):
+    self.assertEqual(self.reg.devices((0xbbaa, ), (0xddcc, )), [(self.panda, "a" * 24)])
+    self.assertEqual(self.other.serial_reads, 0)
+
+  def test_serial_read_once(self):
+    for _ in range(3):
+      self.reg.devices((0xbbaa, ), (0xddcc, ))
+    self.assertEqual(self.panda.serial_reads, 1)
+
+  def test_serial_retried_after_error(self):
+    d = FakeDevice(4, usb1.USBError("not ready"))
+    self.ctx.plug(d)
+    self.assertEqual(len(self.reg.devices((0xbbaa, ), (0xddcc, ), no_error=True)), 1)
+    d.serial = "b" * 24
+    self.assertIn((d, "b" * 24), self.reg.devices((0xbbaa, ), (0xddcc, )))
+
+  def test_unplug_replug(self):
+    self.ctx.unplug(self.panda)
+    self.assertEqual(self.reg.devices((0xbbaa, ), (0xddcc, )), [])
+
+    # a reset panda comes back at a new address and its serial is read again
+    back = FakeDevice(5, "a" * 24)
+    self.ctx.plug(back)
+    self.assertEqual(self.reg.devices((0xbbaa, ), (0xddcc, )), [(back, "a" * 24)])
+
+  def test_wait(self):
+    gen = self.reg.generation
+    self.assertFalse(self.reg.wait(gen, timeout=0.01))
+
+    t = threading.Timer(0.05, self.ctx.plug, args=(FakeDevice(6, "c" * 24), ))
+    t.start()
+    st = time.monotonic()
+    self.assertTrue(self.reg.wait(gen, timeout=5))
+    self.assertLess(time.monotonic() - st, 1)
+    t.join()
+
+    # a change before the wait isn't missed
+    gen = self.reg.generation
+    self.ctx.unplug(self.panda)
+    self.assertTrue(self.reg.wait(gen, timeout=0))
+
+  def test_fork(self):
+    # a fresh process wide registry, on fake contexts
+    with mock.patch.object(UsbRegistry, "_instance", None), mock.patch.object(UsbRegistry, "_unsupported", False), \
+         mock.patch("usb1.USBContext", lambda: FakeContext([FakeDevice(2, "a" * 24)])):
+      parent = UsbRegistry.get()
+      self.assertIsNotNone(parent)
+
+      pid = os.fork()
+      if pid == 0:
+        # the child reconnects through its own context and event thread
+        status = 1
+        try:
+          reg = UsbRegistry.get()
+          if reg is not None and reg is not parent and reg._thread.is_alive() and \
+             reg.devices((0xbbaa, ), (0xddcc, )) == [(reg.context.devices[0], "a" * 24)]:
+            status = 0
+        finally:
+          os._exit(status)
+
+      _, status = os.waitpid(pid, 0)
+      self.assertEqual(os.waitstatus_to_exitcode(status), 0)
+      self.assertIs(UsbRegistry.get(), parent)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+import random
+import time
+import unittest
+
+from opendbc.car.structs import CarParams
+from panda.tests.libpanda.virtual_panda import VirtualPanda
+
+
+def random_msgs(n, bus=0):
+  return [(random.randint(1, 0x7ff), random.randbytes(8), bus) for _ in range(n)]
+
+
+def recv_all(p, n, timeout=5):
+  ret = []
+  st = time.monotonic()
+  while len(ret) < n and time.monotonic() - st < timeout:
+    ret += p.can_recv()
+  return ret
+
+
+class TestVirtualPanda(unittest.TestCase):
+  def setUp(self):
+    self.p = VirtualPanda(simulate_bitrate=False)
+    self.p.set_safety_mode(CarParams.SafetyModel.allOutput)
+
+  def tearDown(self):
+    # libpanda is shared with the other tests
+    self.p.reset(reconnect=False)
+
+  def test_connect(self):
+    self.assertEqual(self.p.get_type(), VirtualPanda.HW_TYPE_RED_PANDA)
+    self.assertEqual(self.p.get_connect_config()["can_speed"], [5000] * 3)
+    self.assertEqual(self.p.health()["safety_mode"], CarParams.SafetyModel.allOutput)
+
+  def test_returned(self):
+    msgs = random_msgs(1000, bus=1)
+    self.p.can_send_many(msgs)
+    rx = recv_all(self.p, len(msgs))
+    self.assertEqual(rx, [(a, d, b + 128) for a, d, b in msgs])
+    self.assertEqual(self.p.can_health(1)["total_tx_cnt"], len(msgs))
+
+  def test_loopback(self):
+    self.p.set_can_loopback(True)
+    msgs = random_msgs(300, bus=2)
+    self.p.can_send_many(msgs)
+    rx = recv_all(self.p, 2 * len(msgs))
+    self.assertEqual([m for m in rx if m[2] == 2], msgs)
+    self.assertEqual([m for m in rx if m[2] == 130], [(a, d, 130) for a, d, _ in msgs])
+
+  def test_safety_rejects(self):
+    self.p.set_safety_mode(CarParams.SafetyModel.silent)
+    self.p.can_send(0x123, b"\x01", 0)
+    self.assertEqual(recv_all(self.p, 1), [(0x123, b"\x01", 192)])
+    self.assertEqual(self.p.health()["safety_tx_blocked"], 1)
+
+  def test_bitrate(self):
+    p = VirtualPanda(simulate_bitrate=True)
+    p.set_safety_mode(CarParams.SafetyModel.allOutput)
+    p.set_can_speed_kbps(0, 500)
+    # 111 bit times each at 500 kbps
+    msgs = random_msgs(2000)
+    st = time.monotonic()
+    p.can_send_many(msgs)
+    self.assertEqual(len(recv_all(p, len(msgs))), len(msgs))
+    self.assertGreater(time.monotonic() - st, 2000 * 111 / 500e3 * 0.9)
+
+  def test_telemetry_rate(self):
+    records = []
+    def stream(seconds):
+      records.clear()
+      st = time.monotonic()
+      while time.monotonic() - st < seconds:
+        self.assertEqual(self.p.can_recv(), [])
+      return records.count("health")
+
+    self.p.set_telemetry_rate(4, callback=lambda name, bus, record: records.append(name))
+    self.assertIn(stream(1), (3, 4, 5))
+    with self.assertRaises(ValueError):
+      self.p.set_telemetry_rate(3)
+
+    # the panda ignores inexact rates and keeps the last one
+    self.p._handle.controlWrite(VirtualPanda.REQUEST_OUT, 0xc7, 3, 0, b'')
+    self.assertIn(stream(1), (3, 4, 5))
+
+    # a new client doesn't inherit the stream
+    self.p.can_reset_communications()
+    self.assertEqual(stream(0.5), 0)
+
+
+if __name__ == "__main__":
+  unittest.main()